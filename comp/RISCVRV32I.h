@@ -1,69 +1,78 @@
-#pragma once
-#include "../compiler/AsmDefinition.h"
-
-inline AsmDefinition RISCVRV32I(
-    "RISC-V",
-    "RV32I",
-    {"x0","x1","x2","x3","x4","x5","x6","x7","x8","x9","x10","x11","x12","x13","x14","x15",
-     "x16","x17","x18","x19","x20","x21","x22","x23","x24","x25","x26","x27","x28","x29","x30","x31"},
-    {
-        // Arithmetic and logic
-        {"add",   "{d} = {s1} + {s2};"},
-        {"sub",   "{d} = {s1} - {s2};"},
-        {"sll",   "{d} = {s1} << ({s2} & 0x1F);"},
-        {"slt",   "{d} = ({s1} < {s2}) ? 1 : 0;"},
-        {"sltu",  "{d} = ((uint32_t){s1} < (uint32_t){s2}) ? 1 : 0;"},
-        {"xor",   "{d} = {s1} ^ {s2};"},
-        {"srl",   "{d} = ((uint32_t){s1}) >> ({s2} & 0x1F);"},
-        {"sra",   "{d} = {s1} >> ({s2} & 0x1F);"},
-        {"or",    "{d} = {s1} | {s2};"},
-        {"and",   "{d} = {s1} & {s2};"},
-
-        // Immediate arithmetic
-        {"addi",  "{d} = {s1} + {imm};"},
-        {"slti",  "{d} = ({s1} < {imm}) ? 1 : 0;"},
-        {"sltiu", "{d} = ((uint32_t){s1} < (uint32_t){imm}) ? 1 : 0;"},
-        {"xori",  "{d} = {s1} ^ {imm};"},
-        {"ori",   "{d} = {s1} | {imm};"},
-        {"andi",  "{d} = {s1} & {imm};"},
-        {"slli",  "{d} = {s1} << ({imm} & 0x1F);"},
-        {"srli",  "{d} = ((uint32_t){s1}) >> ({imm} & 0x1F);"},
-        {"srai",  "{d} = {s1} >> ({imm} & 0x1F);"},
-
-        // Load / store
-        {"lb",    "{d} = (int8_t)mem[{addr}];"},
-        {"lh",    "{d} = (int16_t)mem[{addr}];"},
-        {"lw",    "{d} = mem[{addr}];"},
-        {"lbu",   "{d} = (uint8_t)mem[{addr}];"},
-        {"lhu",   "{d} = (uint16_t)mem[{addr}];"},
-        {"sb",    "mem[{addr}] = (uint8_t){s};"},
-        {"sh",    "mem[{addr}] = (uint16_t){s};"},
-        {"sw",    "mem[{addr}] = {s};"},
-
-        // Control flow
-        {"beq",   "if ({s1} == {s2}) goto {label};"},
-        {"bne",   "if ({s1} != {s2}) goto {label};"},
-        {"blt",   "if ({s1} < {s2}) goto {label};"},
-        {"bge",   "if ({s1} >= {s2}) goto {label};"},
-        {"bltu",  "if ((uint32_t){s1} < (uint32_t){s2}) goto {label};"},
-        {"bgeu",  "if ((uint32_t){s1} >= (uint32_t){s2}) goto {label};"},
-        {"jal",   "{d} = PC + 4; goto {label};"},
-        {"jalr",  "{d} = PC + 4; PC = ({s1} + {imm}) & ~1;"},
-
-        // Upper immediates
-        {"lui",   "{d} = {imm} << 12;"},
-        {"auipc", "{d} = PC + ({imm} << 12);"},
-
-        // System
-        {"ecall", "system_call();"},
-        {"ebreak","debug_break();"},
-
-        // Macros a compiler would likely have? I hope
-        {"print", "a7 = 4; a0 = (intptr_t){s1}; system_call();"},
-        // RISC-V Linux ABI: exit is syscall 93. Default to status 0.
-        {"exit",  "a0 = 0; a7 = 93; system_call();"},
-        {"li",    "{d} = {imm};"},
-        {"mv",    "{d} = {s1};"}
-    }
-);
-
+#pragma once
+#include "../compiler/AsmDefinition.h"
+
+inline constexpr std::string_view RISCVRV32I_TRAITS[] = {
+    "x0","x1","x2","x3","x4","x5","x6","x7","x8","x9","x10","x11","x12","x13","x14","x15",
+    "x16","x17","x18","x19","x20","x21","x22","x23","x24","x25","x26","x27","x28","x29","x30","x31"
+};
+
+// Results wrap to 32 bits (as in MIPS32.h) whatever width the registers get.
+inline constexpr OpDef RISCVRV32I_OPS[] = {
+    // Arithmetic and logic
+    {"add",   "{d} = (int32_t)((uint32_t){s1} + (uint32_t){s2});"},
+    {"sub",   "{d} = (int32_t)((uint32_t){s1} - (uint32_t){s2});"},
+    {"sll",   "{d} = (int32_t)((uint32_t){s1} << ({s2} & 0x1F));"},
+    {"slt",   "{d} = ((int32_t){s1} < (int32_t){s2}) ? 1 : 0;"},
+    {"sltu",  "{d} = ((uint32_t){s1} < (uint32_t){s2}) ? 1 : 0;"},
+    {"xor",   "{d} = (int32_t)((uint32_t){s1} ^ (uint32_t){s2});"},
+    {"srl",   "{d} = (int32_t)((uint32_t){s1} >> ({s2} & 0x1F));"},
+    {"sra",   "{d} = (int32_t){s1} >> ({s2} & 0x1F);"},
+    {"or",    "{d} = (int32_t)((uint32_t){s1} | (uint32_t){s2});"},
+    {"and",   "{d} = (int32_t)((uint32_t){s1} & (uint32_t){s2});"},
+
+    // Immediate arithmetic
+    {"addi",  "{d} = (int32_t)((uint32_t){s1} + (uint32_t){imm});"},
+    {"slti",  "{d} = ((int32_t){s1} < (int32_t){imm}) ? 1 : 0;"},
+    {"sltiu", "{d} = ((uint32_t){s1} < (uint32_t){imm}) ? 1 : 0;"},
+    {"xori",  "{d} = (int32_t)((uint32_t){s1} ^ (uint32_t){imm});"},
+    {"ori",   "{d} = (int32_t)((uint32_t){s1} | (uint32_t){imm});"},
+    {"andi",  "{d} = (int32_t)((uint32_t){s1} & (uint32_t){imm});"},
+    {"slli",  "{d} = (int32_t)((uint32_t){s1} << ({imm} & 0x1F));"},
+    {"srli",  "{d} = (int32_t)((uint32_t){s1} >> ({imm} & 0x1F));"},
+    {"srai",  "{d} = (int32_t){s1} >> ({imm} & 0x1F);"},
+
+    // Load / store
+    {"lb",    "{d} = load_i8({s1});"},
+    {"lh",    "{d} = load_i16({s1});"},
+    {"lw",    "{d} = load_i32({s1});"},
+    {"lbu",   "{d} = load_u8({s1});"},
+    {"lhu",   "{d} = load_u16({s1});"},
+    {"sb",    "store_8({s1}, (uint8_t){s2});"},
+    {"sh",    "store_16({s1}, (uint16_t){s2});"},
+    {"sw",    "store_32({s1}, (uint32_t){s2});"},
+
+    // Control flow
+    {"beq",   "if ({s1} == {s2}) goto {label};"},
+    {"bne",   "if ({s1} != {s2}) goto {label};"},
+    {"blt",   "if ((int32_t){s1} < (int32_t){s2}) goto {label};"},
+    {"bge",   "if ((int32_t){s1} >= (int32_t){s2}) goto {label};"},
+    {"bltu",  "if ((uint32_t){s1} < (uint32_t){s2}) goto {label};"},
+    {"bgeu",  "if ((uint32_t){s1} >= (uint32_t){s2}) goto {label};"},
+    {"jal",   "{d} = PC + 4; goto {label};"},
+    {"jalr",  "{ intptr_t _target = ({s1} + {imm}) & ~1; {d} = PC + 4; PC = _target; }"},
+    {"jr",    "PC = {s1};"},
+
+    // Upper immediates
+    {"lui",   "{d} = (int32_t)((uint32_t){imm} << 12);"},
+    {"auipc", "{d} = (int32_t)((uint32_t)PC + ((uint32_t){imm} << 12));"},
+
+    // System
+    {"ecall", "system_call();"},
+    {"ebreak","debug_break();"},
+
+    // Macros a compiler would likely have? I hope
+    {"print", "a7 = 4; a0 = (intptr_t){s1}; system_call();"},
+    // RISC-V Linux ABI: exit is syscall 93. Default to status 0.
+    {"exit",  "a0 = 0; a7 = 93; system_call();"},
+    {"li",    "{d} = (int32_t){imm};"},
+    {"mv",    "{d} = {s1};"}
+};
+
+// Costs that differ from their class (Estimate.h): an indirect jump's target
+// is known late.
+inline constexpr OpCost RISCVRV32I_COSTS[] = {
+    {"jalr", 1, 3}, {"jr", 1, 3}
+};
+
+inline constexpr ArchTable<RISCVRV32I_TRAITS, RISCVRV32I_OPS> RISCVRV32I_TABLE{};
+inline constexpr AsmDefinition RISCVRV32I = RISCVRV32I_TABLE.define("RISC-V", "RV32I", 32, "x0", "x2").costed(RISCVRV32I_COSTS);
@@ -0,0 +1,46 @@
+#pragma once
+#include "../compiler/AsmDefinition.h"
+#include "RISCVRV64I.h"
+
+// RV64I plus the "A" extension. LR/SC and the AMOs call the runtime's C11
+// atomics on naturally aligned guest words (Runtime.h); every one is
+// sequentially consistent, so .aq/.rl/.aqrl select the plain template.
+// Harts run side by side on host threads with registers of their own: each
+// starts at the first instruction with its id in a0, the hart count in a1
+// and a stack of its own below the one before it.
+inline constexpr OpDef RISCVRV64IA_ATOMICS[] = {
+    // Load-reserved / store-conditional (sc writes 0 on success)
+    {"lr.w",      "{d} = amo_lr_32({s1});"},
+    {"sc.w",      "{d} = amo_sc_32({s2}, {s1});"},
+    {"lr.d",      "{d} = amo_lr_64({s1});"},
+    {"sc.d",      "{d} = amo_sc_64({s2}, {s1});"},
+
+    // Atomic read-modify-write: rd gets the old value, sign-extended
+    {"amoswap.w", "{d} = amo_swap_32({s2}, {s1});"},
+    {"amoadd.w",  "{d} = amo_add_32({s2}, {s1});"},
+    {"amoxor.w",  "{d} = amo_xor_32({s2}, {s1});"},
+    {"amoand.w",  "{d} = amo_and_32({s2}, {s1});"},
+    {"amoor.w",   "{d} = amo_or_32({s2}, {s1});"},
+    {"amomin.w",  "{d} = amo_min_32({s2}, {s1});"},
+    {"amomax.w",  "{d} = amo_max_32({s2}, {s1});"},
+    {"amominu.w", "{d} = amo_minu_32({s2}, {s1});"},
+    {"amomaxu.w", "{d} = amo_maxu_32({s2}, {s1});"},
+    {"amoswap.d", "{d} = amo_swap_64({s2}, {s1});"},
+    {"amoadd.d",  "{d} = amo_add_64({s2}, {s1});"},
+    {"amoxor.d",  "{d} = amo_xor_64({s2}, {s1});"},
+    {"amoand.d",  "{d} = amo_and_64({s2}, {s1});"},
+    {"amoor.d",   "{d} = amo_or_64({s2}, {s1});"},
+    {"amomin.d",  "{d} = amo_min_64({s2}, {s1});"},
+    {"amomax.d",  "{d} = amo_max_64({s2}, {s1});"},
+    {"amominu.d", "{d} = amo_minu_64({s2}, {s1});"},
+    {"amomaxu.d", "{d} = amo_maxu_64({s2}, {s1});"},
+
+    // Orders every access before it against every access after it
+    {"fence",     "amo_fence();"}
+};
+
+inline constexpr auto RISCVRV64IA_OPS = extendOps(RISCVRV64I_OPS, RISCVRV64IA_ATOMICS);
+
+inline constexpr ArchTable<RISCVRV64I_TRAITS, RISCVRV64IA_OPS> RISCVRV64IA_TABLE{};
+inline constexpr AsmDefinition RISCVRV64IA = RISCVRV64IA_TABLE.define("RISC-V", "RV64IA", 64, "x0", "x2")
+    .costed(RISCVRV64I_COSTS).multiHart("a0", "a1");
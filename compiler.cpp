@@ -1,476 +1,1859 @@
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string>
-#include <set>
-#include <vector>
-#include <unordered_map>
-#include <cctype>
-#include <cstdlib>
-#include <algorithm>
-#include "compiler/architectures.h"
-
-struct DataSymbol { std::string name, ctype, value; };
-
-std::string readText(const std::string& path) {
-    std::ifstream in(path);
-    std::stringstream ss; ss << in.rdbuf();
-    return ss.str();
-}
-
-static inline bool isIdentStart(char c){ return std::isalpha((unsigned char)c) || c=='_'; }
-static inline bool isIdentChar(char c){ return std::isalnum((unsigned char)c) || c=='_'; }
-static inline bool contains(const std::string& s, const char* sub){ return s.find(sub)!=std::string::npos; }
-
-static inline std::string toLower(std::string s){
-    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
-    return s;
-}
-
-static inline std::string normalizeArchKey(std::string s) {
-    s = toLower(std::move(s));
-    s.erase(std::remove_if(s.begin(), s.end(), [](unsigned char c){
-        return c==' ' || c=='-' || c=='_';
-    }), s.end());
-    return s;
-}
-
-static inline bool archKeyMatches(const AsmDefinition* def, const std::string& specRaw) {
-    const std::string spec = normalizeArchKey(specRaw);
-    const std::string kFull = normalizeArchKey(def->fullName());
-    const std::string kGT   = normalizeArchKey(def->GT);
-    const std::string kSBST = normalizeArchKey(def->SBST);
-    if (spec == kFull || spec == kGT || (!kSBST.empty() && spec == kSBST)) return true;
-    if (!def->SBST.empty()) {
-        std::string concat = kGT + kSBST;
-        if (spec == concat) return true;
-    }
-    return false;
-}
-
-static inline AsmDefinition* findArchBySpec(const std::string& spec) {
-    for (auto* def : architectures)
-        if (archKeyMatches(def, spec)) return def;
-    return nullptr;
-}
-
-AsmDefinition* guessArchitecture(const std::string& source) {
-    std::unordered_map<const AsmDefinition*, int> scores;
-    std::istringstream words(source);
-    std::string tok;
-    while (words >> tok) {
-        for (auto* def : architectures) {
-            if (def->dict.count(tok)) scores[def] += 3;
-            for (auto& r : def->traits)
-                if (tok == r) scores[def] += 1;
-        }
-    }
-    AsmDefinition* best = nullptr;
-    int bestScore = 0;
-    for (auto* def : architectures) {
-        int s = scores[def];
-        if (s > bestScore) { bestScore = s; best = def; }
-    }
-    return best;
-}
-
-std::vector<DataSymbol> parseDataSection(const std::string& src, std::set<std::string>& dataLabels) {
-    std::vector<DataSymbol> data;
-    std::istringstream ss(src);
-    std::string line;
-    bool inData = false;
-    while (std::getline(ss, line)) {
-        size_t a = line.find_first_not_of(" \t"); if (a==std::string::npos) continue;
-        size_t b = line.find_last_not_of(" \t\r\n"); line = line.substr(a, b-a+1);
-        if (line.empty() || line[0]=='#') continue;
-        if (line.find(".data")!=std::string::npos) { inData = true; continue; }
-        if (line.find(".text")!=std::string::npos) { inData = false; break; }
-        if (!inData) continue;
-        size_t colon = line.find(':'); if (colon==std::string::npos) continue;
-        std::string name = line.substr(0, colon);
-        size_t n0 = name.find_first_not_of(" \t"); size_t n1 = name.find_last_not_of(" \t");
-        name = name.substr(n0, n1-n0+1);
-        dataLabels.insert(name);
-        std::string rest = line.substr(colon+1);
-        size_t r0 = rest.find_first_not_of(" \t"); if (r0==std::string::npos) continue;
-        rest = rest.substr(r0);
-        std::istringstream lr(rest);
-        std::string directive; lr >> directive;
-        std::string after; std::getline(lr, after);
-        size_t a0 = after.find_first_not_of(" \t"); if (a0!=std::string::npos) after = after.substr(a0); else after.clear();
-        if (directive==".word") {
-            data.push_back({name,"uint32_t", after});
-        } else if (directive==".dword") {
-            data.push_back({name,"uint64_t", after});
-        } else if (directive==".asciiz") {
-            std::string value; 
-            size_t q1 = after.find('"');
-            if (q1!=std::string::npos) {
-                size_t q2 = after.find_last_of('"');
-                if (q2!=std::string::npos && q2>q1) value = after.substr(q1, q2-q1+1);
-            }
-            if (value.empty()) value = "\"" + after + "\"";
-            data.push_back({name,"char[]", value});
-        }
-    }
-    return data;
-}
-
-std::set<std::string> collectTextLabels(const std::string& src) {
-    std::set<std::string> labels;
-    std::istringstream ss(src);
-    std::string line; bool inText=false;
-    while (std::getline(ss, line)) {
-        if (line.find(".text")!=std::string::npos) { inText=true; continue; }
-        if (!inText) continue;
-        size_t a = line.find_first_not_of(" \t"); if (a==std::string::npos) continue;
-        size_t b = line.find_last_not_of(" \r\n"); std::string t = line.substr(a, b-a+1);
-        if (!t.empty() && t.back()==':') {
-            t.pop_back();
-            size_t i=0; while (i<t.size() && (t[i]==' '||t[i]=='\t')) ++i;
-            std::string name = t.substr(i);
-            if (!name.empty()) labels.insert(name);
-        }
-    }
-    return labels;
-}
-
-bool needsPC(const std::string& src) {
-    std::istringstream ss(src);
-    std::string line, op;
-    while (std::getline(ss, line)) {
-        std::istringstream is(line);
-        if (is >> op) if (op=="auipc"||op=="jal"||op=="jalr") return true;
-    }
-    return false;
-}
-
-std::set<std::string> collectSymbols(const std::string& src, const std::set<std::string>& allLabels) {
-    std::set<std::string> syms;
-    std::istringstream ss(src);
-    std::string line; bool inText=false;
-    while (std::getline(ss, line)) {
-        if (line.find(".text")!=std::string::npos) { inText=true; continue; }
-        if (!inText) continue;
-        std::istringstream is(line);
-        std::string op,d,s1,s2; is >> op >> d >> s1 >> s2;
-        auto norm = [&](std::string& t){
-            while (!t.empty() && (t.back()==',' || t.back()==' ' || t.back()=='\t'))
-            t.pop_back();
-        };
-        norm(d); norm(s1); norm(s2);
-        auto add=[&](const std::string& t){
-            if (t.empty()) return;
-            if (t[0]=='.') return;
-            if (t.find('"')!=std::string::npos) return;
-            if (allLabels.count(t)) return;
-            if (!isIdentStart(t[0])) return;
-            for(char c: t) if(!isIdentChar(c)) return;
-            syms.insert(t);
-        };
-        add(d); add(s1); add(s2);
-    }
-    return syms;
-}
-
-std::string resolveOperand(std::string tok, const std::set<std::string>& allLabels) {
-    if (tok.empty()) return tok;
-    while (!tok.empty() && (tok.back()==',' || tok.back()==' ' || tok.back()=='\t'))
-        tok.pop_back();
-
-    size_t lp = tok.find('(');
-    size_t rp = tok.find(')');
-    if (lp != std::string::npos && rp != std::string::npos && rp > lp) {
-        std::string imm = tok.substr(0, lp);
-        std::string reg = tok.substr(lp + 1, rp - lp - 1);
-        auto trim = [](std::string s){
-            size_t a = s.find_first_not_of(" \t");
-            size_t b = s.find_last_not_of(" \t");
-            return (a==std::string::npos)?std::string():s.substr(a,b-a+1);
-        };
-        imm = trim(imm);
-        reg = trim(reg);
-        if (imm.empty()) imm = "0";
-        return "(" + reg + " + " + imm + ")";
-    }
-
-    if (allLabels.count(tok))
-        return "(uintptr_t)&" + tok;
-
-    return tok;
-}
-
-std::string translateLine(const std::string& raw, const AsmDefinition* def, const std::set<std::string>& allLabels) {
-    auto sanitize = [](std::string s) {
-        for (char& c : s)
-            if (!std::isalnum((unsigned char)c) && c != '_') c = '_';
-        return s;
-    };
-    auto maybeSanitize = [&](std::string t) -> std::string {
-        if (t.empty()) return t;
-        if (std::isdigit((unsigned char)t[0])) return t;
-        if (t[0] == 'x' && t.size() <= 4) return t;
-        if (t.find("x") != std::string::npos) return t;
-        if (t.find("(intptr_t)") != std::string::npos) return t;
-        if (t.find("(uintptr_t)") != std::string::npos) return t;
-        if (t.find("&") != std::string::npos) return t;
-        if (t.find("+") != std::string::npos || t.find("-") != std::string::npos) return t;
-        return sanitize(t);
-    };
-    std::string line = raw;
-    size_t h=line.find('#'); if(h!=std::string::npos) line=line.substr(0,h);
-    size_t sc=line.find(';'); if(sc!=std::string::npos) line=line.substr(0,sc);
-    while(!line.empty() && (line.back()==' '||line.back()=='\t'||line.back()=='\r')) line.pop_back();
-    size_t l=0; while(l<line.size() && (line[l]==' '||line[l]=='\t')) ++l;
-    if (l>=line.size()) return "";
-    std::string s = line.substr(l);
-    if (s.back()==':') return "";
-    std::istringstream iss(s);
-    std::string opcode; iss >> opcode;
-    if (opcode==".globl"||opcode==".section"||opcode==".text"||opcode==".data") return "";
-    auto it = def->dict.find(opcode);
-    if (it==def->dict.end()) return "";
-    std::string tmpl = it->second;
-    std::string a,b,c; iss >> a >> b >> c;
-    // !!!Do not strip closing parenthesis here!!! resolveOperand needs the full "imm(base)" form (e.g., "0(x1)") to transform it into a valid C expression like "(x1 + 0)".
-    auto norm=[&](std::string& t){
-        if (!t.empty() && t.back()==',') t.pop_back();
-    };
-    if (opcode=="sb" || opcode=="sh" || opcode=="sw" || opcode=="sd") {
-        if (c.empty() && !a.empty() && !b.empty()) {
-            c = a;
-            a.clear();
-        }
-    }
-    norm(a); norm(b); norm(c);
-    a=resolveOperand(a,allLabels);
-    b=resolveOperand(b,allLabels);
-    c=resolveOperand(c,allLabels);
-    a = maybeSanitize(a);
-    b = maybeSanitize(b);
-    c = maybeSanitize(c);
-    bool hasD   = contains(tmpl,"{d}");
-    bool hasS1  = contains(tmpl,"{s1}");
-    if (!hasD && hasS1 && a.size() && b.empty()) { b=a; a.clear(); }
-    auto repl=[&](const std::string& key,const std::string& val){
-        size_t p=0;
-        while((p=tmpl.find(key,p))!=std::string::npos){
-            tmpl.replace(p,key.size(),val);
-            p+=val.size();
-        }
-    };
-    if (tmpl.find("{imm}") != std::string::npos && c.empty() && !b.empty()) c = b;
-    if (tmpl.find("{label}") != std::string::npos && c.empty() && !b.empty()) c = b;
-    repl("{d}",  a);
-    repl("{s1}", b);
-    repl("{s2}", c);
-    repl("{imm}", c);
-    repl("{addr}", c);
-    repl("{label}", c);
-    return tmpl + "\n";
-}
-
-static void printArchitecturesGrouped() {
-    std::unordered_map<std::string, std::vector<const AsmDefinition*>> byGT;
-    for (auto* def : architectures)
-        byGT[def->GT].push_back(def);
-    for (auto& [gt, defs] : byGT) {
-        std::cout << gt << "\n";
-        for (auto* def : defs) {
-            std::string subset = def->SBST.empty() ? "(generic)" : def->SBST;
-            std::cout << " - " << subset << " (" << def->definitionCount << " defs)\n";
-        }
-        std::cout << "\n";
-    }
-}
-
-bool requiresRuntime(const AsmDefinition* def) {
-    for (auto& kv : def->dict) {
-        const std::string& t = kv.second;
-        if (t.find("system_call")!=std::string::npos || t.find("debug_break")!=std::string::npos) return true;
-    }
-    return false;
-}
-
-std::string getOutputName(const std::string& inputPath) {
-    size_t dot = inputPath.find_last_of('.');
-    size_t slash = inputPath.find_last_of("/\\");
-    std::string stem = (slash==std::string::npos) ? inputPath.substr(0,dot) : inputPath.substr(slash+1, dot - slash - 1);
-    return stem + ".exe";
-}
-
-std::string detectArchHint(const std::string& source) {
-    std::istringstream ss(source);
-    std::string line;
-    while (std::getline(ss, line)) {
-        size_t start = line.find_first_not_of(" \t\r");
-        if (start == std::string::npos) continue;
-        size_t end = line.find_last_not_of(" \t\r\n");
-        std::string trimmed = line.substr(start, end - start + 1);
-        if (trimmed.empty()) continue;
-        if (trimmed.rfind(";!", 0) == 0 && trimmed.find("!;") != std::string::npos) {
-            size_t a = 2;
-            size_t b = trimmed.find("!;", a);
-            std::string inner = trimmed.substr(a, b - a);
-            size_t i0 = inner.find_first_not_of(" \t");
-            size_t i1 = inner.find_last_not_of(" \t");
-            if (i0 != std::string::npos)
-                inner = inner.substr(i0, i1 - i0 + 1);
-            return inner;
-        }
-        break;
-    }
-    return "";
-}
-
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cout << "EZM 1.A018.22.251023\n"
-                  << "Usage: ezm [options] <file.ezm>\n\n"
-                  << "Options:\n"
-                  << "  -arch <name>   Force architecture (e.g. \"RISC-V RV32I\")\n"
-                  << "  -k             Keep temp.c after compilation\n\n"
-                  << "Architectures:\n";
-            printArchitecturesGrouped();
-        return 0;
-    }
-    bool keepTemp = false;
-    bool runAfter = false;
-    std::string archName, filePath;
-    for (int i=1; i<argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "-k") { keepTemp = true; continue; }
-        if (arg == "-r") { runAfter = true; continue; }
-        if (arg == "-arch" && i+1 < argc) { archName = argv[++i]; continue; }
-        if (arg[0] != '-') { filePath = arg; }
-    }
-    if (filePath.empty()) { std::cerr << "No input file.\n"; return 1; }
-    std::string source = readText(filePath);
-    AsmDefinition* arch = nullptr;
-    if (!archName.empty()) {
-        arch = findArchBySpec(archName);
-        if (!arch) {
-            std::cerr << "Unknown architecture: " << archName << "\n";
-            return 1;
-        }
-    } else {
-        std::string hintedArch = detectArchHint(source);
-        if (!hintedArch.empty()) {
-            arch = findArchBySpec(hintedArch);
-            if (!arch)
-                std::cerr << "Warning: Unknown architecture hint \"" << hintedArch << "\" — ignoring.\n";
-        }
-        if (!arch)
-            arch = guessArchitecture(source);
-    }
-    if (!arch) {
-        std::cerr << "Could not determine architecture from syntax.\n";
-        printArchitecturesGrouped();
-        return 1;
-    }
-    std::set<std::string> dataLabels;
-    auto data = parseDataSection(source, dataLabels);
-    auto textLabels = collectTextLabels(source);
-    std::set<std::string> allLabels = dataLabels; allLabels.insert(textLabels.begin(), textLabels.end());
-    auto symbols = collectSymbols(source, allLabels);
-    bool runtime = requiresRuntime(arch);
-    if (runtime) {
-        std::string gtLower = toLower(arch->GT);
-        if (gtLower.find("mips") != std::string::npos) {
-            symbols.insert("$v0");
-            symbols.insert("$a0");
-        } else if (gtLower.find("risc") != std::string::npos) {
-            symbols.insert("a0");
-            symbols.insert("a7");
-        }
-    }
-    std::vector<std::string> translatedBody;
-    translatedBody.reserve(256);
-    bool usesMem   = false;
-    bool usesMem64 = false;
-    bool usesPCVar = needsPC(source);
-    {
-        std::istringstream src1(source);
-        std::string line; bool inText=false;
-        while (std::getline(src1, line)) {
-            if (line.find(".text")!=std::string::npos) { inText=true; continue; }
-            if (!inText) continue;
-            std::string emitted = translateLine(line, arch, allLabels);
-            if (!emitted.empty()) {
-                if (emitted.find("mem[")   != std::string::npos) usesMem = true;
-                if (emitted.find("mem64[") != std::string::npos) usesMem64 = true;
-                if (emitted.find("PC")     != std::string::npos) usesPCVar = true;
-                translatedBody.push_back(std::move(emitted));
-            }
-        }
-    }
-    std::string outputName = getOutputName(filePath);
-    std::ofstream out("temp.c");
-    out << "#include <stdio.h>\n#include <stdlib.h>\n#include <stdint.h>\n\n";
-    for (auto& d : data) {
-        if (d.ctype=="uint32_t") out << "uint32_t " << d.name << " = " << d.value << ";\n";
-        else if (d.ctype=="uint64_t") out << "uint64_t " << d.name << " = " << d.value << ";\n";
-        else out << "char " << d.name << "[] = " << d.value << ";\n";
-    }
-    auto sanitize = [](std::string s) {
-        for (char& c : s)
-            if (!std::isalnum((unsigned char)c) && c != '_') c = '_';
-        return s;
-    };
-    for (auto& s : symbols)
-        out << "intptr_t " << sanitize(s) << " = 0;\n";
-    if (usesMem || usesMem64) {
-        out << "\n#ifndef MEM_SIZE\n#define MEM_SIZE 65536\n#endif\n";
-        out << "uint8_t  mem[MEM_SIZE];\n";
-        out << "uint32_t mem32[MEM_SIZE / 4];\n";
-        out << "uint64_t mem64[MEM_SIZE / 8];\n";
-    }
-    if (usesPCVar) {
-        out << "intptr_t PC = 0;\n";
-    }
-    if (runtime) {
-        std::string gtLower = toLower(arch->GT);
-        if (gtLower.find("mips") != std::string::npos) {
-            out 
-            << "\nvoid system_call(){\n"
-            << "    switch(_v0){\n"
-            << "        case 4: printf(\"%s\", (char*)_a0); break;\n"
-            << "        case 10: exit(0); break;\n"
-            << "        default: printf(\"[unknown syscall %d]\\n\", (int)_v0); break;\n"
-            << "    }\n}\n\n";
-        } else {
-            out 
-            << "\nvoid system_call(){\n"
-            << "    switch(a7){\n"
-            << "        case 4:  printf(\"%s\", (char*)a0); break;\n"
-            << "        case 93: exit((int)a0); break;\n"
-            << "        default: printf(\"[unknown syscall %d]\\n\", (int)a7); break;\n"
-            << "    }\n}\n\n";
-        }
-    }
-    out << "int main(){\n";
-    for (const auto& ln : translatedBody) {
-        out << "    " << ln;
-    }
-    out << "    return 0;\n}\n";
-    out.close();
-    std::cout << "Architecture: " << arch->fullName() << " (" << arch->definitionCount << " defs)\n";
-    if (!runAfter)
-        std::cout << "Compiling temp.c -> " << outputName << " ...\n";
-    std::string cmd = "gcc temp.c -o \"" + outputName + "\"";
-    system(cmd.c_str());
-    if (!keepTemp) std::remove("temp.c");
-    if (runAfter) {
-    #ifdef _WIN32
-        std::string runCmd = outputName;
-    #else
-        std::string runCmd = "./" + outputName;
-    #endif
-        system(runCmd.c_str());
-        std::remove(outputName.c_str());
-    } else {
-        std::cout << "Done. Run ./" << outputName << "\n";
-    }
-    return 0;
-}
-
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include "compiler/architectures.h"
+#include "compiler/Program.h"
+#include "compiler/ArchIndex.h"
+#include "compiler/Runtime.h"
+#include "compiler/Translator.h"
+#include "compiler/Interp.h"
+#include "compiler/Optimizer.h"
+#include "compiler/Idioms.h"
+#include "compiler/Structure.h"
+#include "compiler/Estimate.h"
+#include "compiler/BuildCache.h"
+#include "compiler/Process.h"
+#include "compiler/Source.h"
+#include "compiler/Synth.h"
+#include "compiler/Server.h"
+#include "compiler/Native.h"
+
+static inline bool isIdentStart(char c){ return std::isalpha((unsigned char)c) || c=='_'; }
+static inline bool isIdentChar(char c){ return std::isalnum((unsigned char)c) || c=='_'; }
+static inline bool contains(const std::string& s, const char* sub){ return s.find(sub)!=std::string::npos; }
+
+static inline std::string toLower(std::string s){
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
+    return s;
+}
+
+static inline std::string normalizeArchKey(std::string s) {
+    s = toLower(std::move(s));
+    s.erase(std::remove_if(s.begin(), s.end(), [](unsigned char c){
+        return c==' ' || c=='-' || c=='_';
+    }), s.end());
+    return s;
+}
+
+static inline bool archKeyMatches(const AsmDefinition* def, const std::string& specRaw) {
+    const std::string spec = normalizeArchKey(specRaw);
+    const std::string kFull = normalizeArchKey(def->fullName());
+    const std::string kGT   = normalizeArchKey(std::string(def->GT));
+    const std::string kSBST = normalizeArchKey(std::string(def->SBST));
+    if (spec == kFull || spec == kGT || (!kSBST.empty() && spec == kSBST)) return true;
+    if (!def->SBST.empty()) {
+        std::string concat = kGT + kSBST;
+        if (spec == concat) return true;
+    }
+    return false;
+}
+
+static inline const AsmDefinition* findArchBySpec(const std::string& spec) {
+    for (auto* def : architectures)
+        if (archKeyMatches(def, spec)) return def;
+    return nullptr;
+}
+
+static const ArchIndex& archIndex() {
+    static const ArchIndex index(architectures, std::size(architectures));
+    return index;
+}
+
+// Each distinct opcode/operand token is looked up once and weighted by its use count.
+const AsmDefinition* guessArchitecture(const Program& prog) {
+    return archIndex().guess(prog);
+}
+
+static inline bool isPlainIdent(std::string_view t) {
+    if (!t.empty() && t[0]=='$') t.remove_prefix(1);    // MIPS registers
+    if (t.empty() || !isIdentStart(t[0])) return false;
+    for (char c : t) if (!isIdentChar(c)) return false;
+    return true;
+}
+
+// Operands that name neither a label, an import nor a literal become C
+// variables, sorted by name; so do the base registers of "off(base)" memory operands.
+std::vector<std::string_view> collectSymbols(const Program& prog) {
+    std::vector<std::string_view> names;
+    for (Sym s=1; s<prog.syms.size(); ++s) {
+        if (!(prog.syms.flags[s] & SymOperand) || (prog.syms.flags[s] & SymImport) || prog.syms.isLabel(s)) continue;
+        std::string_view t = prog.name(s);
+        size_t lp = t.find('('), rp = t.find(')');
+        if (lp != std::string_view::npos && rp != std::string_view::npos && rp > lp) t = trimView(t.substr(lp+1, rp-lp-1));
+        if (isPlainIdent(t)) names.push_back(t);
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+static void printArchitecturesGrouped() {
+    std::unordered_map<std::string, std::vector<const AsmDefinition*>> byGT;
+    for (auto* def : architectures)
+        byGT[std::string(def->GT)].push_back(def);
+    for (auto& [gt, defs] : byGT) {
+        std::cout << gt << "\n";
+        for (auto* def : defs) {
+            std::string subset = def->SBST.empty() ? "(generic)" : std::string(def->SBST);
+            std::cout << " - " << subset << " (" << def->definitionCount << " defs)\n";
+        }
+        std::cout << "\n";
+    }
+}
+
+std::string getOutputName(const std::string& inputPath) {
+    size_t dot = inputPath.find_last_of('.');
+    size_t slash = inputPath.find_last_of("/\\");
+    std::string stem = (slash==std::string::npos) ? inputPath.substr(0,dot) : inputPath.substr(slash+1, dot - slash - 1);
+    return stem + ".exe";
+}
+
+// -stats: wall time per phase and what the front end counted, for one input.
+struct PhaseStats {
+    using Clock = std::chrono::steady_clock;
+    double read = 0, arch = 0, layout = 0, optimize = 0, translate = 0, emit = 0, cache = 0, gcc = 0, run = 0;
+    uint64_t lines = 0, insns = 0, translated = 0, dropped = 0, labels = 0, data = 0, symbols = 0, declared = 0, cBytes = 0;
+    std::vector<std::string> unknown;       // opcodes without a template, left out of the C
+    Clock::time_point mark = Clock::now();
+
+    // Adds the time since the last lap to phase.
+    void lap(double& phase) {
+        auto now = Clock::now();
+        phase += std::chrono::duration<double>(now - mark).count();
+        mark = now;
+    }
+};
+
+struct BuildJob {
+    std::string filePath, outputName, cfile, key, log;
+    std::vector<std::string> units;         // emitted C; more than one when .text was split or linked
+    std::vector<std::string> unitKeys;      // cache keys of the units' objects
+    const AsmDefinition* arch = nullptr;
+    bool ok = false, hit = false, noArch = false;
+    bool native = false;                    // -native wrote outputName itself
+    unsigned pendingUnits = 0;              // object files still being compiled
+    bool compiling = false;                 // gcc has started on some unit
+    PhaseStats stats;
+
+    // Unit 0 is cfile itself; chunk k of a split program goes next to it as <stem>.k.c.
+    std::string unitFile(size_t k, const char* ext = ".c") const {
+        std::string stem = cfile.substr(0, cfile.size() - 2);
+        return k ? stem + "." + std::to_string(k) + ext : stem + ext;
+    }
+};
+
+// -arch wins, then the source's hint, then the best guess: from the whole
+// program, or with detectPrefix set from about that many leading bytes of
+// source. Warnings go to log.
+static const AsmDefinition* selectArchitecture(const Program& prog, const AsmDefinition* forced, std::string& log, size_t detectPrefix = 0) {
+    if (forced) return forced;
+    const AsmDefinition* arch = nullptr;
+    std::string hintedArch(prog.archHint);
+    if (!hintedArch.empty()) {
+        arch = findArchBySpec(hintedArch);
+        if (!arch)
+            log += "Warning: Unknown architecture hint \"" + hintedArch + "\" — ignoring.\n";
+    }
+    if (!arch)
+        arch = detectPrefix ? archIndex().guessPrefix(prog.src, detectPrefix) : guessArchitecture(prog);
+    return arch;
+}
+
+// Chunks of .text start at text labels, each once the one before holds at least
+// `size` instructions; the last entry is the end of the text. size 0 keeps one chunk.
+static std::vector<uint32_t> chunkStarts(const Program& prog, size_t size) {
+    uint32_t n = (uint32_t)prog.text.size();
+    std::vector<uint32_t> starts{0};
+    if (size)
+        for (auto& l : prog.labels)
+            if (l.at < n && l.at - starts.back() >= size) starts.push_back(l.at);
+    starts.push_back(n);
+    return starts;
+}
+
+// The body of one chunk, instructions [begin, end).
+struct TextChunk {
+    uint32_t begin = 0, end = 0;
+    uint32_t translated = 0, dropped = 0;
+    std::vector<Sym> unknown;                                // opcodes of dropped instructions
+    std::string body;
+    std::vector<std::pair<uint32_t, std::string>> targets;   // where an indirect jump may land
+    std::vector<std::pair<uint32_t, std::string>> external;  // labels in other chunks it jumps to
+    std::vector<Sym> imports;                                // names other files define
+    bool indirect = false;
+};
+
+// Renders a chunk's instructions, in order, into its body. Text labels and the
+// instructions after calls are the only places an indirect jump may land.
+// labelAt (split programs only) maps text labels to their instructions, so
+// jumps out of the chunk are collected in external.
+struct BodyWriter {
+    const Program& prog;
+    Translator& tr;
+    const OptimizedText& opt;
+    TextChunk& c;
+    const std::vector<uint32_t>* labelAt;
+    uint32_t n;                         // instructions in the whole program
+    size_t li = 0;                      // next label
+    bool returnSite;                    // the previous instruction links
+    Profile* profile = nullptr;         // -profile: count blocks (and branches) into this
+    const ControlPlan* plan = nullptr;  // blocks to rebuild from the branches
+    int depth = 0;                      // blocks open here
+    bool blockEnded = true;             // the previous instruction jumps or branches
+    char pc[48];
+
+    BodyWriter(const Program& p, Translator& t, const OptimizedText& o, TextChunk& chunk, uint32_t total, bool afterLink, const std::vector<uint32_t>* at = nullptr)
+        : prog(p), tr(t), opt(o), c(chunk), labelAt(at), n(total), returnSite(afterLink) {
+        tr.grow();
+        while (li < prog.labels.size() && prog.labels[li].at < c.begin) ++li;
+    }
+
+    void labels(uint32_t at) {
+        for (; li < prog.labels.size() && prog.labels[li].at == at; ++li) {
+            std::string name(tr.labelOperand(prog.labels[li].name));
+            c.body.append("    ").append(name).append(":;\n");
+            c.targets.emplace_back(at, std::move(name));
+        }
+        if (!returnSite || (!c.targets.empty() && c.targets.back().first == at)) return;
+        std::string name = "_ret_" + std::to_string(at);
+        c.body.append("    ").append(name).append(":;\n");
+        c.targets.emplace_back(at, std::move(name));
+    }
+
+    // Indents what was appended since from by the blocks open.
+    void indent(size_t from) {
+        if (depth <= 0 || from >= c.body.size()) return;
+        std::string pad(4 * depth, ' '), tail;
+        tail.reserve((c.body.size() - from) * 2);
+        for (size_t at = from, nl; at < c.body.size(); at = nl + 1) {
+            nl = c.body.find('\n', at);
+            if (nl == std::string::npos) nl = c.body.size() - 1;
+            tail.append(pad).append(c.body, at, nl + 1 - at);
+        }
+        c.body.replace(from, std::string::npos, tail);
+    }
+    void mark(const ControlPlan::Mark& m) {
+        depth += m.before;
+        c.body.append(4 + 4 * depth, ' ').append(m.text).push_back('\n');
+        depth += m.after;
+    }
+
+    void insn(const Insn& in, uint32_t i) {
+        size_t landing = c.targets.size();
+        const ControlPlan::Mark* rewrite = nullptr;
+        if (plan)
+            if (auto it = plan->close.find(i); it != plan->close.end()) for (auto& m : it->second) mark(m);
+        size_t from = c.body.size();
+        if (!opt.before.empty())
+            if (auto it = opt.before.find(i); it != opt.before.end()) c.body += it->second;
+        if (plan) {
+            indent(from);
+            if (auto it = plan->open.find(i); it != plan->open.end()) for (auto& m : it->second) mark(m);
+            if (auto it = plan->branch.find(i); it != plan->branch.end()) rewrite = &it->second;
+            from = c.body.size();
+        }
+        labels(i);
+        const SlotProgram* p = tr.find(in.op);
+        uint8_t f = p ? p->flags : 0;
+        returnSite = f & TmplLinks;
+        if (profile && (blockEnded || i == c.begin || c.targets.size() != landing)) {
+            c.body.append("    prof_block[").append(std::to_string(profile->blockStart.size())).append("]++;\n");
+            profile->blockStart.push_back(i);
+        }
+        blockEnded = f & (TmplBranches | TmplJumpsPC | TmplLinks);
+        if (!opt.action.empty() && opt.action[i] == OptimizedText::Drop) { indent(from); return; }
+        if ((f & TmplUsesPC) && !rewrite) {
+            std::snprintf(pc, sizeof pc, "    PC = 0x%llx;\n", (unsigned long long)(tr.textBase + 4ull*i));
+            c.body += pc;
+        }
+        if (rewrite) {
+            indent(from);
+            mark(*rewrite);
+            from = c.body.size();
+            ++c.translated;
+        }
+        else if (!opt.action.empty() && opt.action[i] != OptimizedText::Keep) { c.body += opt.replacement.at(i); ++c.translated; }
+        else if (tr.translateLine(in, c.body)) ++c.translated;
+        else {
+            ++c.dropped;
+            if (std::find(c.unknown.begin(), c.unknown.end(), in.op) == c.unknown.end()) c.unknown.push_back(in.op);
+        }
+        if (profile && profile->branches && (f & TmplConditional)) {
+            c.body.append("    prof_fall[").append(std::to_string(profile->branchAt.size())).append("]++;\n");
+            profile->branchAt.push_back(i);
+            profile->branchBlock.push_back((uint32_t)profile->blockStart.size() - 1);
+        }
+        if (f & TmplJumpsPC) { c.body += "    goto _dispatch;\n"; c.indirect = true; }
+        if (!opt.after.empty())
+            if (auto it = opt.after.find(i); it != opt.after.end()) c.body += it->second;
+        indent(from);
+        for (Sym s : {in.a, in.b, in.c}) {
+            if (prog.syms.flags[s] & SymImport) c.imports.push_back(s);
+            if (!labelAt || !(prog.syms.flags[s] & SymTextLabel)) continue;
+            uint32_t at = (*labelAt)[s];
+            if ((at >= c.begin && at < c.end) || (at == n && c.end == n)) continue;
+            c.external.emplace_back(at, std::string(tr.labelOperand(s)));
+        }
+    }
+
+    void finish() {
+        if (c.end == n) labels(n);
+        std::sort(c.external.begin(), c.external.end());
+        c.external.erase(std::unique(c.external.begin(), c.external.end()), c.external.end());
+        std::sort(c.imports.begin(), c.imports.end());
+        c.imports.erase(std::unique(c.imports.begin(), c.imports.end()), c.imports.end());
+    }
+};
+
+static void addControl(OptStats& o, const ControlPlan& plan) {
+    o.whiles += plan.loops;
+    o.ifs += plan.ifs;
+    o.elses += plan.elses;
+    o.breaks += plan.breaks;
+}
+
+static void countChunk(PhaseStats& st, const Program& prog, const TextChunk& c) {
+    st.translated += c.translated;
+    st.dropped += c.dropped;
+    for (Sym op : c.unknown) {
+        std::string name(prog.name(op));
+        if (std::find(st.unknown.begin(), st.unknown.end(), name) == st.unknown.end()) st.unknown.push_back(std::move(name));
+    }
+}
+
+// What the emitted program declares, read off the Translator once it has seen
+// every line (or assumed them all, when streaming).
+struct CLayout {
+    std::vector<std::string> vars;
+    std::string stack;
+    const char* type = "intptr_t";
+    bool usesStack = false, memory = false, runtime = false, usesPCVar = false, localRegs = false;
+    bool atomics = false;               // amo_* helpers
+    bool harts = false;                 // main's body runs on every hart (see emitHarts)
+    std::string hartReg, hartCountReg;  // set at entry when the program reads them
+    SyscallABI abi;
+    const Profile* profile = nullptr;
+
+    std::string initial(const std::string& name) const {
+        if (name != stack) return "0";
+        return localRegs ? std::string("(") + type + ")MEM_SIZE" : "MEM_SIZE";
+    }
+    void includes(std::ostream& out) const {
+        if (memory) out << "#define _DEFAULT_SOURCE\n";         // mmap and sigaction under -std=c99
+        out << "#include <stdio.h>\n#include <stdlib.h>\n#include <stdint.h>\n";
+        if (memory) out << "#include <string.h>\n";
+        if (runtime) out << "#include <unistd.h>\n";
+        if (atomics) out << "#include <stdatomic.h>\n";
+        if (harts) out << "#include <pthread.h>\n";
+        out << "\n";
+    }
+    bool declares(const std::string& name) const { return std::find(vars.begin(), vars.end(), name) != vars.end(); }
+};
+
+static CLayout layoutC(const Program& prog, const AsmDefinition* arch, const Translator& tr, const DataImage& image, bool localRegs) {
+    CLayout L;
+    L.localRegs = localRegs;
+    L.runtime   = tr.flags & TmplRuntime;
+    L.usesPCVar = tr.flags & TmplUsesPC;
+    std::set<std::string> state = tr.writes;
+    L.abi = syscallABI(arch);
+    if (L.runtime) {
+        state.emplace(L.abi.numReg);
+        for (auto reg : L.abi.argReg) state.emplace(reg);
+        state.emplace(L.abi.retReg);
+    }
+    // -O keeps the register file in main at the architecture's width so gcc can allocate it.
+    std::set<std::string> declared{"PC"};
+    auto declare = [&](std::string name){ if (declared.insert(name).second) L.vars.push_back(std::move(name)); };
+    if (!arch->zeroReg.empty()) declared.insert(sanitizeIdent(arch->zeroReg));
+    for (auto name : collectSymbols(prog)) declare(sanitizeIdent(name));
+    for (auto& name : state) declare(name);
+    if (tr.discards) declare("_discard");
+    if (localRegs)
+        for (size_t i=0; i<arch->traitCount; ++i) declare(sanitizeIdent(arch->traits[i]));
+    L.stack = arch->stackReg.empty() ? std::string() : sanitizeIdent(arch->stackReg);
+    L.usesStack = !L.stack.empty() && L.declares(L.stack);
+    L.atomics = tr.flags & TmplAtomic;
+    L.harts = arch->harts();
+    if (L.harts) {
+        L.hartReg = sanitizeIdent(arch->hartReg);
+        L.hartCountReg = sanitizeIdent(arch->hartCountReg);
+    }
+    L.memory = (tr.flags & TmplUsesMem) || L.runtime || L.usesStack || L.harts || image.size;
+    L.type = registerType(arch, localRegs);
+    return L;
+}
+
+// A whole program in one unit: everything up to the first instruction of main,
+// or with harts of hart_main, whose global registers are then thread-local.
+static void emitMainHead(std::ostream& out, const CLayout& L, const DataImage& image, uint64_t memSize, unsigned xlen) {
+    L.includes(out);
+    if (L.memory)
+        emitMemory(out, image, memSize, xlen);
+    if (L.atomics)
+        emitAtomics(out);
+    const char* storage = L.harts ? "_Thread_local intptr_t " : "intptr_t ";
+    if (!L.localRegs)
+        for (auto& name : L.vars) out << storage << name << " = " << L.initial(name) << ";\n";
+    if (L.usesPCVar && !L.localRegs) {
+        out << storage << "PC = 0;\n";
+    }
+    if (L.runtime)
+        emitRuntime(out, L.abi, true, image.heapBase(), memSize, xlen, L.harts);
+    if (L.profile)
+        emitProfileCounters(out, *L.profile, true, false);
+    if (L.harts) {
+        emitHarts(out);
+        out << "static void* hart_main(void* hart_arg){\n";
+    } else {
+        out << "int main(){\n";
+        if (L.memory) out << "    mem_init();\n";
+        if (L.runtime) out << "    io_init();\n";
+        if (L.profile) out << "    atexit(prof_report);\n";
+    }
+    if (L.localRegs) {
+        for (auto& name : L.vars) out << "    " << L.type << " " << name << " = " << L.initial(name) << ";\n";
+        if (L.usesPCVar) out << "    intptr_t PC = 0;\n";
+    }
+    if (L.harts) {
+        if (L.declares(L.hartReg)) out << "    " << L.hartReg << " = (intptr_t)hart_arg;\n";
+        if (L.declares(L.hartCountReg)) out << "    " << L.hartCountReg << " = ezm_harts;\n";
+        if (L.usesStack) out << "    " << L.stack << " = hart_stack((intptr_t)hart_arg);\n";
+    }
+}
+
+static void emitMainTail(std::ostream& out, const CLayout& L, const TextChunk& c, uint32_t n, unsigned xlen) {
+    out << "    return 0;\n";
+    if (c.indirect)
+        emitDispatch(out, c.targets, n + 1, xlen);
+    out << "}\n";
+    if (!L.harts) return;
+    out << "\nint main(){\n"
+        << "    mem_init();\n";
+    if (L.runtime) out << "    io_init();\n";
+    if (L.profile) out << "    atexit(prof_report);\n";
+    out << "    harts_run();\n"
+        << "    return 0;\n}\n";
+}
+
+// Throws std::runtime_error when the program does not fit in memSize bytes of guest memory.
+// Returns one C translation unit, or with chunkInsns set and a long enough
+// program of a single-hart architecture, the main unit followed by one unit
+// per chunk of .text.
+// stats, if given, gets the layout, optimize, translate and emit phases;
+// profile, if given, instruments the program (see Runtime.h); structured
+// rebuilds loops and ifs from the branches (see Structure.h).
+std::vector<std::string> emitC(const Program& prog, const AsmDefinition* arch, uint64_t memSize = DefaultMemSize, bool localRegs = false, OptStats* optimize = nullptr, size_t chunkInsns = 0, PhaseStats* stats = nullptr, Profile* profile = nullptr, bool structured = false) {
+    PhaseStats none;
+    PhaseStats& st = stats ? *stats : none;
+    DataImage image = layoutData(prog);
+    std::string bad = checkMemSize(memSize, arch->xlen, image);
+    if (!bad.empty()) throw std::runtime_error(bad);
+    Translator tr(prog, arch, image);
+    st.lap(st.layout);
+    OptimizedText opt;
+    if (optimize) {
+        opt = optimizeText(prog, tr, arch, localRegs);
+        if (!profile) recognizeLoops(prog, tr, opt, memSize);     // profiles count every iteration
+        *optimize = opt.stats;
+        st.lap(st.optimize);
+    }
+    const uint32_t n = (uint32_t)prog.text.size();
+    std::vector<uint32_t> starts = chunkStarts(prog, arch->harts() ? 0 : chunkInsns);
+    const bool split = starts.size() > 2;
+    std::vector<uint32_t> labelAt;
+    if (split) {
+        labelAt.assign(prog.syms.size(), ~0u);
+        for (auto& l : prog.labels) labelAt[l.name] = l.at;
+    }
+    std::vector<TextChunk> chunks(starts.size() - 1);
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        TextChunk& c = chunks[k];
+        c.begin = starts[k];
+        c.end = starts[k+1];
+        c.body.reserve((c.end - c.begin) * 32);
+        const SlotProgram* before = c.begin ? tr.find(prog.text[c.begin - 1].op) : nullptr;
+        BodyWriter w(prog, tr, opt, c, n, before && (before->flags & TmplLinks), split ? &labelAt : nullptr);
+        w.profile = profile;
+        ControlPlan plan;
+        if (structured) {
+            plan = planControl(prog, tr, opt, c.begin, c.end, !profile);
+            w.plan = &plan;
+            if (optimize) addControl(*optimize, plan);
+        }
+        for (uint32_t i = c.begin; i < c.end; ++i) w.insn(prog.text[i], i);
+        w.finish();
+        countChunk(st, prog, c);
+    }
+    st.lap(st.translate);
+
+    CLayout L = layoutC(prog, arch, tr, image, localRegs);
+    L.profile = profile;
+    st.declared = L.vars.size();
+    st.lap(st.layout);
+    const auto& vars = L.vars;
+    const std::string& stack = L.stack;
+    const char* type = L.type;
+    if (!split) {
+        std::ostringstream out;
+        emitMainHead(out, L, image, memSize, arch->xlen);
+        out << chunks[0].body;
+        emitMainTail(out, L, chunks[0], n, arch->xlen);
+        if (profile) emitProfileReport(out, *profile, prog, n);
+        std::vector<std::string> units{out.str()};
+        st.lap(st.emit);
+        return units;
+    }
+
+    // Split: every chunk is a function `uint32_t chunk_K(uint32_t entry)` in its
+    // own unit. It enters at instruction `entry` and returns the index of the
+    // next instruction to run, which main's driver loop hands to the chunk that
+    // holds it. Registers are globals; under -O each chunk keeps them in locals
+    // and writes them back to the global file R before it returns.
+    auto prelude = [&](std::ostream& out, bool owner) {
+        L.includes(out);
+        if (L.memory)
+            emitMemory(out, image, memSize, arch->xlen, owner);
+        if (!localRegs) {
+            for (auto& name : vars)
+                if (owner) out << "intptr_t " << name << " = " << L.initial(name) << ";\n";
+                else out << "extern intptr_t " << name << ";\n";
+            if (L.usesPCVar) out << (owner ? "intptr_t PC = 0;\n" : "extern intptr_t PC;\n");
+        } else {
+            out << "typedef struct {\n";
+            for (auto& name : vars) out << "    " << type << " " << name << ";\n";
+            out << "} regs_t;\n";
+            if (!owner) out << "extern regs_t R;\n";
+            else if (L.usesStack) out << "regs_t R = { ." << stack << " = " << L.initial(stack) << " };\n";
+            else out << "regs_t R;\n";
+            out << "#define SAVE_REGS() do {";
+            for (auto& name : vars) out << " R." << name << " = " << name << ";";
+            out << " } while (0)\n";
+        }
+        if (L.runtime) emitRuntime(out, L.abi, owner, image.heapBase(), memSize, arch->xlen);
+        if (profile) emitProfileCounters(out, *profile, owner, true);
+        const char* guestPC = arch->xlen < 64 ? "(uint64_t)(uint32_t)pc" : "(uint64_t)pc";
+        out << "\nstatic inline void jump_fault(uint64_t a) {\n"
+            << "    fflush(stdout);\n"
+            << "    fprintf(stderr, \"jump to non-instruction address 0x%llx\\n\", (unsigned long long)a);\n"
+            << "    exit(1);\n}\n"
+            << "static inline uint32_t pc_index(intptr_t pc) {\n"
+            << "    uint64_t at = " << guestPC << " - " << TextBase << "ull;\n"
+            << "    if ((at & 3) || (at >> 2) > " << n << ") jump_fault(at + " << TextBase << "ull);\n"
+            << "    return (uint32_t)(at >> 2);\n}\n\n";
+    };
+    const char* save = localRegs ? "SAVE_REGS(); " : "";
+    // A chunk is entered at its first instruction, at labels other chunks jump
+    // to and, once anything jumps indirectly, at all of its indirect targets.
+    bool indirect = false;
+    std::vector<uint8_t> entered(n + 1, 0);
+    for (auto& c : chunks) {
+        indirect |= c.indirect;
+        entered[c.begin] = 1;
+        for (auto& e : c.external) entered[e.first] = 1;
+    }
+    std::vector<std::string> units;
+    {
+        std::ostringstream out;
+        prelude(out, true);
+        for (size_t k = 0; k < chunks.size(); ++k) out << "uint32_t chunk_" << k << "(uint32_t entry);\n";
+        out << "\nstatic uint32_t (*const chunks[" << chunks.size() << "])(uint32_t) = {";
+        for (size_t k = 0; k < chunks.size(); ++k) out << (k % 8 ? " " : "\n    ") << "chunk_" << k << ",";
+        out << "\n};\nstatic const uint32_t chunk_start[" << chunks.size() << "] = {";
+        for (size_t k = 0; k < chunks.size(); ++k) out << (k % 8 ? " " : "\n    ") << chunks[k].begin << ",";
+        out << "\n};\n\nint main(){\n";
+        if (L.memory) out << "    mem_init();\n";
+        if (L.runtime) out << "    io_init();\n";
+        if (profile) out << "    atexit(prof_report);\n";
+        out << "    for (uint32_t at = 0; at < " << n << ";) {\n"
+            << "        uint32_t lo = 0, hi = " << chunks.size() << ";\n"
+            << "        while (hi - lo > 1) { uint32_t mid = (lo + hi) / 2; if (chunk_start[mid] <= at) lo = mid; else hi = mid; }\n"
+            << "        at = chunks[lo](at);\n"
+            << "    }\n"
+            << "    return 0;\n}\n";
+        if (profile) emitProfileReport(out, *profile, prog, n);
+        units.push_back(out.str());
+    }
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        const TextChunk& c = chunks[k];
+        std::ostringstream out;
+        prelude(out, false);
+        out << "uint32_t chunk_" << k << "(uint32_t entry){\n";
+        if (localRegs) {
+            for (auto& name : vars) out << "    " << type << " " << name << " = R." << name << ";\n";
+            if (L.usesPCVar) out << "    intptr_t PC = 0;\n";
+        }
+        out << "    switch (entry) {\n"
+            << "        case " << c.begin << ": goto _start;\n";
+        for (size_t t = 0; t < c.targets.size(); ++t) {
+            uint32_t at = c.targets[t].first;
+            if (at == c.begin || (t && c.targets[t-1].first == at) || !(indirect || entered[at])) continue;
+            out << "        case " << at << ": goto " << c.targets[t].second << ";\n";
+        }
+        out << "        default: jump_fault(" << TextBase << "ull + 4ull * entry);\n"
+            << "    }\n"
+            << "_start:;\n"
+            << c.body
+            << "    " << save << "return " << c.end << ";\n";
+        for (auto& [at, label] : c.external)
+            out << label << ": " << save << "return " << at << ";\n";
+        if (c.indirect)
+            out << "_dispatch: " << save << "return pc_index(PC);\n";
+        out << "}\n";
+        units.push_back(out.str());
+    }
+    st.lap(st.emit);
+    return units;
+}
+
+// Inputs of at least StreamBytes (or any with -stream) are translated without
+// holding the program: the first pass over the mapped source collects symbols,
+// labels and data and drops every instruction, the second translates each
+// instruction as it is lexed again and writes the C out a megabyte at a time,
+// hashing it for the build cache on the way. Memory stays at the size of the
+// symbol tables. The optimizer and -split need the whole text, so neither runs.
+constexpr size_t StreamBytes = 256u << 20, StreamFlush = 1u << 20;
+
+// Throws std::runtime_error when the program does not fit in memSize bytes of
+// guest memory or the C cannot be written.
+// The second pass counts as translation in st, C writes included.
+static void streamC(SourceFile& source, Program& prog, uint32_t n, const AsmDefinition* arch, uint64_t memSize, bool localRegs, const std::string& path, Sha256* hash, PhaseStats& st) {
+    DataImage image = layoutData(prog);
+    std::string bad = checkMemSize(memSize, arch->xlen, image);
+    if (!bad.empty()) throw std::runtime_error(bad);
+    Translator tr(prog, arch, image);
+    tr.assumeProgram();
+    CLayout L = layoutC(prog, arch, tr, image, localRegs);
+    st.declared = L.vars.size();
+    st.lap(st.layout);
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("cannot write " + path);
+    TextChunk c;
+    c.end = n;
+    auto flush = [&]{
+        if (hash) hash->update(c.body);
+        st.cBytes += c.body.size();
+        file.write(c.body.data(), (std::streamsize)c.body.size());
+        c.body.clear();
+    };
+    {
+        std::ostringstream head;
+        emitMainHead(head, L, image, memSize, arch->xlen);
+        c.body = head.str();
+    }
+    c.body.reserve(StreamFlush + 4096);
+    OptimizedText none;
+    BodyWriter w(prog, tr, none, c, n, false);
+    Lexer again(prog, false);
+    source.windows([&](std::string_view window){
+        again.feed(window, [&](const Insn& in, uint32_t i){
+            w.insn(in, i);
+            if (c.body.size() >= StreamFlush) flush();
+        });
+    });
+    w.finish();
+    countChunk(st, prog, c);
+    st.lap(st.translate);
+    std::ostringstream tail;
+    emitMainTail(tail, L, c, n, arch->xlen);
+    c.body += tail.str();
+    flush();
+    if (!file.flush()) throw std::runtime_error("cannot write " + path);
+    st.lap(st.emit);
+}
+
+// Without -split, programs longer than AutoSplitInsns are emitted as chunks
+// of about SplitChunkInsns instructions, so gcc never sees one giant function.
+constexpr size_t AutoSplitInsns = 50000, SplitChunkInsns = 10000;
+
+struct BuildOptions {
+    const AsmDefinition* forced = nullptr;
+    bool keepC = false, localRegs = false;
+    bool dataflow = true, optStats = false;
+    bool structured = true;             // rebuild loops and ifs from the branches
+    uint64_t memSize = DefaultMemSize;
+    long split = -1;                    // instructions per chunk; 0 never splits, -1 picks by size
+    bool stream = false;                // translate in two passes without keeping the program
+    size_t detect = 0;                  // guess the architecture from this many bytes; 0: all
+    int profile = 0;                    // 1: count blocks, 2: and branches
+    bool native = false;                // write an x86-64 executable instead of C
+    long harts = 0;                     // -harts: the default hart count of multi-hart architectures
+    Command compile;                    // gcc [cflags] <c> -o <exe>; the last three are filled per job
+};
+
+// Harts run on host threads, so their programs build with -pthread.
+static Command compileCommand(const BuildOptions& opt, const std::string& in, const std::string& out, const AsmDefinition* arch) {
+    Command cmd = opt.compile;
+    cmd[cmd.size() - 3] = in;
+    cmd[cmd.size() - 1] = out;
+    if (arch && arch->harts()) cmd.insert(cmd.end() - 3, "-pthread");
+    return cmd;
+}
+
+// gcc [cflags] -c <chunk.c> -o <chunk.o> for one unit of a split program.
+static Command objectCommand(const BuildOptions& opt, const BuildJob& job, size_t k) {
+    Command cmd = compileCommand(opt, job.unitFile(k), job.unitFile(k, ".o"), job.arch);
+    cmd.insert(cmd.end() - 3, "-c");
+    return cmd;
+}
+
+static Command linkCommand(const BuildOptions& opt, const BuildJob& job) {
+    Command cmd(opt.compile.begin(), opt.compile.end() - 3);
+    if (job.arch && job.arch->harts()) cmd.push_back("-pthread");
+    for (size_t k = 0; k < job.units.size(); ++k) cmd.push_back(job.unitFile(k, ".o"));
+    cmd.insert(cmd.end(), {"-o", job.outputName});
+    return cmd;
+}
+
+// Multi-file programs. A file that pulls others in with .include (paths are
+// relative to the including file; each file counts once) is the root of a
+// program with one module per file, numbered in include order from the
+// root's 0. Modules are translated side by side, one C unit each, and
+// nothing in a unit depends on the other files, so editing one file changes
+// one unit and every other object comes out of the build cache:
+//   instruction i of module K has the index K << ModuleBits | i and, as
+//   always, the address TextBase + 4*index;
+//   the root's data sits at DataBase, module K's at the link-time constant
+//   ezm_data_K;
+//   a label named in .globl is exported as the constant ezm_sym_<name>; a
+//   name a file uses without defining it is imported when another file
+//   exports it (a .globl/.extern name must be).
+// module_K(entry) runs from global index entry until it leaves the module
+// and returns the index to go on at; the link unit (unit 0) holds the
+// registers, memory and symbols and drives the modules until the index falls
+// off the end of one.
+constexpr uint32_t ModuleBits = 22, MaxModules = 255;     // keeps every address below 4 GiB
+
+struct Module {
+    std::string path;
+    SourceFile source;                  // the root's stays with its job
+    Program prog;
+    DataImage image;
+    uint64_t dataAt = DataBase;         // where the link unit puts image
+    CLayout layout;
+    TextChunk text;
+    OptStats stats;
+};
+
+static std::string moduleUnit(const Module& m, uint32_t k, const AsmDefinition* arch, uint64_t memSize) {
+    const CLayout& L = m.layout;
+    const TextChunk& c = m.text;
+    const uint32_t base = k << ModuleBits, n = c.end;
+    std::ostringstream out;
+    L.includes(out);
+    if (L.memory)
+        emitMemory(out, m.image, memSize, arch->xlen, false);
+    if (!L.localRegs) {
+        for (auto& name : L.vars) out << "extern intptr_t " << name << ";\n";
+        if (L.usesPCVar) out << "extern intptr_t PC;\n";
+    } else {
+        for (auto& name : L.vars) out << "extern " << L.type << " R_" << name << ";\n";
+        out << "#define SAVE_REGS() do {";
+        for (auto& name : L.vars) out << " R_" << name << " = " << name << ";";
+        out << " } while (0)\n";
+    }
+    if (L.runtime) emitRuntime(out, L.abi, false, 0, memSize, arch->xlen);
+    if (k) out << "extern const uint64_t ezm_data_" << k << ";\n";
+    for (Sym s : c.imports) out << "extern const uint64_t ezm_sym_" << sanitizeIdent(m.prog.name(s)) << ";\n";
+    const char* guestPC = arch->xlen < 64 ? "(uint64_t)(uint32_t)pc" : "(uint64_t)pc";
+    out << "\nstatic inline void jump_fault(uint64_t a) {\n"
+        << "    fflush(stdout);\n"
+        << "    fprintf(stderr, \"jump to non-instruction address 0x%llx\\n\", (unsigned long long)a);\n"
+        << "    exit(1);\n}\n"
+        << "static inline uint32_t pc_index(intptr_t pc) {\n"
+        << "    uint64_t at = " << guestPC << " - " << TextBase << "ull;\n"
+        << "    if ((at & 3) || (at >> 2) > 0xffffffffull) jump_fault(at + " << TextBase << "ull);\n"
+        << "    return (uint32_t)(at >> 2);\n}\n\n";
+
+    const char* save = L.localRegs ? "SAVE_REGS(); " : "";
+    out << "uint32_t module_" << k << "(uint32_t entry){\n";
+    if (L.localRegs) {
+        for (auto& name : L.vars) out << "    " << L.type << " " << name << " = R_" << name << ";\n";
+        if (L.usesPCVar) out << "    intptr_t PC = 0;\n";
+    }
+    // Any label or return site may be entered from another file.
+    if (c.indirect) out << "_enter:\n";
+    out << "    switch (entry) {\n"
+        << "        case " << base << "u: goto _start;\n";
+    for (size_t t = 0; t < c.targets.size(); ++t) {
+        uint32_t at = c.targets[t].first;
+        if (at == 0 || (t && c.targets[t-1].first == at)) continue;
+        out << "        case " << base + at << "u: goto " << c.targets[t].second << ";\n";
+    }
+    out << "        default: jump_fault(" << TextBase << "ull + 4ull * entry);\n"
+        << "    }\n"
+        << "_start:;\n"
+        << c.body
+        << "    " << save << "return " << base + n << "u;\n";
+    for (Sym s : c.imports) {
+        std::string name = sanitizeIdent(m.prog.name(s));
+        out << name << ": " << save << "return pc_index((intptr_t)ezm_sym_" << name << ");\n";
+    }
+    if (c.indirect)
+        out << "_dispatch:\n"
+            << "    entry = pc_index(PC);\n"
+            << "    if (entry - " << base << "u < " << n << "u) goto _enter;\n"
+            << "    " << save << "return entry;\n";
+    out << "}\n";
+    return out.str();
+}
+
+// Gathers the files root includes, resolves symbols across them and emits
+// the link unit followed by one unit per module. Throws std::runtime_error
+// for a missing file, a symbol exported twice or never exported, or a
+// program that does not fit.
+static std::vector<std::string> emitModules(Program& root, const std::string& rootPath, const AsmDefinition* arch, const BuildOptions& opt, OptStats* optimize, PhaseStats& st, std::string& log) {
+    std::vector<std::unique_ptr<Module>> mods;
+    std::unordered_map<std::string, size_t> seen;
+    auto canonical = [](const fs::path& p){
+        std::error_code ec;
+        fs::path c = fs::weakly_canonical(p, ec);
+        return (ec ? p : c).string();
+    };
+    mods.push_back(std::make_unique<Module>());
+    mods[0]->path = rootPath;
+    mods[0]->prog = std::move(root);
+    seen.emplace(canonical(rootPath), 0);
+    std::function<void(size_t)> visit = [&](size_t k) {
+        for (auto& [inc, line] : mods[k]->prog.includes) {
+            fs::path p = fs::path(mods[k]->path).parent_path() / std::string(inc);
+            if (!seen.emplace(canonical(p), mods.size()).second) continue;
+            if (mods.size() == MaxModules) throw std::runtime_error("more than " + std::to_string(MaxModules) + " files");
+            auto m = std::make_unique<Module>();
+            m->path = p.string();
+            if (!m->source.open(m->path))
+                throw std::runtime_error(mods[k]->path + ":" + std::to_string(line) + ": cannot read " + m->path);
+            m->prog = lexProgram(m->source.text);
+            m->prog.dir = p.parent_path().string();
+            mods.push_back(std::move(m));
+            visit(mods.size() - 1);
+        }
+    };
+    visit(0);
+    for (size_t k = 1; k < mods.size(); ++k) {
+        const Program& p = mods[k]->prog;
+        st.lines += p.lines;
+        st.insns += p.text.size();
+        st.labels += p.labels.size();
+        st.data += p.data.size();
+        st.symbols += p.syms.size() - 1;
+    }
+    st.lap(st.read);
+
+    // Exports, then imports: .globl names a file does not define, and any
+    // operand another file exports.
+    struct Export { size_t module; Sym sym; uint64_t at = 0; };
+    std::unordered_map<std::string_view, Export> exports;
+    for (size_t k = 0; k < mods.size(); ++k) {
+        const SymbolPool& syms = mods[k]->prog.syms;
+        for (Sym s = 1; s < syms.size(); ++s) {
+            if (!(syms.flags[s] & SymGlobal) || !syms.isLabel(s)) continue;
+            auto [it, fresh] = exports.try_emplace(syms[s], Export{k, s});
+            if (!fresh) throw std::runtime_error(std::string(syms[s]) + " is exported by both " + mods[it->second.module]->path + " and " + mods[k]->path);
+        }
+    }
+    for (auto& m : mods) {
+        SymbolPool& syms = m->prog.syms;
+        for (Sym s = 1; s < syms.size(); ++s) {
+            if (syms.isLabel(s) || !(syms.flags[s] & (SymGlobal | SymOperand))) continue;
+            bool exported = exports.count(syms[s]);
+            if ((syms.flags[s] & SymGlobal) && !exported) throw std::runtime_error(m->path + ": no file defines " + std::string(syms[s]));
+            if (exported) syms.flags[s] |= SymImport;
+        }
+    }
+
+    uint64_t end = DataBase;
+    for (uint32_t k = 0; k < mods.size(); ++k) {
+        Module& m = *mods[k];
+        if (m.prog.text.size() >= (1u << ModuleBits))
+            throw std::runtime_error(m.path + " has more than " + std::to_string((1u << ModuleBits) - 1) + " instructions");
+        m.image = layoutData(m.prog);
+        m.dataAt = end;
+        end = (end + m.image.size + 7) & ~7ull;
+    }
+    DataImage all;
+    for (auto& m : mods) {
+        for (DataPiece piece : m->image.pieces) {
+            piece.at += m->dataAt - DataBase;
+            if (piece.file.empty()) piece.from += all.bytes.size();
+            all.pieces.push_back(std::move(piece));
+        }
+        all.bytes.insert(all.bytes.end(), m->image.bytes.begin(), m->image.bytes.end());
+    }
+    all.size = end - DataBase;
+    uint64_t memSize = opt.memSize;
+    std::string bad = checkMemSize(memSize, arch->xlen, all);
+    if (!bad.empty()) throw std::runtime_error(bad);
+    for (auto& [name, e] : exports) {
+        const Module& m = *mods[e.module];
+        if (m.prog.syms.flags[e.sym] & SymDataLabel) { e.at = m.dataAt + (m.image.address[e.sym] - DataBase); continue; }
+        for (auto& l : m.prog.labels)
+            if (l.name == e.sym) { e.at = TextBase + 4ull * ((uint64_t)e.module << ModuleBits | l.at); break; }
+    }
+    st.lap(st.layout);
+
+    std::vector<std::string> units(mods.size() + 1);
+    {
+        std::atomic<size_t> next{0};
+        auto worker = [&]{
+            for (size_t k; (k = next++) < mods.size();) {
+                Module& m = *mods[k];
+                Translator tr(m.prog, arch, m.image);
+                tr.textBase = TextBase + 4ull * ((uint64_t)k << ModuleBits);
+                if (k) tr.dataBase = "ezm_data_" + std::to_string(k);
+                OptimizedText o;
+                if (optimize) {
+                    o = optimizeText(m.prog, tr, arch, opt.localRegs, true);
+                    recognizeLoops(m.prog, tr, o, memSize);
+                    m.stats = o.stats;
+                }
+                const uint32_t n = (uint32_t)m.prog.text.size();
+                m.text.end = n;
+                m.text.body.reserve(n * 32);
+                BodyWriter w(m.prog, tr, o, m.text, n, false);
+                ControlPlan plan;
+                if (opt.structured) {
+                    plan = planControl(m.prog, tr, o, 0, n, true);
+                    w.plan = &plan;
+                    addControl(m.stats, plan);
+                }
+                for (uint32_t i = 0; i < n; ++i) w.insn(m.prog.text[i], i);
+                w.finish();
+                m.layout = layoutC(m.prog, arch, tr, m.image, opt.localRegs);
+                units[k + 1] = moduleUnit(m, (uint32_t)k, arch, memSize);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), mods.size()); ++t) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+    }
+    for (auto& m : mods) {
+        countChunk(st, m->prog, m->text);
+        if (!optimize) continue;
+        OptStats& o = *optimize;
+        o.blocks += m->stats.blocks;
+        o.folded += m->stats.folded;
+        o.constOperands += m->stats.constOperands;
+        o.copies += m->stats.copies;
+        o.deadStores += m->stats.deadStores;
+        o.zeroWrites += m->stats.zeroWrites;
+        o.whiles += m->stats.whiles;
+        o.ifs += m->stats.ifs;
+        o.elses += m->stats.elses;
+        o.breaks += m->stats.breaks;
+        if (o.skipped.empty() && !m->stats.skipped.empty()) o.skipped = m->path + ": " + m->stats.skipped;
+        for (auto& l : m->stats.loops) o.loops.push_back(m->path + " " + l);
+    }
+    st.lap(st.translate);
+
+    // The link unit: the union of what the modules declare.
+    CLayout U = mods[0]->layout;
+    std::set<std::string> declared(U.vars.begin(), U.vars.end());
+    for (auto& m : mods) {
+        const CLayout& L = m->layout;
+        for (auto& name : L.vars) if (declared.insert(name).second) U.vars.push_back(name);
+        U.memory |= L.memory;
+        U.runtime |= L.runtime;
+        U.usesPCVar |= L.usesPCVar;
+    }
+    U.memory |= all.size != 0;
+    st.declared = U.vars.size();
+    std::ostringstream out;
+    U.includes(out);
+    if (U.memory)
+        emitMemory(out, all, memSize, arch->xlen);
+    if (!U.localRegs) {
+        for (auto& name : U.vars) out << "intptr_t " << name << " = " << U.initial(name) << ";\n";
+        if (U.usesPCVar) out << "intptr_t PC = 0;\n";
+    } else {
+        for (auto& name : U.vars) out << U.type << " R_" << name << " = " << U.initial(name) << ";\n";
+    }
+    if (U.runtime) emitRuntime(out, U.abi, true, all.heapBase(), memSize, arch->xlen);
+    for (size_t k = 1; k < mods.size(); ++k) out << "const uint64_t ezm_data_" << k << " = " << mods[k]->dataAt << "ull;\n";
+    std::vector<std::pair<std::string, uint64_t>> symbols;
+    for (auto& [name, e] : exports) symbols.emplace_back(sanitizeIdent(name), e.at);
+    std::sort(symbols.begin(), symbols.end());
+    for (auto& [name, at] : symbols) out << "const uint64_t ezm_sym_" << name << " = " << at << "ull;\n";
+    out << "\n";
+    for (size_t k = 0; k < mods.size(); ++k) out << "uint32_t module_" << k << "(uint32_t entry);\n";
+    out << "\nstatic uint32_t (*const modules[" << mods.size() << "])(uint32_t) = {";
+    for (size_t k = 0; k < mods.size(); ++k) out << (k % 8 ? " " : "\n    ") << "module_" << k << ",";
+    out << "\n};\nstatic const uint32_t module_size[" << mods.size() << "] = {";
+    for (size_t k = 0; k < mods.size(); ++k) out << (k % 8 ? " " : "\n    ") << mods[k]->text.end << ",";
+    out << "\n};\n\nint main(){\n";
+    if (U.memory) out << "    mem_init();\n";
+    if (U.runtime) out << "    io_init();\n";
+    out << "    for (uint32_t at = 0;;) {\n"
+        << "        uint32_t k = at >> " << ModuleBits << ", i = at & " << ((1u << ModuleBits) - 1) << "u;\n"
+        << "        if (k >= " << mods.size() << " || i > module_size[k]) {\n"
+        << "            fflush(stdout);\n"
+        << "            fprintf(stderr, \"jump to non-instruction address 0x%llx\\n\", " << TextBase << "ull + 4ull * at);\n"
+        << "            exit(1);\n"
+        << "        }\n"
+        << "        if (i == module_size[k]) return 0;\n"
+        << "        at = modules[k](at);\n"
+        << "    }\n}\n";
+    units[0] = out.str();
+    log += "Linked " + std::to_string(mods.size()) + " files, " + std::to_string(exports.size()) + " exported symbols\n";
+    st.lap(st.emit);
+    return units;
+}
+
+// Front end for one input: everything up to the gcc invocation. Runs on a worker thread.
+static void translateJob(BuildJob& job, const BuildOptions& opt, const BuildCache& cache) {
+    PhaseStats& st = job.stats;
+    st.mark = PhaseStats::Clock::now();
+    SourceFile source;
+    if (!source.open(job.filePath)) {
+        job.log += "Cannot read " + job.filePath + "\n";
+        return;
+    }
+    // A profile quotes source lines in the program, so it needs the whole text;
+    // so does the native backend.
+    const bool stream = !opt.profile && !opt.native && (opt.stream || source.text.size() >= StreamBytes);
+    if ((opt.profile || opt.native) && opt.stream) job.log += std::string("Warning: ") + (opt.native ? "-native" : "-profile") + " builds are not streamed\n";
+    Program prog;
+    uint32_t streamed = 0;
+    if (stream) {
+        prog.src = source.text;
+        Lexer lex(prog);
+        source.windows([&](std::string_view window){ lex.feed(window, [](const Insn&, uint32_t){}); });
+        streamed = lex.insns;
+    } else {
+        prog = lexProgram(source.text);
+    }
+    prog.dir = fs::path(job.filePath).parent_path().string();
+    st.lines = prog.lines;
+    st.insns = stream ? streamed : prog.text.size();
+    st.labels = prog.labels.size();
+    st.data = prog.data.size();
+    st.symbols = prog.syms.size() - 1;
+    st.lap(st.read);
+    job.arch = selectArchitecture(prog, opt.forced, job.log, opt.detect);
+    st.lap(st.arch);
+    if (!job.arch) {
+        job.log += "Could not determine architecture from syntax.\n";
+        job.noArch = true;
+        return;
+    }
+    job.log += "Architecture: " + job.arch->fullName() + " (" + std::to_string(job.arch->definitionCount) + " defs)\n";
+    const bool linked = !prog.includes.empty();
+    if (linked && (opt.native || stream)) {
+        job.log += std::string("Error: ") + (opt.native ? "-native" : "-stream") + " builds single files; " + job.filePath + " uses .include\n";
+        return;
+    }
+    if (linked && (opt.profile || opt.split > 0)) job.log += "Warning: -profile and -split do not apply to multi-file programs\n";
+    const bool harts = job.arch->harts();
+    if (harts && linked && !opt.native) {
+        job.log += "Error: " + job.arch->fullName() + " harts run single files; " + job.filePath + " uses .include\n";
+        return;
+    }
+    if (harts && opt.native && opt.harts > 1) job.log += "Warning: -native runs one hart\n";
+    if (harts && !opt.native && opt.split > 0) job.log += "Warning: -split does not apply to " + job.arch->fullName() + " (every hart runs main)\n";
+    if (harts && !opt.native && opt.profile) job.log += "Warning: with several harts the profile counts are approximate\n";
+    if (opt.native) {
+        interp::Machine m;
+        try {
+            interp::decode(m, prog, job.arch, opt.memSize);
+            st.lap(st.translate);
+            native::writeExecutable(m, layoutData(prog), job.arch->xlen, job.outputName);
+        } catch (const std::exception& e) {
+            job.log += std::string("Error: ") + e.what() + "\n";
+            return;
+        }
+        st.lap(st.emit);
+        job.native = job.ok = true;
+        return;
+    }
+    if (stream) {
+        job.log += "Streaming " + std::to_string(streamed) + " instructions (no optimizer, no -split)\n";
+        Sha256 hash = BuildCache::hasher(job.arch->fullName(), quoteCommand(opt.compile), BuildCache::compilerIdentity("gcc"));
+        try {
+            streamC(source, prog, streamed, job.arch, opt.memSize, opt.localRegs, job.cfile, cache.enabled ? &hash : nullptr, st);
+        } catch (const std::runtime_error& e) {
+            job.log += std::string("Error: ") + e.what() + "\n";
+            std::remove(job.cfile.c_str());
+            return;
+        }
+        job.units.assign(1, std::string());     // the C is already in cfile
+        if (cache.enabled) {
+            job.key = hash.hex();
+            job.hit = cache.fetch(job.key, job.outputName);
+        }
+        if (job.hit && !opt.keepC) std::remove(job.cfile.c_str());
+        st.lap(st.cache);
+        job.ok = true;
+        return;
+    }
+    OptStats stats;
+    Profile profile;
+    profile.branches = opt.profile > 1;
+    try {
+        size_t chunk = opt.split >= 0 ? (size_t)opt.split : prog.text.size() > AutoSplitInsns ? SplitChunkInsns : 0;
+        if (linked) job.units = emitModules(prog, job.filePath, job.arch, opt, opt.dataflow ? &stats : nullptr, st, job.log);
+        else job.units = emitC(prog, job.arch, opt.memSize, opt.localRegs, opt.dataflow ? &stats : nullptr, chunk, &st, opt.profile ? &profile : nullptr, opt.structured);
+    } catch (const std::runtime_error& e) {
+        job.log += std::string("Error: ") + e.what() + "\n";
+        return;
+    }
+    if (opt.optStats && opt.dataflow) {
+        if (!stats.skipped.empty()) job.log += "Optimizer: skipped (" + stats.skipped + ")\n";
+        else job.log += "Optimizer: " + std::to_string(stats.blocks) + " blocks; constprop folded " + std::to_string(stats.folded)
+            + ", " + std::to_string(stats.constOperands) + " operands; copyprop " + std::to_string(stats.copies)
+            + " operands; dse removed " + std::to_string(stats.deadStores) + " dead, " + std::to_string(stats.zeroWrites) + " zero-register writes\n";
+        if (opt.structured)
+            job.log += "Control flow: " + std::to_string(stats.whiles) + " loops, " + std::to_string(stats.ifs) + " ifs ("
+                + std::to_string(stats.elses) + " with else), " + std::to_string(stats.breaks) + " break/continue\n";
+        job.log += "Loop idioms: " + std::to_string(stats.loops.size()) + " replaced\n";
+        for (auto& l : stats.loops) job.log += "  " + l + "\n";
+    }
+    if (job.units.size() > 1 && !linked)
+        job.log += "Split into " + std::to_string(job.units.size() - 1) + " chunks\n";
+    if (cache.enabled) {
+        std::string all;
+        for (auto& u : job.units) all.append(u).push_back('\0');
+        std::string gcc = BuildCache::compilerIdentity("gcc");
+        job.key = BuildCache::key(all, job.arch->fullName(), quoteCommand(opt.compile), gcc);
+        job.hit = cache.fetch(job.key, job.outputName);
+        if (!job.hit && job.units.size() > 1)
+            for (auto& u : job.units) job.unitKeys.push_back(BuildCache::key(u, job.arch->fullName(), quoteCommand(opt.compile) + " -c", gcc));
+    }
+    st.lap(st.cache);
+    for (auto& u : job.units) st.cBytes += u.size();
+    if (!job.hit || opt.keepC)
+        for (size_t k = 0; k < job.units.size(); ++k)
+            std::ofstream(job.unitFile(k), std::ios::binary) << job.units[k];
+    st.lap(st.emit);
+    job.ok = true;
+}
+
+static std::string jsonString(std::string_view v) {
+    std::string out = "\"";
+    for (char c : v) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+// -bench: for each architecture (or just -arch), generates a synthetic
+// program (see Synth.h) and times the front end (lexing, architecture
+// guessing, translation and C emission), gcc and the program's run, whose
+// output is drained through a pipe and counted for the output rate. The
+// front end repeats until it has run for a quarter second, so small programs
+// still get a stable rate; detection from a BenchDetectPrefix-byte prefix is
+// timed beside it, outside the front-end total. Prints one JSON object per line.
+constexpr size_t BenchDetectPrefix = 64u << 10;
+
+static int runBenchmark(const SynthSpec& spec, const AsmDefinition* only, const BuildOptions& opt, bool keep) {
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::time_point a, Clock::time_point b){ return std::chrono::duration<double>(b - a).count(); };
+    int status = 0;
+    for (auto* def : architectures) {
+        if (only && def != only) continue;
+        std::string source = synthProgram(def, spec);
+        std::string stem = "bench-" + normalizeArchKey(def->fullName());
+        if (!keep) stem = (fs::temp_directory_path() / ("ezm-" + BuildCache::uniqueSuffix() + "-" + stem)).string();
+        if (keep) std::ofstream(stem + ".ezm", std::ios::binary) << source;
+
+        double lexTime = 0, guessTime = 0, detectTime = 0, emitTime = 0;
+        unsigned reps = 0;
+        uint32_t lines = 0, insns = 0;
+        bool guessed = false, detected = false;
+        BuildJob job;
+        job.arch = def;
+        job.cfile = stem + ".c";
+        job.outputName = stem + ".exe";
+        do {
+            auto t0 = Clock::now();
+            Program prog = lexProgram(source);
+            auto t1 = Clock::now();
+            guessed = guessArchitecture(prog) == def;
+            auto t2 = Clock::now();
+            detected = archIndex().guessPrefix(source, BenchDetectPrefix) == def;
+            detectTime += seconds(t2, Clock::now());
+            t2 = Clock::now();
+            size_t chunk = opt.split >= 0 ? (size_t)opt.split : prog.text.size() > AutoSplitInsns ? SplitChunkInsns : 0;
+            OptStats stats;
+            try {
+                job.units = emitC(prog, def, opt.memSize, opt.localRegs, opt.dataflow ? &stats : nullptr, chunk, nullptr, nullptr, opt.structured);
+            } catch (const std::runtime_error& e) {
+                std::cerr << def->fullName() << ": " << e.what() << "\n";
+                return 1;
+            }
+            auto t3 = Clock::now();
+            lexTime += seconds(t0, t1);
+            guessTime += seconds(t1, t2);
+            emitTime += seconds(t2, t3);
+            lines = prog.lines;
+            insns = (uint32_t)prog.text.size();
+            ++reps;
+        } while (lexTime + guessTime + emitTime < 0.25);
+        size_t cBytes = 0;
+        for (size_t k = 0; k < job.units.size(); ++k) {
+            std::ofstream(job.unitFile(k), std::ios::binary) << job.units[k];
+            cBytes += job.units[k].size();
+        }
+
+        auto t0 = Clock::now();
+        int built = 0;
+        if (job.units.size() == 1) built = runCommand(compileCommand(opt, job.cfile, job.outputName, def));
+        else {
+            std::vector<Command> cmds;
+            for (size_t k = 0; k < job.units.size(); ++k) cmds.push_back(objectCommand(opt, job, k));
+            runCommands(cmds, std::max(1u, std::thread::hardware_concurrency()), [&](size_t, int st){ if (st) built = st; });
+            if (!built) built = runCommand(linkCommand(opt, job));
+        }
+        auto t1 = Clock::now();
+        int exitStatus = -1;
+        uint64_t outputBytes = 0;
+        if (!built) {
+            std::string exe = job.outputName;
+            if (exe.find('/') == std::string::npos) exe = "./" + exe;
+            exitStatus = runCommandCounting({exe}, outputBytes);
+        }
+        auto t2 = Clock::now();
+        for (size_t k = 0; k < job.units.size(); ++k) {
+            if (!keep) std::remove(job.unitFile(k).c_str());
+            if (job.units.size() > 1) std::remove(job.unitFile(k, ".o").c_str());
+        }
+        if (!keep) std::remove(job.outputName.c_str());
+        if (built) status = 1;
+
+        double front = (lexTime + guessTime + emitTime) / reps;
+        std::string flags;
+        for (size_t k = 1; k + 3 < opt.compile.size(); ++k) flags += (flags.empty() ? "" : " ") + opt.compile[k];
+        std::ostringstream out;
+        out.precision(6);
+        out << "{\"arch\":" << jsonString(def->fullName())
+            << ",\"insns\":" << insns << ",\"lines\":" << lines << ",\"source_bytes\":" << source.size()
+            << ",\"mix\":[" << spec.alu << "," << spec.mem << "," << spec.branch << "," << spec.io << "],\"seed\":" << spec.seed
+            << ",\"optimize\":" << (opt.localRegs ? "true" : "false") << ",\"dataflow\":" << (opt.dataflow ? "true" : "false")
+            << ",\"structured\":" << (opt.structured ? "true" : "false")
+            << ",\"cflags\":" << jsonString(flags)
+            << ",\"reps\":" << reps << ",\"lex_s\":" << lexTime / reps << ",\"guess_s\":" << guessTime / reps
+            << ",\"emit_s\":" << emitTime / reps << ",\"guess_ok\":" << (guessed ? "true" : "false")
+            << ",\"detect_prefix_s\":" << detectTime / reps << ",\"detect_ok\":" << (detected ? "true" : "false")
+            << ",\"frontend_lines_per_s\":" << (front > 0 ? lines / front : 0)
+            << ",\"c_bytes\":" << cBytes << ",\"units\":" << job.units.size()
+            << ",\"gcc_s\":" << seconds(t0, t1) << ",\"gcc_status\":" << built
+            << ",\"run_s\":" << (built ? 0.0 : seconds(t1, t2)) << ",\"exit\":" << exitStatus
+            << ",\"output_bytes\":" << outputBytes
+            << ",\"output_mb_per_s\":" << (built || t2 == t1 ? 0.0 : outputBytes / 1e6 / seconds(t1, t2)) << "}\n";
+        std::cout << out.str() << std::flush;
+    }
+    return status;
+}
+
+// -scale: builds the parallel kernel (see Synth.h) for a multi-hart
+// architecture (-arch, or the first there is) once, then times its run with
+// $EZM_HARTS at 1, 2, 4, ... up to -harts or the core count. Speedup and
+// efficiency are against one hart; exit_ok says the run exited as one hart's
+// did. Prints one JSON object per hart count.
+static int runScaling(uint64_t items, const AsmDefinition* only, const BuildOptions& opt, bool keep) {
+    using Clock = std::chrono::steady_clock;
+    const AsmDefinition* def = only;
+    if (!def)
+        for (auto* a : architectures) if (a->harts()) { def = a; break; }
+    if (!def || !def->harts()) { std::cerr << "-scale needs a multi-hart architecture\n"; return 1; }
+    std::string source = synthParallel(def, items);
+    std::string stem = "scale-" + normalizeArchKey(def->fullName());
+    if (!keep) stem = (fs::temp_directory_path() / ("ezm-" + BuildCache::uniqueSuffix() + "-" + stem)).string();
+    if (keep) std::ofstream(stem + ".ezm", std::ios::binary) << source;
+    Program prog = lexProgram(source);
+    std::string cfile = stem + ".c", exe = stem + ".exe";
+    try {
+        OptStats stats;
+        std::ofstream(cfile, std::ios::binary) << emitC(prog, def, opt.memSize, opt.localRegs, opt.dataflow ? &stats : nullptr, 0, nullptr, nullptr, opt.structured)[0];
+    } catch (const std::runtime_error& e) {
+        std::cerr << def->fullName() << ": " << e.what() << "\n";
+        return 1;
+    }
+    int built = runCommand(compileCommand(opt, cfile, exe, def));
+    if (!keep) std::remove(cfile.c_str());
+    if (built) { std::cerr << "gcc failed on the -scale kernel (exit " << built << ")\n"; return 1; }
+    if (exe.find('/') == std::string::npos) exe = "./" + exe;
+
+    long most = opt.harts > 0 ? opt.harts : (long)std::max(1u, std::thread::hardware_concurrency());
+    std::vector<long> counts;
+    for (long h = 1; h < most; h *= 2) counts.push_back(h);
+    counts.push_back(most);
+    std::string flags;
+    for (size_t k = 1; k + 3 < opt.compile.size(); ++k) flags += (flags.empty() ? "" : " ") + opt.compile[k];
+    double one = 0;
+    int oneExit = -1, status = 0;
+    for (long h : counts) {
+        std::string n = std::to_string(h);
+    #ifdef _WIN32
+        _putenv_s("EZM_HARTS", n.c_str());
+    #else
+        setenv("EZM_HARTS", n.c_str(), 1);
+    #endif
+        uint64_t outputBytes = 0;
+        auto t0 = Clock::now();
+        int exitStatus = runCommandCounting({exe}, outputBytes);
+        double run = std::chrono::duration<double>(Clock::now() - t0).count();
+        if (h == 1) { one = run; oneExit = exitStatus; }
+        bool same = exitStatus == oneExit;
+        if (!same) status = 1;
+        std::ostringstream out;
+        out.precision(6);
+        out << "{\"arch\":" << jsonString(def->fullName()) << ",\"items\":" << items << ",\"insns\":" << prog.text.size()
+            << ",\"optimize\":" << (opt.localRegs ? "true" : "false") << ",\"cflags\":" << jsonString(flags)
+            << ",\"harts\":" << h << ",\"run_s\":" << run
+            << ",\"speedup\":" << (run > 0 ? one / run : 0) << ",\"efficiency\":" << (run > 0 ? one / run / (double)h : 0)
+            << ",\"exit\":" << exitStatus << ",\"exit_ok\":" << (same ? "true" : "false")
+            << ",\"output_bytes\":" << outputBytes << "}\n";
+        std::cout << out.str() << std::flush;
+    }
+#ifdef _WIN32
+    _putenv_s("EZM_HARTS", "");
+#else
+    unsetenv("EZM_HARTS");
+#endif
+    if (!keep) std::remove(exe.c_str());
+    return status;
+}
+
+// -fuzz: for each architecture (or just -arch), generates n small programs
+// (Synth.h, seeds counting up from -seed) and runs each in the interpreter,
+// as a -native executable (on x86-64 Linux) and built from C as `plain` and
+// `optimized` say (without and with -O). Every run must exit and print as the
+// interpreter's did; each one that does not gets a line (-k keeps its program
+// as fuzz-<arch>-<seed>.ezm) and makes the exit status 1. Ends with one
+// summary line per architecture.
+static int runDifferential(uint64_t count, const SynthSpec& spec, const AsmDefinition* only,
+                           const BuildOptions& plain, const BuildOptions& optimized, bool keep) {
+    struct Run { std::string mode; int exit = 0; std::string out; };
+    int status = 0;
+    for (auto* def : architectures) {
+        if (only && def != only) continue;
+        uint64_t differ = 0;
+        for (uint64_t k = 0; k < count; ++k) {
+            SynthSpec one = spec;
+            one.seed = spec.seed + k;
+            std::string source = synthProgram(def, one);
+            std::string name = "fuzz-" + normalizeArchKey(def->fullName()) + "-" + std::to_string(one.seed);
+            std::string stem = (fs::temp_directory_path() / ("ezm-" + BuildCache::uniqueSuffix() + "-" + name)).string();
+            Program prog = lexProgram(source);
+            std::vector<Run> runs;
+            std::string problem;
+            uint64_t bytes = 0;
+            try {
+                interp::Machine m;
+                interp::decode(m, prog, def, plain.memSize);
+                Run r{"-interp", 0, {}};
+                r.exit = runForkCounting([&]{ return m.run(); }, bytes, &r.out);
+                runs.push_back(std::move(r));
+#if defined(__linux__) && defined(__x86_64__)
+                std::string exe = stem + "-native.exe";
+                native::writeExecutable(m, layoutData(prog), def->xlen, exe);
+                Run n{"-native", 0, {}};
+                n.exit = runCommandCounting({exe}, bytes, &n.out);
+                runs.push_back(std::move(n));
+                std::remove(exe.c_str());
+#endif
+                for (const BuildOptions* o : {&plain, &optimized}) {
+                    Run c{o->localRegs ? "-O" : "C", 0, {}};
+                    OptStats stats;
+                    std::string cfile = stem + ".c", exe = stem + ".exe";
+                    std::ofstream(cfile, std::ios::binary) << emitC(prog, def, o->memSize, o->localRegs, o->dataflow ? &stats : nullptr, 0, nullptr, nullptr, o->structured)[0];
+                    int built = runCommand(compileCommand(*o, cfile, exe, def));
+                    std::remove(cfile.c_str());
+                    if (built) { problem = "gcc failed (exit " + std::to_string(built) + ") for " + c.mode; break; }
+                    c.exit = runCommandCounting({exe}, bytes, &c.out);
+                    std::remove(exe.c_str());
+                    runs.push_back(std::move(c));
+                }
+            } catch (const std::exception& e) {
+                problem = e.what();
+            }
+            for (size_t r = 1; problem.empty() && r < runs.size(); ++r) {
+                const Run& a = runs[0];
+                const Run& b = runs[r];
+                if (a.exit != b.exit) problem = b.mode + " exits " + std::to_string(b.exit) + ", " + a.mode + " " + std::to_string(a.exit);
+                else if (a.out != b.out) {
+                    size_t n = std::min(a.out.size(), b.out.size());
+                    size_t at = (size_t)(std::mismatch(a.out.begin(), a.out.begin() + n, b.out.begin()).first - a.out.begin());
+                    problem = b.mode + " prints differently from " + a.mode + " from byte " + std::to_string(at);
+                }
+            }
+            if (problem.empty()) continue;
+            ++differ;
+            std::cout << def->fullName() << " seed " << one.seed << ": " << problem << "\n" << std::flush;
+            if (keep) std::ofstream(name + ".ezm", std::ios::binary) << source;
+        }
+        std::cout << def->fullName() << ": " << count << " programs, " << differ << " differ\n" << std::flush;
+        if (differ) status = 1;
+    }
+    return status;
+}
+
+// -stats report for one input: three lines of text, or with json one object.
+static void printStats(std::ostream& out, const std::string& file, const AsmDefinition* arch, const PhaseStats& st, bool json, const std::string& prefix) {
+    const std::pair<const char*, double> phases[] = {
+        {"read", st.read}, {"arch", st.arch}, {"layout", st.layout}, {"optimize", st.optimize}, {"translate", st.translate},
+        {"emit", st.emit}, {"cache", st.cache}, {"gcc", st.gcc}, {"run", st.run}};
+    const std::pair<const char*, uint64_t> counts[] = {
+        {"lines", st.lines}, {"instructions", st.insns}, {"translated", st.translated}, {"dropped", st.dropped},
+        {"labels", st.labels}, {"data", st.data}, {"symbols", st.symbols}, {"declared", st.declared}, {"c_bytes", st.cBytes}};
+    std::ostringstream o;
+    o.precision(6);
+    if (json) {
+        o << "{\"file\":" << jsonString(file) << ",\"arch\":" << (arch ? jsonString(arch->fullName()) : "null") << ",\"seconds\":{";
+        for (auto& [name, t] : phases) o << (&name == &phases[0].first ? "" : ",") << "\"" << name << "\":" << t;
+        o << "}";
+        for (auto& [name, n] : counts) o << ",\"" << name << "\":" << n;
+        o << ",\"unknown_opcodes\":[";
+        for (size_t k = 0; k < st.unknown.size(); ++k) o << (k ? "," : "") << jsonString(st.unknown[k]);
+        o << "]}\n";
+    } else {
+        o << std::fixed;
+        o.precision(3);
+        o << prefix << "Stats:";
+        for (auto& [name, t] : phases) o << (&name == &phases[0].first ? " " : ", ") << name << " " << t * 1000 << " ms";
+        o << "\n" << prefix << "Stats: " << st.lines << " lines, " << st.insns << " instructions (" << st.translated << " translated, "
+          << st.dropped << " dropped), " << st.labels << " labels, " << st.data << " data, " << st.symbols << " symbols, "
+          << st.declared << " declared, " << st.cBytes << " bytes of C\n";
+        if (!st.unknown.empty()) {
+            o << prefix << "Stats: unknown opcodes:";
+            for (size_t k = 0; k < st.unknown.size(); ++k) o << (k ? ", " : " ") << st.unknown[k];
+            o << "\n";
+        }
+    }
+    out << o.str();
+}
+
+// -estimate: the static cost report of every input, without building anything.
+static int estimateInputs(const std::vector<std::string>& inputs, const AsmDefinition* forced, size_t detect) {
+    bool batch = inputs.size() > 1;
+    for (auto& path : inputs) {
+        SourceFile source;
+        if (!source.open(path)) { std::cerr << "Cannot read " << path << "\n"; return 1; }
+        Program prog = lexProgram(source.text);
+        prog.dir = fs::path(path).parent_path().string();
+        std::string log;
+        const AsmDefinition* arch = selectArchitecture(prog, forced, log, detect);
+        std::cerr << log;
+        if (!arch) {
+            std::cerr << "Could not determine architecture from syntax.\n";
+            printArchitecturesGrouped();
+            return 1;
+        }
+        if (!prog.includes.empty()) std::cerr << "Warning: " << path << ": -estimate covers this file only, not what it includes\n";
+        try {
+            DataImage image = layoutData(prog);
+            Translator tr(prog, arch, image);
+            if (batch) std::cout << path << ": ";
+            estimate::writeReport(std::cout, prog, arch, estimate::estimateProgram(prog, tr, arch));
+        } catch (const std::exception& e) {
+            std::cerr << path << ": " << e.what() << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Input paths plus the lines of any @manifest (blank lines and # comments skipped).
+static bool addInput(const std::string& arg, std::vector<std::string>& inputs) {
+    if (arg[0] != '@') { inputs.push_back(arg); return true; }
+    std::ifstream in(arg.substr(1));
+    if (!in) return false;
+    for (std::string line; std::getline(in, line);) {
+        std::string path(trimView(line));
+        if (!path.empty() && path[0] != '#') inputs.push_back(path);
+    }
+    return true;
+}
+
+// One invocation: in-process, or on a -server child for a forwarded one.
+static int build(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "EZM 1.A018.22.251023\n"
+                  << "Usage: ezm [options] <file.ezm>... | @manifest\n\n"
+                  << "Options:\n"
+                  << "  -arch <name>   Force architecture (e.g. \"RISC-V RV32I\")\n"
+                  << "  -k             Keep the generated C (temp.c, or <name>.c for several inputs)\n"
+                  << "  -r             Compile, run and delete the executable\n"
+                  << "  -interp        Run the program in the built-in interpreter (no C compiler)\n"
+                  << "  -mem <size>    Guest memory size (e.g. 64M, 1G; default 256M)\n"
+                  << "  -detect <size> Guess the architecture from about this much of the source\n"
+                  << "                 (e.g. 64K), stopping early once one is clearly ahead\n"
+                  << "  -O             Keep registers in locals of their real width and optimize\n"
+                  << "  -native        Write an x86-64 Linux executable directly, without gcc\n"
+                  << "                 (checked like -interp; -O, -split, -profile do not apply)\n"
+                  << "  -cflags \"..\"   Flags for gcc (default with -O: \"-O2 -fwrapv\")\n"
+                  << "  -noopt         Skip constant/copy propagation, dead store elimination and\n"
+                  << "                 byte copy/fill/scan loop replacement\n"
+                  << "  -nostruct      Leave branches as gotos instead of rebuilding loops and ifs\n"
+                  << "  -optstats      Report what each optimizer pass did\n"
+                  << "  -estimate      Report estimated cycles per block and loop, critical paths and\n"
+                  << "                 the instruction mix, without compiling or running\n"
+                  << "  -profile       Count basic blocks; at exit report the hottest lines and blocks\n"
+                  << "                 (to stderr, or to the file $EZM_PROFILE names)\n"
+                  << "  -profile-branches  The same plus taken/not-taken counts per branch\n"
+                  << "  -stats         Report wall time per phase and front-end counters per input\n"
+                  << "  -stats-json    The same as one JSON object per input\n"
+                  << "  -j <n>         Translate and compile up to n inputs at once (default: all cores)\n"
+                  << "  -split <n>     Compile .text as separate chunks of about n instructions\n"
+                  << "                 (0: never; default: 10000 once a program exceeds 50000)\n"
+                  << "  -stream        Translate in two passes without holding the program in memory\n"
+                  << "                 (default for inputs of 256M and up; implies -noopt, no -split)\n"
+                  << "  -bench <n>     Time the pipeline on a generated n-instruction program per\n"
+                  << "                 architecture; prints JSON lines (-k keeps bench-<arch>.*)\n"
+                  << "  -harts <n>     Run the harts of a multi-hart architecture (RISC-V RV64IA) on n host\n"
+                  << "                 threads (default 1; $EZM_HARTS overrides it when the program starts)\n"
+                  << "  -scale <n>     Time a generated n-item parallel kernel at 1, 2, 4, ... harts up to\n"
+                  << "                 -harts or the core count; prints JSON lines (-k keeps scale-<arch>.*)\n"
+                  << "  -fuzz <n>      Run n generated programs per architecture in the interpreter, with\n"
+                  << "                 -native and from C without and with -O; report any that differ\n"
+                  << "  -mix a,m,b[,p] -bench instruction mix in percent: ALU, memory, branch and\n"
+                  << "                 printed lines (default 70,20,10,0; -fuzz 60,15,15,10); -seed <n>\n"
+                  << "                 varies the program\n"
+                  << "  -nocache       Always invoke gcc; don't read or fill the build cache\n"
+                  << "  -cache-size N  Bound the build cache (e.g. 512M; default 256M)\n"
+                  << "  -server <path> Serve builds on a Unix socket with the tables kept warm; while\n"
+                  << "                 EZM_SERVER names that socket, ezm runs there (else in-process)\n\n"
+                  << "Architectures:\n";
+            printArchitecturesGrouped();
+        return 0;
+    }
+    bool keepTemp = false;
+    bool runAfter = false;
+    bool interpret = false;
+    bool estimateOnly = false;
+    bool useCache = true;
+    bool optimize = false;
+    bool dataflow = true;
+    bool optStats = false;
+    bool structured = true;
+    bool haveCflags = false;
+    unsigned jobLimit = 0;
+    long split = -1;
+    bool stream = false;
+    bool bench = false;
+    bool stats = false, statsJson = false;
+    size_t detect = 0;
+    int profile = 0;
+    bool native = false;
+    long harts = 0;
+    uint64_t scaleItems = 0, fuzzCount = 0;
+    bool haveMix = false;
+    SynthSpec spec;
+    uint64_t memSize = DefaultMemSize;
+    std::string archName, cacheSize, cflags;
+    std::vector<std::string> inputs;
+    for (int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.empty()) continue;
+        if (arg == "-k") { keepTemp = true; continue; }
+        if (arg == "-r") { runAfter = true; continue; }
+        if (arg == "-interp") { interpret = true; continue; }
+        if (arg == "-estimate") { estimateOnly = true; continue; }
+        if (arg == "-nocache") { useCache = false; continue; }
+        if (arg == "-O") { optimize = true; continue; }
+        if (arg == "-noopt") { dataflow = false; continue; }
+        if (arg == "-optstats") { optStats = true; continue; }
+        if (arg == "-nostruct") { structured = false; continue; }
+        if (arg == "-stream") { stream = true; continue; }
+        if (arg == "-native") { native = true; continue; }
+        if (arg == "-stats") { stats = true; continue; }
+        if (arg == "-profile") { profile = std::max(profile, 1); continue; }
+        if (arg == "-profile-branches") { profile = 2; continue; }
+        if (arg == "-detect" && i+1 < argc) {
+            detect = (size_t)parseByteSize(argv[++i]);
+            if (!detect) { std::cerr << "Bad detection prefix: " << argv[i] << "\n"; return 1; }
+            continue;
+        }
+        if (arg == "-stats-json") { stats = statsJson = true; continue; }
+        if (arg == "-bench" && i+1 < argc) { bench = true; spec.insns = (size_t)std::max(1L, std::atol(argv[++i])); continue; }
+        if (arg == "-harts" && i+1 < argc) {
+            harts = std::atol(argv[++i]);
+            if (harts < 1 || harts > 4096) { std::cerr << "Bad hart count: " << argv[i] << "\n"; return 1; }
+            continue;
+        }
+        if (arg == "-scale" && i+1 < argc) { scaleItems = std::max(1ull, std::strtoull(argv[++i], nullptr, 10)); continue; }
+        if (arg == "-fuzz" && i+1 < argc) { fuzzCount = std::max(1ull, std::strtoull(argv[++i], nullptr, 10)); continue; }
+        if (arg == "-seed" && i+1 < argc) { spec.seed = std::strtoull(argv[++i], nullptr, 10); continue; }
+        if (arg == "-mix" && i+1 < argc) {
+            spec.io = 0;
+            if (std::sscanf(argv[++i], "%u,%u,%u,%u", &spec.alu, &spec.mem, &spec.branch, &spec.io) < 3) { std::cerr << "Bad mix: " << argv[i] << "\n"; return 1; }
+            haveMix = true;
+            continue;
+        }
+        if (arg == "-cflags" && i+1 < argc) { cflags = argv[++i]; haveCflags = true; continue; }
+        if (arg == "-mem" && i+1 < argc) {
+            memSize = parseByteSize(argv[++i]);
+            if (!memSize) { std::cerr << "Bad memory size: " << argv[i] << "\n"; return 1; }
+            continue;
+        }
+        if (arg == "-cache-size" && i+1 < argc) { cacheSize = argv[++i]; continue; }
+        if (arg == "-arch" && i+1 < argc) { archName = argv[++i]; continue; }
+        if (arg == "-split" && i+1 < argc) {
+            char* end = nullptr;
+            split = std::max(0L, std::strtol(argv[++i], &end, 10));
+            if (end == argv[i] || *end) { std::cerr << "Bad chunk size for -split: " << argv[i] << "\n"; return 1; }
+            continue;
+        }
+        if (arg == "-j" && i+1 < argc) { jobLimit = (unsigned)std::atoi(argv[++i]); continue; }
+        if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0) { jobLimit = (unsigned)std::atoi(arg.c_str() + 2); continue; }
+        if (arg[0] != '-' && !addInput(arg, inputs)) { std::cerr << "Cannot read manifest " << arg.substr(1) << "\n"; return 1; }
+    }
+    if (inputs.empty() && !bench && !scaleItems && !fuzzCount) { std::cerr << "No input file.\n"; return 1; }
+    const AsmDefinition* forced = nullptr;
+    if (!archName.empty()) {
+        forced = findArchBySpec(archName);
+        if (!forced) {
+            std::cerr << "Unknown architecture: " << archName << "\n";
+            return 1;
+        }
+    }
+    BuildOptions opt;
+    opt.forced = forced;
+    opt.keepC = keepTemp;
+    opt.localRegs = optimize;
+    opt.dataflow = dataflow;
+    opt.optStats = optStats;
+    opt.structured = structured;
+    opt.memSize = memSize;
+    opt.split = split;
+    opt.stream = stream;
+    opt.detect = detect;
+    opt.profile = profile;
+    opt.native = native;
+    opt.harts = harts;
+    auto gccWith = [&](bool optimized) {
+        Command cmd = {"gcc"};
+        std::istringstream flagWords(!haveCflags && optimized ? "-O2 -fwrapv" : cflags);   // templates rely on wrapping arithmetic
+        for (std::string w; flagWords >> w;) cmd.push_back(w);
+        if (harts) cmd.push_back("-DHARTS=" + std::to_string(harts));
+        cmd.insert(cmd.end(), {"<c>", "-o", "<exe>"});
+        return cmd;
+    };
+    opt.compile = gccWith(optimize);
+    if (native && (profile || optimize || split > 0)) std::cerr << "Warning: -native ignores -O, -split and -profile\n";
+    if (bench) return runBenchmark(spec, forced, opt, keepTemp);
+    if (scaleItems) return runScaling(scaleItems, forced, opt, keepTemp);
+    if (fuzzCount) {
+        // Short programs whose loop runs a few times, printing and comparing as it goes.
+        if (!haveMix) { spec.alu = 60; spec.mem = 15; spec.branch = 15; spec.io = 10; }
+        spec.insns = 96;
+        spec.iters = 4;
+        spec.compares = true;
+        BuildOptions plain = opt, optimized = opt;
+        plain.localRegs = false;
+        plain.compile = gccWith(false);
+        optimized.localRegs = true;
+        optimized.compile = gccWith(true);
+        return runDifferential(fuzzCount, spec, forced, plain, optimized, keepTemp);
+    }
+    if (estimateOnly) return estimateInputs(inputs, forced, detect);
+    if (interpret) {
+        if (profile) std::cerr << "Warning: -profile applies to compiled programs, not -interp\n";
+        if (harts > 1) std::cerr << "Warning: -interp runs one hart\n";
+        int status = 0;
+        for (auto& path : inputs) {
+            PhaseStats st;
+            SourceFile source;
+            if (!source.open(path)) { std::cerr << "Cannot read " << path << "\n"; return 1; }
+            Program prog = lexProgram(source.text);
+            prog.dir = fs::path(path).parent_path().string();
+            if (!prog.includes.empty()) { std::cerr << "-interp runs single files; " << path << " uses .include\n"; return 1; }
+            st.lines = prog.lines;
+            st.insns = prog.text.size();
+            st.labels = prog.labels.size();
+            st.data = prog.data.size();
+            st.symbols = prog.syms.size() - 1;
+            st.lap(st.read);
+            std::string log;
+            const AsmDefinition* arch = selectArchitecture(prog, forced, log, detect);
+            st.lap(st.arch);
+            std::cerr << log;
+            if (!arch) {
+                std::cerr << "Could not determine architecture from syntax.\n";
+                printArchitecturesGrouped();
+                return 1;
+            }
+            interp::Machine m;
+            try {
+                interp::decode(m, prog, arch, memSize);
+            } catch (const std::exception& e) {
+                std::cerr << "Interpreter: " << e.what() << "\n";
+                return 1;
+            }
+            st.lap(st.translate);
+            status = m.run();
+            st.lap(st.run);
+            if (stats) printStats(std::cerr, path, arch, st, statsJson, "");
+        }
+        return status;
+    }
+    BuildCache cache;
+    if (useCache) cache = BuildCache::fromEnvironment();
+    if (!cacheSize.empty()) {
+        uint64_t n = parseByteSize(cacheSize);
+        if (!n) { std::cerr << "Bad cache size: " << cacheSize << "\n"; return 1; }
+        cache.maxBytes = n;
+    }
+    if (!jobLimit) jobLimit = std::max(1u, std::thread::hardware_concurrency());
+
+    // Every job gets its own C file so concurrent jobs (and ezm processes) never share one.
+    bool batch = inputs.size() > 1;
+    std::vector<BuildJob> jobs(inputs.size());
+    std::unordered_map<std::string, std::string> outputs;
+    for (size_t i=0; i<inputs.size(); ++i) {
+        BuildJob& job = jobs[i];
+        job.filePath = inputs[i];
+        job.outputName = getOutputName(job.filePath);
+        auto [it, fresh] = outputs.emplace(job.outputName, job.filePath);
+        if (!fresh) {
+            std::cerr << job.filePath << " and " << it->second << " would both build " << job.outputName << "\n";
+            return 1;
+        }
+        if (keepTemp) job.cfile = batch ? job.outputName.substr(0, job.outputName.size() - 4) + ".c" : "temp.c";
+        else job.cfile = (fs::temp_directory_path() / ("ezm-" + BuildCache::uniqueSuffix() + ".c")).string();
+    }
+    {
+        std::atomic<size_t> next{0};
+        auto worker = [&]{
+            for (size_t i; (i = next++) < jobs.size();)
+                translateJob(jobs[i], opt, cache);
+        };
+        std::vector<std::thread> pool;
+        for (size_t t=1; t<std::min<size_t>(jobLimit, jobs.size()); ++t) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+    }
+
+    // Whole programs and the units of split and multi-file ones compile side
+    // by side; those link once all of their objects are there.
+    bool failed = false;
+    std::vector<Command> cmds, links;
+    std::vector<size_t> pending, pendingUnit, linking;
+    for (auto& job : jobs) {
+        std::string prefix = batch ? job.filePath + ": " : "";
+        for (size_t b=0, e; b<job.log.size(); b=e+1) {
+            e = job.log.find('\n', b);
+            std::cout << prefix << job.log.substr(b, e-b) << "\n";
+        }
+        if (!job.ok) { failed = true; if (job.noArch && !batch) printArchitecturesGrouped(); continue; }
+        if (job.native) {
+            if (!runAfter) std::cout << prefix << "Native x86-64 " << job.filePath << " -> " << job.outputName << "\n";
+            continue;
+        }
+        if (job.hit) {
+            if (!runAfter)
+                std::cout << prefix << "Cache hit (" << job.key.substr(0, 12) << ") -> " << job.outputName << "\n";
+            continue;
+        }
+        // Objects of unchanged units come from the cache; gcc only compiles the rest.
+        size_t at = &job - jobs.data(), cached = 0;
+        if (job.units.size() == 1) {
+            cmds.push_back(compileCommand(opt, job.cfile, job.outputName, job.arch));
+            pending.push_back(at);
+            pendingUnit.push_back(0);
+            job.pendingUnits = 1;
+        } else {
+            for (size_t k = 0; k < job.units.size(); ++k) {
+                if (!job.unitKeys.empty() && cache.fetch(job.unitKeys[k], job.unitFile(k, ".o"))) { ++cached; continue; }
+                cmds.push_back(objectCommand(opt, job, k));
+                pending.push_back(at);
+                pendingUnit.push_back(k);
+                ++job.pendingUnits;
+            }
+            if (!job.pendingUnits) {
+                links.push_back(linkCommand(opt, job));
+                linking.push_back(at);
+            }
+        }
+        if (!runAfter) {
+            if (cache.enabled) std::cout << prefix << "Cache miss (" << job.key.substr(0, 12) << ")\n";
+            std::cout << prefix << "Compiling " << job.filePath << " -> " << job.outputName;
+            if (cached) std::cout << " (" << cached << " of " << job.units.size() << " objects cached)";
+            std::cout << " ...\n";
+        }
+    }
+    std::cout.flush();
+    auto finish = [&](BuildJob& job, int status) {
+        job.stats.lap(job.stats.gcc);
+        if (status == 0) cache.store(job.key, job.outputName);
+        else if (job.ok) {
+            std::cerr << "gcc failed on " << job.filePath << " (exit " << status << ")\n";
+            job.ok = false;
+            failed = true;
+        }
+        for (size_t k = 0; k < job.units.size(); ++k) {
+            if (!keepTemp) std::remove(job.unitFile(k).c_str());
+            if (job.units.size() > 1) std::remove(job.unitFile(k, ".o").c_str());
+        }
+    };
+    runCommands(cmds, jobLimit, [&](size_t k, int status){
+        BuildJob& job = jobs[pending[k]];
+        if (job.units.size() == 1) { finish(job, status); return; }
+        if (status == 0 && !job.unitKeys.empty()) cache.store(job.unitKeys[pendingUnit[k]], job.unitFile(pendingUnit[k], ".o"));
+        if (status != 0 && job.ok) {
+            std::cerr << "gcc failed on " << job.filePath << " (exit " << status << ")\n";
+            job.ok = false;
+            failed = true;
+        }
+        if (--job.pendingUnits) return;
+        if (!job.ok) { finish(job, 1); return; }
+        links.push_back(linkCommand(opt, job));
+        linking.push_back(pending[k]);
+    }, [&](size_t k){
+        BuildJob& job = jobs[pending[k]];
+        if (!job.compiling) { job.compiling = true; job.stats.mark = PhaseStats::Clock::now(); }
+    });
+    runCommands(links, jobLimit, [&](size_t k, int status){ finish(jobs[linking[k]], status); });
+    int ran = 0;                        // -r: the last nonzero exit status of a program
+    for (auto& job : jobs) {
+        if (!job.ok) continue;
+        if (runAfter) {
+            job.stats.mark = PhaseStats::Clock::now();
+        #ifdef _WIN32
+            int status = runCommand({job.outputName});
+        #else
+            int status = runCommand({"./" + job.outputName});
+        #endif
+            if (status) ran = status;
+            job.stats.lap(job.stats.run);
+            std::remove(job.outputName.c_str());
+        } else {
+            std::cout << "Done. Run ./" << job.outputName << "\n";
+        }
+    }
+    // On stderr, so the report never mixes with what -r prints.
+    if (stats) {
+        std::cout.flush();
+        for (auto& job : jobs) printStats(std::cerr, job.filePath, job.arch, job.stats, statsJson, batch ? job.filePath + ": " : "");
+    }
+    return failed ? 1 : ran;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 3 && std::string(argv[1]) == "-server")
+        return server::serve(argv[2], []{ archIndex(); }, [](std::vector<std::string>& args){
+            std::vector<char*> v{const_cast<char*>("ezm")};
+            for (auto& a : args) v.push_back(a.data());
+            v.push_back(nullptr);
+            return build((int)args.size() + 1, v.data());
+        });
+    int status = 0;
+    if (const char* at = std::getenv("EZM_SERVER"); at && *at && argc > 1 && server::forward(at, argc, argv, status))
+        return status;
+    return build(argc, argv);
+}
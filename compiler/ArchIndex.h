@@ -0,0 +1,99 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "AsmDefinition.h"
+#include "Program.h"
+
+// Architecture detection. Every mnemonic and register name of every
+// architecture goes into one index that maps the token to bitmasks of the
+// architectures knowing it as an opcode and as a register, so scoring a token
+// is a single lookup however many architectures there are. An opcode is
+// worth 3 points to each architecture that has it, a register 1.
+//
+// guess() scores a lexed program's distinct symbols by use count and stops
+// once the leader is ahead by more than the remaining symbols could still
+// give anyone, so it always agrees with scoring everything. guessPrefix()
+// reads the source itself, a few KiB at a time, and stops once one
+// architecture leads every other by DecisiveLead points, or at the byte limit.
+class ArchIndex {
+public:
+    static constexpr long DecisiveLead = 96;
+    static constexpr size_t PrefixStep = 4096;
+
+    ArchIndex(const AsmDefinition* const* list, size_t n) : defs(list, list + n) {
+        if (n > 64) throw std::logic_error("ArchIndex holds at most 64 architectures");
+        for (size_t k = 0; k < n; ++k) {
+            for (int i = 0; i < defs[k]->definitionCount; ++i) index[defs[k]->ops[i].name].ops |= 1ull << k;
+            for (size_t i = 0; i < defs[k]->traitCount; ++i) index[defs[k]->traits[i]].regs |= 1ull << k;
+        }
+    }
+
+    const AsmDefinition* guess(const Program& prog) const {
+        std::vector<long> scores(defs.size(), 0);
+        long remaining = 0;
+        for (Sym s = 1; s < prog.syms.size(); ++s) remaining += 3L * prog.syms.uses[s];
+        for (Sym s = 1; s < prog.syms.size(); ++s) {
+            if (uint32_t uses = prog.syms.uses[s]) {
+                remaining -= 3L * uses;
+                add(scores, prog.syms[s], uses);
+            }
+            if ((s & 255) == 0 && lead(scores) > remaining) break;
+        }
+        return best(scores);
+    }
+
+    // limit 0 reads the whole source.
+    const AsmDefinition* guessPrefix(std::string_view src, size_t limit) const {
+        std::vector<long> scores(defs.size(), 0);
+        Program scratch;
+        Lexer lex(scratch);
+        size_t end = limit && limit < src.size() ? limit : src.size();
+        for (size_t pos = 0; pos < end;) {
+            size_t stop = std::min(pos + PrefixStep, end);
+            if (stop < src.size()) {
+                size_t nl = src.rfind('\n', stop - 1);
+                if (nl == std::string_view::npos || nl < pos) nl = src.find('\n', stop);
+                stop = nl == std::string_view::npos ? src.size() : nl + 1;
+            }
+            lex.feed(src.substr(pos, stop - pos), [&](const Insn& in, uint32_t){
+                for (Sym s : {in.op, in.a, in.b, in.c}) if (s) add(scores, scratch.syms[s], 1);
+            });
+            pos = stop;
+            if (lead(scores) >= DecisiveLead) break;
+        }
+        return best(scores);
+    }
+
+private:
+    struct Entry { uint64_t ops = 0, regs = 0; };
+    std::vector<const AsmDefinition*> defs;
+    std::unordered_map<std::string_view, Entry> index;
+
+    void add(std::vector<long>& scores, std::string_view tok, uint32_t uses) const {
+        auto it = index.find(tok);
+        if (it == index.end()) return;
+        for (uint64_t m = it->second.ops; m; m &= m - 1) scores[__builtin_ctzll(m)] += 3L * uses;
+        for (uint64_t m = it->second.regs; m; m &= m - 1) scores[__builtin_ctzll(m)] += uses;
+    }
+    // How far the leader is ahead of the runner-up.
+    static long lead(const std::vector<long>& scores) {
+        long first = 0, second = 0;
+        for (long s : scores) {
+            if (s > first) { second = first; first = s; }
+            else if (s > second) second = s;
+        }
+        return first - second;
+    }
+    // The first architecture with the top score, if anything scored.
+    const AsmDefinition* best(const std::vector<long>& scores) const {
+        const AsmDefinition* top = nullptr;
+        long topScore = 0;
+        for (size_t k = 0; k < defs.size(); ++k)
+            if (scores[k] > topScore) { topScore = scores[k]; top = defs[k]; }
+        return top;
+    }
+};
@@ -1,27 +1,230 @@
-#pragma once
-#include <string>
-#include <unordered_map>
-#include <vector>
-
-struct AsmDefinition {
-    std::string GT;
-    std::string SBST;
-
-    std::vector<std::string> traits;
-    std::unordered_map<std::string, std::string> dict;
-    int definitionCount;
-
-    AsmDefinition(std::string gt,
-                  std::string sbst,
-                  std::vector<std::string> t,
-                  std::unordered_map<std::string, std::string> d)
-        : GT(std::move(gt)),
-          SBST(std::move(sbst)),
-          traits(std::move(t)),
-          dict(std::move(d)),
-          definitionCount(static_cast<int>(dict.size())) {}
-
-    std::string fullName() const {
-        return SBST.empty() ? GT : (GT + " " + SBST);
-    }
-};
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include "Template.h"
+
+// Architecture definitions are built entirely at compile time: a header in
+// comp/ lists register traits and opcode templates as constexpr arrays and
+// instantiates ArchTable over them, which compiles every template into slot
+// programs and builds perfect hashes for opcode and register lookup. Nothing
+// is constructed at startup.
+
+struct OpDef { std::string_view name, tmpl; };
+
+// An extension's table: the base architecture's opcodes followed by its own.
+template<size_t N, size_t M>
+constexpr std::array<OpDef, N + M> extendOps(const OpDef (&base)[N], const OpDef (&more)[M]) {
+    std::array<OpDef, N + M> all{};
+    for (size_t i=0; i<N; ++i) all[i] = base[i];
+    for (size_t i=0; i<M; ++i) all[N + i] = more[i];
+    return all;
+}
+
+// Estimated cost of an opcode (Estimate.h): cycles until its result can be
+// used, and cycles until the next instruction can issue. Opcodes an
+// architecture's table leaves out get the cost of their class.
+struct OpCost { std::string_view name; uint8_t latency, interval; };
+
+constexpr uint32_t nameHash(std::string_view s) {
+    uint32_t h = 2166136261u;
+    for (char c : s) { h ^= (uint8_t)c; h *= 16777619u; }
+    return h;
+}
+
+constexpr uint32_t displace(uint32_t h, uint32_t seed) {
+    h += seed * 0x9E3779B9u;
+    h ^= h >> 16; h *= 0x85EBCA6Bu;
+    h ^= h >> 13; h *= 0xC2B2AE35u;
+    return h ^ (h >> 16);
+}
+
+// Hash-and-displace: keys are split into buckets by their hash, and each
+// bucket gets a seed that sends all of its keys to free slots.
+struct HashView {
+    const uint32_t* seeds = nullptr;
+    const int16_t* slots = nullptr;
+    uint32_t buckets = 1, mask = 0;
+
+    template<class KeyAt>
+    constexpr int find(std::string_view s, KeyAt keyAt) const {
+        uint32_t h = nameHash(s);
+        int i = slots[displace(h, seeds[h % buckets]) & mask];
+        return (i >= 0 && keyAt(i) == s) ? i : -1;
+    }
+};
+
+template<size_t N>
+struct PerfectHash {
+    static constexpr uint32_t buckets = N/2 + 1;
+    static constexpr uint32_t size = [] { uint32_t m = 4; while (m < 2*N) m *= 2; return m; }();
+    uint32_t seeds[buckets] = {};
+    int16_t slots[size] = {};
+
+    template<class KeyAt>
+    constexpr void build(KeyAt keyAt) {
+        for (auto& s : slots) s = -1;
+        uint32_t hashes[N + 1] = {};
+        uint32_t count[buckets] = {};
+        for (size_t i=0; i<N; ++i) {
+            hashes[i] = nameHash(keyAt(i));
+            ++count[hashes[i] % buckets];
+            for (size_t j=0; j<i; ++j)
+                if (keyAt(i) == keyAt(j)) throw "duplicate key in architecture table";
+        }
+        bool done[buckets] = {};
+        for (uint32_t round=0; round<buckets; ++round) {
+            uint32_t b = 0, most = 0;                  // largest unplaced bucket first
+            for (uint32_t k=0; k<buckets; ++k)
+                if (!done[k] && count[k] >= most) { b = k; most = count[k]; }
+            done[b] = true;
+            if (!most) continue;
+            for (uint32_t seed=1;; ++seed) {
+                if (seed > 1u << 20) throw "no perfect hash seed";
+                uint32_t taken[N + 1] = {};
+                size_t n = 0;
+                bool ok = true;
+                for (size_t i=0; i<N && ok; ++i) {
+                    if (hashes[i] % buckets != b) continue;
+                    uint32_t s = displace(hashes[i], seed) & (size - 1);
+                    if (slots[s] >= 0) ok = false;
+                    for (size_t j=0; j<n && ok; ++j) if (taken[j] == s) ok = false;
+                    taken[n++] = s;
+                }
+                if (!ok) continue;
+                n = 0;
+                for (size_t i=0; i<N; ++i)
+                    if (hashes[i] % buckets == b) slots[taken[n++]] = (int16_t)i;
+                seeds[b] = seed;
+                break;
+            }
+        }
+    }
+    constexpr HashView view() const { return {seeds, slots, buckets, size - 1}; }
+};
+
+struct AsmDefinition {
+    std::string_view GT;
+    std::string_view SBST;
+    unsigned xlen = 32;                         // register width in bits
+    std::string_view zeroReg;                   // hardwired to zero, if the ISA has one
+    std::string_view stackReg;                  // starts at the top of guest memory
+    std::string_view hartReg, hartCountReg;     // multi-hart: each hart starts with its id and the hart count here
+
+    const std::string_view* traits = nullptr;
+    size_t traitCount = 0;
+    const OpDef* ops = nullptr;
+    const SlotProgram* programs = nullptr;     // parallel to ops
+    int definitionCount = 0;
+    const OpCost* costs = nullptr;
+    size_t costCount = 0;
+
+    const char* lits = nullptr;
+    const TemplatePiece* pieces = nullptr;
+    const TemplateName* writeNames = nullptr;
+    HashView opIndex, regIndex;
+
+    // Memory-ordering suffixes (.aq, .rl, .aqrl) select the plain opcode's template.
+    constexpr int opcode(std::string_view op) const {
+        int i = opIndex.find(op, [this](int i){ return ops[i].name; });
+        if (i >= 0) return i;
+        for (std::string_view suffix : {std::string_view(".aqrl"), std::string_view(".aq"), std::string_view(".rl")})
+            if (op.size() > suffix.size() && op.substr(op.size() - suffix.size()) == suffix)
+                return opIndex.find(op.substr(0, op.size() - suffix.size()), [this](int i){ return ops[i].name; });
+        return -1;
+    }
+    constexpr int reg(std::string_view r) const {
+        return regIndex.find(r, [this](int i){ return traits[i]; });
+    }
+    constexpr const SlotProgram* find(std::string_view op) const {
+        int i = opcode(op);
+        return i < 0 ? nullptr : &programs[i];
+    }
+    constexpr const OpCost* cost(std::string_view op) const {
+        for (size_t i=0; i<costCount; ++i) if (costs[i].name == op) return &costs[i];
+        return nullptr;
+    }
+    template<size_t N>
+    constexpr AsmDefinition costed(const OpCost (&table)[N]) const {
+        AsmDefinition d = *this;
+        d.costs = table;
+        d.costCount = N;
+        return d;
+    }
+    constexpr AsmDefinition multiHart(std::string_view id, std::string_view count) const {
+        AsmDefinition d = *this;
+        d.hartReg = id;
+        d.hartCountReg = count;
+        return d;
+    }
+    bool harts() const { return !hartCountReg.empty(); }
+    std::string_view write(const SlotProgram& p, size_t k) const {
+        const TemplateName& n = writeNames[p.write + k];
+        return {lits + n.lit, n.len};
+    }
+
+    // ops[i] is the rendered text of the i-th assembly operand; labelOps[i] is
+    // the same operand rendered as a C label.
+    void emit(const SlotProgram& p, const std::string_view* ops, const std::string_view* labelOps, std::string& out) const {
+        for (const TemplatePiece* pc = pieces + p.piece, *end = pc + p.pieceCount; pc != end; ++pc) {
+            out.append(lits + pc->lit, pc->len);
+            if (pc->slot == SlotNone) continue;
+            int k = p.operandFor(pc->slot);
+            if (k < 0) continue;
+            out.append(pc->slot == SlotLabel ? labelOps[k] : ops[k]);
+        }
+    }
+
+    std::string fullName() const {
+        return SBST.empty() ? std::string(GT) : (std::string(GT) + " " + std::string(SBST));
+    }
+};
+
+template<const auto& Traits, const auto& Ops>
+struct ArchTable {
+    static constexpr size_t R = std::size(Traits);
+    static constexpr size_t N = std::size(Ops);
+    static constexpr TemplateSizes sizes = [] {
+        TemplateSizes s;
+        for (auto& op : Ops) {
+            TemplateSizes t = measureTemplate(op.tmpl);
+            s.lits += t.lits; s.pieces += t.pieces; s.writes += t.writes;
+        }
+        return s;
+    }();
+    static_assert(sizes.lits < 65536 && sizes.pieces < 65536, "template pools are indexed by uint16_t");
+
+    SlotProgram programs[N] = {};
+    TemplatePools<sizes.lits, sizes.pieces, sizes.writes> pools{};
+    PerfectHash<N> opHash{};
+    PerfectHash<R> regHash{};
+
+    constexpr ArchTable() {
+        for (size_t i=0; i<N; ++i) programs[i] = pools.compile(Ops[i].tmpl);
+        opHash.build([](size_t i){ return Ops[i].name; });
+        regHash.build([](size_t i){ return Traits[i]; });
+    }
+
+    constexpr AsmDefinition define(std::string_view gt, std::string_view sbst, unsigned xlen, std::string_view zero = {}, std::string_view stack = {}) const {
+        AsmDefinition d;
+        d.GT = gt;
+        d.SBST = sbst;
+        d.xlen = xlen;
+        d.zeroReg = zero;
+        d.stackReg = stack;
+        d.traits = std::data(Traits);
+        d.traitCount = R;
+        d.ops = std::data(Ops);
+        d.programs = programs;
+        d.definitionCount = (int)N;
+        d.lits = pools.lits;
+        d.pieces = pools.pieces;
+        d.writeNames = pools.writes;
+        d.opIndex = opHash.view();
+        d.regIndex = regHash.view();
+        return d;
+    }
+};
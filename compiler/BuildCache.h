@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+// Content-addressed store of built executables. The key is a SHA-256 over
+// the emitted C, the architecture and the compiler command line (plus the
+// compiler binary's size and mtime), so an unchanged program never reaches
+// gcc twice. Entries are written to a private temporary name and renamed
+// into place, which keeps concurrent ezm processes from ever seeing a
+// partial binary; eviction runs under an advisory lock, oldest-used first.
+
+namespace fs = std::filesystem;
+
+struct Sha256 {
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t buf[64];
+    uint64_t total = 0;
+    size_t used = 0;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+    void block(const uint8_t* p) {
+        static const uint32_t k[64] = {
+            0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+            0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+            0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+            0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+            0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+            0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+            0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+            0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2};
+        uint32_t w[64];
+        for (int i=0; i<16; ++i) w[i] = (uint32_t)p[4*i]<<24 | (uint32_t)p[4*i+1]<<16 | (uint32_t)p[4*i+2]<<8 | p[4*i+3];
+        for (int i=16; i<64; ++i) {
+            uint32_t s0 = rotr(w[i-15],7) ^ rotr(w[i-15],18) ^ (w[i-15] >> 3);
+            uint32_t s1 = rotr(w[i-2],17) ^ rotr(w[i-2],19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+        uint32_t a=h[0], b=h[1], c=h[2], d=h[3], e=h[4], f=h[5], g=h[6], hh=h[7];
+        for (int i=0; i<64; ++i) {
+            uint32_t t1 = hh + (rotr(e,6) ^ rotr(e,11) ^ rotr(e,25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a,2) ^ rotr(a,13) ^ rotr(a,22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
+        }
+        h[0]+=a; h[1]+=b; h[2]+=c; h[3]+=d; h[4]+=e; h[5]+=f; h[6]+=g; h[7]+=hh;
+    }
+    Sha256& update(std::string_view s) {
+        const uint8_t* p = (const uint8_t*)s.data();
+        size_t n = s.size();
+        total += n;
+        if (used) {
+            size_t take = std::min(n, 64 - used);
+            std::memcpy(buf + used, p, take);
+            used += take; p += take; n -= take;
+            if (used < 64) return *this;
+            block(buf); used = 0;
+        }
+        for (; n >= 64; p += 64, n -= 64) block(p);
+        std::memcpy(buf, p, n);
+        used = n;
+        return *this;
+    }
+    std::string hex() {
+        uint64_t bits = total * 8;
+        uint8_t pad = 0x80;
+        update(std::string_view((const char*)&pad, 1));
+        uint8_t zero = 0;
+        while (used != 56) update(std::string_view((const char*)&zero, 1));
+        uint8_t len[8];
+        for (int i=0; i<8; ++i) len[i] = (uint8_t)(bits >> (56 - 8*i));
+        update(std::string_view((const char*)len, 8));
+        static const char* digits = "0123456789abcdef";
+        std::string out;
+        for (uint32_t v : h)
+            for (int i=28; i>=0; i-=4) out += digits[(v >> i) & 15];
+        return out;
+    }
+};
+
+// "512M", "2G", "65536" -> bytes; 0 on a malformed size.
+inline uint64_t parseByteSize(const std::string& s) {
+    char* end = nullptr;
+    double v = std::strtod(s.c_str(), &end);
+    if (end == s.c_str() || v < 0) return 0;
+    switch (*end) {
+        case 'k': case 'K': v *= 1024.0; break;
+        case 'm': case 'M': v *= 1024.0 * 1024; break;
+        case 'g': case 'G': v *= 1024.0 * 1024 * 1024; break;
+        case 0: break;
+        default: return 0;
+    }
+    return (uint64_t)v;
+}
+
+struct BuildCache {
+    fs::path dir;
+    uint64_t maxBytes = 256ull << 20;
+    bool enabled = false;
+
+    // EZM_CACHE_DIR, else $XDG_CACHE_HOME/ezm, else ~/.cache/ezm. EZM_CACHE_SIZE bounds it.
+    static BuildCache fromEnvironment() {
+        BuildCache c;
+        if (const char* d = std::getenv("EZM_CACHE_DIR"); d && *d) c.dir = d;
+        else if (const char* x = std::getenv("XDG_CACHE_HOME"); x && *x) c.dir = fs::path(x) / "ezm";
+        else if (const char* h = std::getenv("HOME"); h && *h) c.dir = fs::path(h) / ".cache" / "ezm";
+        else return c;
+        if (const char* s = std::getenv("EZM_CACHE_SIZE"); s && *s)
+            if (uint64_t n = parseByteSize(s)) c.maxBytes = n;
+        std::error_code ec;
+        fs::create_directories(c.dir / "tmp", ec);
+        c.enabled = !ec;
+        return c;
+    }
+
+    // Identifies the compiler binary that `program` resolves to on PATH.
+    static std::string compilerIdentity(const std::string& program) {
+        const char* path = std::getenv("PATH");
+        if (!path) return program;
+#ifdef _WIN32
+        const char sep = ';';
+#else
+        const char sep = ':';
+#endif
+        std::string_view rest(path);
+        while (!rest.empty()) {
+            size_t e = rest.find(sep);
+            fs::path candidate = fs::path(std::string(rest.substr(0, e))) / program;
+            std::error_code ec;
+            if (fs::is_regular_file(candidate, ec)) {
+                auto size = fs::file_size(candidate, ec);
+                auto time = fs::last_write_time(candidate, ec).time_since_epoch().count();
+                return candidate.string() + ":" + std::to_string(size) + ":" + std::to_string(time);
+            }
+            if (e == std::string_view::npos) break;
+            rest.remove_prefix(e + 1);
+        }
+        return program;
+    }
+
+    // Hashes everything but the C, for callers that feed the C in pieces.
+    static Sha256 hasher(std::string_view arch, std::string_view command, std::string_view compiler) {
+        Sha256 h;
+        std::string_view nul("\0", 1);
+        h.update(arch).update(nul).update(command).update(nul).update(compiler).update(nul);
+        return h;
+    }
+
+    static std::string key(std::string_view csrc, std::string_view arch, std::string_view command, std::string_view compiler) {
+        return hasher(arch, command, compiler).update(csrc).hex();
+    }
+
+    fs::path entry(const std::string& key) const { return dir / key.substr(0, 2) / key; }
+
+    // Copies a cached executable to dest and marks it recently used.
+    bool fetch(const std::string& key, const std::string& dest) const {
+        if (!enabled) return false;
+        std::error_code ec;
+        fs::path src = entry(key);
+        if (!fs::copy_file(src, dest, fs::copy_options::overwrite_existing, ec) || ec) return false;
+        fs::last_write_time(src, fs::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    // Publishes a freshly built executable under key.
+    void store(const std::string& key, const std::string& built) const {
+        if (!enabled) return;
+        std::error_code ec;
+        fs::path target = entry(key);
+        fs::create_directories(target.parent_path(), ec);
+        fs::path tmp = dir / "tmp" / (key + "." + uniqueSuffix());
+        if (!fs::copy_file(built, tmp, fs::copy_options::overwrite_existing, ec) || ec) { fs::remove(tmp, ec); return; }
+        fs::rename(tmp, target, ec);
+        if (ec) { fs::remove(tmp, ec); return; }
+        evict();
+    }
+
+    static std::string uniqueSuffix() {
+        static uint64_t counter = 0;
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+#ifdef _WIN32
+        long pid = 0;
+#else
+        long pid = (long)getpid();
+#endif
+        return std::to_string(pid) + "." + std::to_string(now) + "." + std::to_string(++counter);
+    }
+
+    // Drops least recently used entries until the cache is below 90% of maxBytes.
+    // Only one process evicts at a time; the others skip it.
+    void evict() const {
+#ifndef _WIN32
+        int lock = open((dir / "lock").c_str(), O_CREAT | O_RDWR, 0644);
+        if (lock < 0) return;
+        if (flock(lock, LOCK_EX | LOCK_NB) != 0) { close(lock); return; }
+#endif
+        struct Item { fs::path path; uint64_t size; fs::file_time_type used; };
+        std::vector<Item> items;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (!it->is_regular_file(ec) || it->path().parent_path() == dir) continue;
+            if (it->path().parent_path().filename() == "tmp") continue;
+            uint64_t size = it->file_size(ec);
+            if (ec) { ec.clear(); continue; }
+            items.push_back({it->path(), size, it->last_write_time(ec)});
+            total += size;
+        }
+        if (total > maxBytes) {
+            std::sort(items.begin(), items.end(), [](const Item& a, const Item& b){ return a.used < b.used; });
+            uint64_t goal = maxBytes / 10 * 9;
+            for (auto& item : items) {
+                if (total <= goal) break;
+                if (fs::remove(item.path, ec)) total -= item.size;
+            }
+        }
+#ifndef _WIN32
+        flock(lock, LOCK_UN);
+        close(lock);
+#endif
+    }
+};
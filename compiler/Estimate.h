@@ -0,0 +1,259 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Optimizer.h"
+
+// Static cost estimate, from the source alone. Every instruction gets a class
+// from the micro-ops its template compiles to (see Interp.h) and that class's
+// cost, unless the architecture's cost table names the opcode. Blocks are the
+// optimizer's. Each block runs on a single-issue in-order pipeline that stalls
+// until an instruction's operands are ready (a load also waits for the stores
+// before it); its estimate is when the last instruction has issued and the
+// last result is ready. The critical path is the longest chain of latencies
+// through the block's registers and memory. A loop is a branch back to a
+// block; one iteration is the cheapest and the dearest path from that block
+// to the branch, with one iteration of each inner loop on the way. A call
+// costs itself and returns to the next block. Branches count as not taken.
+
+namespace estimate {
+
+enum Class : uint8_t { Alu, Mul, Div, Load, Store, Atomic, Branch, Jump, System, Nop, Unknown, Classes };
+
+// A classic five-stage pipeline with a multi-cycle multiplier and divider;
+// an atomic read-modify-write holds the cache line for a round trip.
+inline constexpr OpCost classCost[Classes] = {
+    {"alu", 1, 1}, {"mul", 3, 1}, {"div", 20, 20}, {"load", 2, 1}, {"store", 1, 1}, {"atomic", 10, 10},
+    {"branch", 1, 1}, {"jump", 1, 2}, {"system", 20, 20}, {"nop", 0, 1}, {"unknown", 1, 1}
+};
+
+struct Block {
+    uint32_t begin, end;                // instructions
+    uint32_t cycles = 0, path = 0;
+    std::vector<uint32_t> chain;        // the critical path, first to last
+};
+
+struct Loop {
+    uint32_t head, tail;                // blocks; tail is the last that branches back
+    uint32_t low = 0, high = 0;         // cycles per iteration
+    uint32_t inner = 0;
+};
+
+struct Report {
+    std::string skipped;                // why nothing could be estimated
+    std::vector<Block> blocks;
+    std::vector<Loop> loops;
+    size_t mix[Classes] = {};
+    uint64_t total = 0;                 // every block once
+};
+
+struct Estimator {
+    const Program& prog;
+    const AsmDefinition* def;
+    opt::Optimizer o;
+    std::vector<uint8_t> cls;
+
+    Estimator(const Program& p, Translator& tr, const AsmDefinition* d) : prog(p), def(d), o(p, tr) {}
+
+    static Class classify(const opt::Optimizer& o, const opt::InsnInfo& in) {
+        if (!in.ok) return Unknown;
+        bool mul = false, div = false, load = false, store = false, sys = false;
+        for (uint32_t u = in.uop0; u < in.uop1; ++u)
+            switch (o.m.code[u].k) {
+                case interp::MUL: mul = true; break;
+                case interp::DIVS: case interp::DIVU: case interp::REMS: case interp::REMU: div = true; break;
+                case interp::LD8S: case interp::LD8U: case interp::LD16S: case interp::LD16U:
+                case interp::LD32S: case interp::LD32U: case interp::LD64: load = true; break;
+                case interp::ST8: case interp::ST16: case interp::ST32: case interp::ST64: store = true; break;
+                case interp::SYSCALL: case interp::HALT: sys = true; break;
+                default: break;
+            }
+        if (sys) return System;
+        if (div) return Div;
+        if (mul) return Mul;
+        if (load && store) return Atomic;
+        if (load) return Load;
+        if (store) return Store;
+        if (in.fx & opt::FxBranch) return Branch;
+        if (in.fx & (opt::FxJump | opt::FxIndirect)) return Jump;
+        for (uint32_t u = in.uop0; u < in.uop1; ++u) if (o.m.code[u].k != interp::NOP) return Alu;
+        return Nop;
+    }
+
+    // The block ends in a jump that links: the code after it runs on return.
+    bool calls(uint32_t b) const {
+        const opt::InsnInfo& in = o.info[o.blockStart[b + 1] - 1];
+        if (!(in.fx & (opt::FxJump | opt::FxIndirect))) return false;
+        auto pc = o.m.regIndex.find("PC");
+        for (uint8_t k = 0; k < in.defs; ++k) {
+            uint32_t d = o.defsOf(in)[k];
+            if (d != o.discard && (pc == o.m.regIndex.end() || d != pc->second)) return true;
+        }
+        return false;
+    }
+
+    OpCost cost(uint32_t i) const {
+        if (const OpCost* c = def->cost(prog.name(prog.text[i].op))) return *c;
+        return classCost[cls[i]];
+    }
+
+    void schedule(Block& b, uint32_t stamp, std::vector<uint32_t>& seen, std::vector<uint32_t>& ready,
+                  std::vector<uint32_t>& path, std::vector<uint32_t>& from, std::vector<uint32_t>& pathAt, std::vector<uint32_t>& prev) {
+        uint32_t issue = 0, done = 0;
+        uint32_t storeReady = 0, storePath = 0, storeFrom = ~0u;
+        for (uint32_t i = b.begin; i < b.end; ++i) {
+            const opt::InsnInfo& in = o.info[i];
+            OpCost c = cost(i);
+            uint32_t start = issue, longest = 0, before = ~0u;
+            auto after = [&](uint32_t at, uint32_t len, uint32_t by) {
+                start = std::max(start, at);
+                if (len > longest || before == ~0u) { longest = len; before = by; }
+            };
+            const uint32_t* uses = o.usesOf(in);
+            for (uint8_t k = 0; k < in.uses; ++k)
+                if (seen[uses[k]] == stamp) after(ready[uses[k]], path[uses[k]], from[uses[k]]);
+            if ((cls[i] == Load || cls[i] == Atomic) && storeFrom != ~0u) after(storeReady, storePath, storeFrom);
+            issue = start + c.interval;
+            done = std::max(done, start + c.latency);
+            pathAt[i] = longest + c.latency;
+            prev[i] = longest ? before : ~0u;
+            const uint32_t* defs = o.defsOf(in);
+            for (uint8_t k = 0; k < in.defs; ++k) {
+                seen[defs[k]] = stamp;
+                ready[defs[k]] = start + c.latency;
+                path[defs[k]] = pathAt[i];
+                from[defs[k]] = i;
+            }
+            if (cls[i] == Store || cls[i] == Atomic) { storeReady = start + c.latency; storePath = pathAt[i]; storeFrom = i; }
+            if (pathAt[i] > b.path) { b.path = pathAt[i]; b.chain.assign(1, i); }
+        }
+        b.cycles = std::max(issue, done);
+        if (b.chain.empty()) return;
+        for (uint32_t i = prev[b.chain[0]]; i != ~0u; i = prev[i]) b.chain.push_back(i);
+        std::reverse(b.chain.begin(), b.chain.end());
+    }
+
+    Report run() {
+        Report r;
+        uint32_t n = (uint32_t)prog.text.size();
+        if (!n) return r;
+        if (!o.prepare(def, true, false)) { r.skipped = o.result.stats.skipped; return r; }
+        cls.resize(n);
+        for (uint32_t i = 0; i < n; ++i) ++r.mix[cls[i] = classify(o, o.info[i])];
+
+        uint32_t nb = (uint32_t)o.succ.size(), nr = o.regs();
+        std::vector<uint32_t> seen(nr, 0), ready(nr), path(nr), from(nr), pathAt(n), prev(n);
+        r.blocks.resize(nb);
+        for (uint32_t b = 0; b < nb; ++b) {
+            Block& k = r.blocks[b];
+            k.begin = o.blockStart[b];
+            k.end = o.blockStart[b + 1];
+            schedule(k, b + 1, seen, ready, path, from, pathAt, prev);
+            r.total += k.cycles;
+        }
+
+        // Loops by header, innermost first. A path follows forward edges from
+        // the header to a branch back to it; an inner loop on the way is one
+        // node that costs an iteration and leaves by any of its exits.
+        std::vector<uint32_t> tail(nb, ~0u), heads;
+        for (uint32_t b = 0; b < nb; ++b)
+            for (uint32_t s : o.succ[b])
+                if (s <= b && (tail[s] == ~0u || b > tail[s])) tail[s] = b;
+        for (uint32_t h = 0; h < nb; ++h) if (tail[h] != ~0u) heads.push_back(h);
+        std::stable_sort(heads.begin(), heads.end(), [&](uint32_t x, uint32_t y) { return tail[x] - x < tail[y] - y; });
+        std::vector<uint32_t> lo(nb), hi(nb), loopLow(nb), loopHigh(nb);
+        std::vector<uint8_t> costed(nb, 0);
+        for (uint32_t h : heads) {
+            Loop l{h, tail[h]};
+            auto nested = [&](uint32_t u) { return u != h && costed[u] && tail[u] <= l.tail; };
+            std::fill(lo.begin() + h, lo.begin() + l.tail + 1, ~0u);
+            std::fill(hi.begin() + h, hi.begin() + l.tail + 1, 0);
+            lo[h] = hi[h] = r.blocks[h].cycles;
+            l.low = ~0u;
+            for (uint32_t u = h; u <= l.tail; ++u) {
+                if (lo[u] == ~0u) continue;
+                uint32_t last = u;
+                if (nested(u)) { last = tail[u]; ++l.inner; }
+                auto step = [&](uint32_t s) {
+                    if (s == h) { l.low = std::min(l.low, lo[u]); l.high = std::max(l.high, hi[u]); }
+                    if (s <= last || s > l.tail) return;
+                    lo[s] = std::min(lo[s], lo[u] + (nested(s) ? loopLow[s] : r.blocks[s].cycles));
+                    hi[s] = std::max(hi[s], hi[u] + (nested(s) ? loopHigh[s] : r.blocks[s].cycles));
+                };
+                for (uint32_t x = u; x <= last; ++x) {
+                    for (uint32_t s : o.succ[x]) step(s);
+                    if (x + 1 < nb && calls(x)) step(x + 1);
+                }
+                u = last;
+            }
+            if (l.low == ~0u) continue;         // nothing comes back: not a loop after all
+            costed[h] = 1;
+            loopLow[h] = l.low;
+            loopHigh[h] = l.high;
+            r.loops.push_back(l);
+        }
+        std::sort(r.loops.begin(), r.loops.end(), [](const Loop& x, const Loop& y) { return x.head < y.head; });
+        return r;
+    }
+};
+
+inline Report estimateProgram(const Program& prog, Translator& tr, const AsmDefinition* def) {
+    return Estimator(prog, tr, def).run();
+}
+
+inline void writeReport(std::ostream& out, const Program& prog, const AsmDefinition* def, const Report& r) {
+    std::vector<Sym> label(prog.text.size() + 1, 0);
+    for (auto it = prog.labels.rbegin(); it != prog.labels.rend(); ++it) label[it->at] = it->name;
+    auto lines = [&](uint32_t a, uint32_t b) {
+        char buf[64];
+        uint32_t x = prog.text[a].line, y = prog.text[b - 1].line;
+        if (x == y) std::snprintf(buf, sizeof buf, "line %u", x);
+        else std::snprintf(buf, sizeof buf, "lines %u-%u", x, y);
+        std::string s = buf;
+        if (label[a]) s += " (" + std::string(prog.name(label[a])) + ")";
+        return s;
+    };
+    size_t width = 0;
+    for (auto& b : r.blocks) width = std::max(width, lines(b.begin, b.end).size());
+
+    out << "Estimate for " << def->fullName() << ": " << prog.text.size() << " instructions, "
+        << r.blocks.size() << " blocks, " << r.loops.size() << " loops\n";
+    if (!r.skipped.empty()) { out << "Not estimated: " << r.skipped << "\n"; return; }
+    if (prog.text.empty()) return;
+    out << "Instruction mix:";
+    const char* sep = " ";
+    for (int c = 0; c < Classes; ++c) {
+        if (!r.mix[c]) continue;
+        char buf[64];
+        std::snprintf(buf, sizeof buf, "%s%s %zu (%.0f%%)", sep, classCost[c].name.data(), r.mix[c], 100.0 * r.mix[c] / prog.text.size());
+        out << buf;
+        sep = ", ";
+    }
+    out << "\nBlocks (cycles; critical path and the lines on it):\n";
+    for (auto& b : r.blocks) {
+        std::string where = lines(b.begin, b.end);
+        char buf[64];
+        std::snprintf(buf, sizeof buf, "%5u insns %6u cycles  path %u", b.end - b.begin, b.cycles, b.path);
+        out << "  " << where << std::string(width - where.size(), ' ') << buf;
+        size_t m = b.chain.size();
+        for (size_t k = 0; k < m; ++k) {
+            if (m > 6 && k == 3) { out << " -> (" << m - 5 << " more)"; k = m - 3; continue; }
+            out << (k ? " -> " : ": ") << prog.text[b.chain[k]].line;
+        }
+        out << "\n";
+    }
+    if (!r.loops.empty()) out << "Loops (cycles per iteration):\n";
+    for (auto& l : r.loops) {
+        std::string where = lines(r.blocks[l.head].begin, r.blocks[l.tail].end);
+        out << "  " << where << std::string(std::max(width, where.size()) - where.size(), ' ') << "  " << l.low;
+        if (l.high != l.low) out << "-" << l.high;
+        if (l.inner) out << ", " << l.inner << " inner loop" << (l.inner > 1 ? "s" : "") << " at one iteration";
+        out << "\n";
+    }
+    out << "Total: " << r.total << " cycles with every block run once\n";
+}
+
+} // namespace estimate
@@ -0,0 +1,282 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Optimizer.h"
+
+// Loop idioms. Byte loops that copy, fill, or scan for a terminating zero get
+// a fast path in front of their label: one memmove, memset or memchr over
+// guest memory, the registers set to what the loop would have left in them,
+// and a jump past the loop. The fast path only runs when that is exact: every
+// byte inside [0, top), a count that is positive and, for 32-bit guests, no
+// register leaving the int32 range; for a copy, no overlap that memmove would
+// resolve differently from a forward byte loop. Otherwise the loop runs as
+// written. Being ahead of the label, it runs once per entry by fall-through,
+// not per iteration; a loop entered only by jumps keeps its plain form.
+// Shapes, with the increments in any order and any offsets:
+//   copy  L: lb/lbu t, a(src)  ..  sb t, b(dst)  ..  bne x, y, L
+//   fill  L: sb v, a(dst)  ..  bne x, y, L
+//   scan  L: lb/lbu t, a(p)  ..  bne t, zero, L
+//         L: lb/lbu t, a(p)  beq t, zero, Done  ..  j L  Done:
+// where ".." are addi r, r, +-1 (each register once; pointers step +1), x is
+// one of those registers and y, v registers the loop does not write.
+
+namespace idiom {
+
+enum Kind : uint8_t { Copy, Fill, Scan };
+
+struct Step {
+    std::string reg;
+    int step;                           // +1 or -1
+    uint32_t at;                        // instruction index
+};
+
+struct Loop {
+    Kind kind = Copy;
+    uint32_t head = 0, back = 0;        // first instruction, the branch back to it
+    uint32_t exit = ~0u;                // scan: the beq out of the loop, if any
+    bool load = false, store = false, sign = false;
+    std::string t, src, dst, fill;     // loaded register, bases, stored value
+    int64_t srcOff = 0, dstOff = 0;     // offsets, counting increments that run before the access
+    uint32_t loadAt = 0, storeAt = 0;
+    std::vector<Step> steps;
+    std::string x, y;                   // copy, fill: the registers the back branch compares
+
+    const Step* step(const std::string& r) const {
+        for (auto& s : steps) if (s.reg == r) return &s;
+        return nullptr;
+    }
+};
+
+struct Matcher {
+    const Program& prog;
+    Translator& tr;
+    OptimizedText& opt;
+    std::string zero, top;
+    bool narrow;                        // 32-bit guest
+    std::vector<uint32_t> labelAt;      // by Sym
+    std::vector<uint8_t> labelled;      // by instruction
+
+    Matcher(const Program& p, Translator& t, OptimizedText& o, uint64_t limit)
+        : prog(p), tr(t), opt(o), narrow(t.def->xlen < 64) {
+        if (!tr.def->zeroReg.empty()) zero = sanitizeIdent(tr.def->zeroReg);
+        top = std::to_string(limit) + "ull";
+        uint32_t n = (uint32_t)prog.text.size();
+        labelAt.assign(prog.syms.size(), ~0u);
+        labelled.assign(n + 1, 0);
+        for (auto& l : prog.labels) { labelAt[l.name] = l.at; labelled[l.at] = 1; }
+    }
+
+    static bool ident(std::string_view v) {
+        if (v.empty() || !(std::isalpha((unsigned char)v[0]) || v[0] == '_')) return false;
+        for (char c : v) if (!std::isalnum((unsigned char)c) && c != '_') return false;
+        return true;
+    }
+    static bool integer(std::string_view v, int64_t& out) {
+        std::string s(trimView(v));
+        char* end = nullptr;
+        out = std::strtoll(s.c_str(), &end, 0);
+        return !s.empty() && end && !*end;
+    }
+
+    // A register operand's C variable, or "" for anything else.
+    std::string reg(Sym s) {
+        if (prog.syms.isLabel(s) || (prog.syms.flags[s] & SymImport)) return {};
+        std::string_view v = tr.operand(s);
+        return ident(v) ? std::string(v) : std::string();
+    }
+    // Slot k of instruction i as the emitted C reads it: the optimizer's
+    // constant or copy, 0 for the zero register, else the operand.
+    std::string value(uint32_t i, int k, Sym s) {
+        auto it = opt.operands.find(i);
+        if (it != opt.operands.end() && !it->second[k].empty()) return it->second[k];
+        std::string r = reg(s);
+        if (!r.empty() && r == zero) return "0";
+        return r.empty() ? std::string(tr.operand(s)) : r;
+    }
+    bool memory(Sym s, std::string& base, int64_t& off) {
+        std::string_view t = prog.name(s);
+        size_t lp = t.find('('), rp = t.find(')');
+        if (lp == std::string_view::npos || rp == std::string_view::npos || rp < lp) return false;
+        std::string_view imm = trimView(t.substr(0, lp));
+        base = sanitizeIdent(trimView(t.substr(lp + 1, rp - lp - 1)));
+        if (imm.empty()) off = 0;
+        else if (!integer(imm, off)) return false;
+        return ident(base) && base != zero;
+    }
+    bool loopsTo(Sym s, uint32_t head) const { return s && prog.syms.isLabel(s) && labelAt[s] == head; }
+
+    // The loop whose back branch is at e, or false.
+    bool match(uint32_t h, uint32_t e, Loop& L) {
+        L.head = h;
+        L.back = e;
+        Sym syms[3];
+        for (uint32_t i = h; i < e; ++i) {
+            if (opt.action[i] == OptimizedText::Drop) continue;        // not in the emitted loop
+            if (opt.action[i] == OptimizedText::Replace && !opt.operands.count(i)) return false;
+            const Insn& in = prog.text[i];
+            if (!tr.find(in.op)) return false;
+            std::string_view op = prog.name(in.op);
+            int n = tr.operands(in, syms);
+            if ((op == "lb" || op == "lbu") && n == 2 && !L.load) {
+                L.load = true;
+                L.sign = op == "lb";
+                L.loadAt = i;
+                L.t = reg(syms[0]);
+                if (L.t.empty() || L.t == zero || !memory(syms[1], L.src, L.srcOff)) return false;
+            } else if (op == "sb" && n == 2 && !L.store) {
+                L.store = true;
+                L.storeAt = i;
+                if (!memory(syms[0], L.dst, L.dstOff)) return false;
+                L.fill = value(i, 1, syms[1]);
+            } else if ((op == "addi" || op == "addiu") && n == 3) {
+                std::string d = reg(syms[0]);
+                int64_t imm;
+                if (d.empty() || d == zero || d != reg(syms[1]) || !integer(prog.name(syms[2]), imm) || (imm != 1 && imm != -1)) return false;
+                if (opt.operands.count(i)) return false;
+                for (auto& s : L.steps) if (s.reg == d) return false;
+                L.steps.push_back({d, (int)imm, i});
+            } else if (op == "beq" && n == 3 && L.exit == ~0u && L.load && i > L.loadAt) {
+                std::string a = value(i, 0, syms[0]), b = value(i, 1, syms[1]);
+                if (!((a == L.t && b == "0") || (a == "0" && b == L.t))) return false;
+                if (!prog.syms.isLabel(syms[2]) || labelAt[syms[2]] != e + 1) return false;
+                L.exit = i;
+            } else return false;
+        }
+
+        const Insn& in = prog.text[e];
+        std::string_view op = prog.name(in.op);
+        int n = tr.operands(in, syms);
+        if (opt.action[e] == OptimizedText::Replace && !opt.operands.count(e)) return false;
+        if (L.exit != ~0u) {
+            // scan with the test in the middle: an unconditional jump back
+            bool jump = (op == "j" && n == 1 && loopsTo(syms[0], h))
+                || (op == "jal" && n == 2 && reg(syms[0]) == zero && !zero.empty() && loopsTo(syms[1], h));
+            if (!jump || L.store) return false;
+            L.kind = Scan;
+        } else {
+            if (op != "bne" || n != 3 || !loopsTo(syms[2], h)) return false;
+            std::string a = value(e, 0, syms[0]), b = value(e, 1, syms[1]);
+            if (L.load && !L.store && ((a == L.t && b == "0") || (a == "0" && b == L.t))) L.kind = Scan;
+            else if (L.load && L.store && L.fill == L.t && L.loadAt < L.storeAt) L.kind = Copy;
+            else if (!L.load && L.store) L.kind = Fill;
+            else return false;
+            if (L.kind != Scan) {
+                if (L.step(a)) { L.x = a; L.y = b; }
+                else { L.x = b; L.y = a; }
+                if (!L.step(L.x) || L.step(L.y) || L.y == L.t) return false;
+            }
+        }
+
+        // Pointers step +1; nothing else the loop reads changes in it.
+        auto pointer = [&](const std::string& base, int64_t& off, uint32_t at) {
+            const Step* s = L.step(base);
+            if (!s || s->step != 1) return false;
+            if (s->at < at) ++off;
+            return true;
+        };
+        if (L.load && (!pointer(L.src, L.srcOff, L.loadAt) || L.src == L.t)) return false;
+        if (L.store && !pointer(L.dst, L.dstOff, L.storeAt)) return false;
+        if (L.load && L.store && L.src == L.dst) return false;
+        if (L.step(L.t)) return false;
+        if (L.kind == Fill && (L.step(L.fill) || L.fill == L.t)) return false;
+        return true;
+    }
+
+    static std::string plus(int64_t v) {
+        if (!v) return {};
+        return v < 0 ? " - " + std::to_string(-v) : " + " + std::to_string(v);
+    }
+
+    // Range guards and updates for the stepped registers. A copy or fill runs
+    // every step _len times; a scan also runs the steps ahead of its test once more.
+    void steps(const Loop& L, std::string& guard, std::string& update) {
+        for (auto& s : L.steps) {
+            std::string count = "_len";
+            if (L.kind == Scan && (L.exit == ~0u || s.at < L.exit)) count = "(_len + 1)";
+            if (narrow)
+                guard += s.step > 0 ? " && (int64_t)" + s.reg + " + " + count + " <= 2147483647"
+                                    : " && (int64_t)" + s.reg + " - " + count + " >= -2147483647 - 1";
+            update += "            " + s.reg + (s.step > 0 ? " += " : " -= ") + count + ";\n";
+        }
+    }
+
+    // The fast path for L, ahead of its label.
+    std::string emit(const Loop& L, const std::string& done) {
+        std::string guard, update, out;
+        out = "    {   /* line " + std::to_string(prog.text[L.head].line) + ": ";
+        if (L.kind == Scan) {
+            out += "byte scan -> memchr */\n"
+                   "        uint64_t _from = (uint64_t)((int64_t)" + L.src + plus(L.srcOff) + ");\n"
+                   "        const uint8_t* _hit = _from < " + top + " ? (const uint8_t*)memchr(mem + _from, 0, " + top + " - _from) : NULL;\n"
+                   "        int64_t _len = _hit ? _hit - (mem + _from) : 0;\n";
+            steps(L, guard, update);
+            out += "        if (_hit" + guard + ") {\n" + update
+                 + "            " + L.t + " = 0;\n";
+        } else {
+            const Step* x = L.step(L.x);
+            out += L.kind == Copy ? "byte copy -> memmove */\n" : "byte fill -> memset */\n";
+            out += x->step > 0 ? "        int64_t _len = (int64_t)" + L.y + " - (int64_t)" + L.x + ";\n"
+                               : "        int64_t _len = (int64_t)" + L.x + " - (int64_t)" + L.y + ";\n";
+            out += "        uint64_t _to = (uint64_t)((int64_t)" + L.dst + plus(L.dstOff) + ");\n";
+            guard = "_len > 0 && (uint64_t)_len <= " + top + " && _to <= " + top + " - (uint64_t)_len";
+            if (L.kind == Copy) {
+                out += "        uint64_t _from = (uint64_t)((int64_t)" + L.src + plus(L.srcOff) + ");\n";
+                guard += " && _from <= " + top + " - (uint64_t)_len && (_to <= _from || _to - _from >= (uint64_t)_len)";
+            }
+            steps(L, guard, update);
+            out += "        if (" + guard + ") {\n";
+            if (L.kind == Copy)
+                out += "            memmove(mem + _to, mem + _from, (size_t)_len);\n" + update
+                     + "            " + L.t + " = " + (L.sign ? "(int8_t)" : "(uint8_t)") + "mem[_to + _len - 1];\n";
+            else
+                out += "            memset(mem + _to, (uint8_t)(" + L.fill + "), (size_t)_len);\n" + update;
+        }
+        out += "            goto " + done + ";\n"
+               "        }\n"
+               "    }\n";
+        return out;
+    }
+
+    // Loops are at most this long, so a scan from each label stays cheap.
+    static constexpr uint32_t MaxBody = 16;
+
+    void run() {
+        uint32_t n = (uint32_t)prog.text.size();
+        for (auto& l : prog.labels) {
+            uint32_t h = l.at;
+            if (h >= n || opt.before.count(h)) continue;
+            if (h) {                        // reached by fall-through?
+                const SlotProgram* p = tr.find(prog.text[h-1].op);
+                if (p && (p->flags & (TmplBranches | TmplJumpsPC)) && !(p->flags & TmplConditional)) continue;
+            }
+            for (uint32_t e = h; e < n && e < h + MaxBody; ++e) {
+                if (e > h && labelled[e]) break;
+                const Insn& in = prog.text[e];
+                if (!loopsTo(in.a, h) && !loopsTo(in.b, h) && !loopsTo(in.c, h)) continue;
+                Loop L;
+                if (match(h, e, L)) {
+                    std::string done = "_idiom_" + std::to_string(e);
+                    opt.before[h] = emit(L, done);
+                    opt.after[e] = "    " + done + ":;\n";
+                    static const char* what[] = {"byte copy -> memmove", "byte fill -> memset", "byte scan -> memchr"};
+                    opt.stats.loops.push_back("line " + std::to_string(prog.text[h].line) + ": " + what[L.kind]);
+                }
+                break;
+            }
+        }
+    }
+};
+
+} // namespace idiom
+
+// Adds the fast paths to opt. top bounds the guest addresses they touch:
+// the memory size, and for 32-bit guests below 2^31 so no address is negative.
+inline void recognizeLoops(const Program& prog, Translator& tr, OptimizedText& opt, uint64_t memSize) {
+    if (opt.action.size() != prog.text.size()) return;
+    uint64_t top = tr.def->xlen < 64 ? std::min<uint64_t>(memSize, 0x7fffffff) : memSize;
+    idiom::Matcher(prog, tr, opt, top).run();
+}
@@ -0,0 +1,843 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "AsmDefinition.h"
+#include "Memory.h"
+#include "Program.h"
+#include "Runtime.h"
+#include "Translator.h"
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// -interp runs the .text section without a C compiler. Each instruction is
+// rendered through its slot program exactly as the emitter would write it,
+// and that C statement is parsed once into typed micro-ops over one flat
+// value array (registers, then constants, then temporaries). Branch targets
+// are resolved to micro-op indices and the result runs under a threaded
+// (computed goto) dispatch loop. Guest memory follows Memory.h; every access
+// is bounds checked against memSize.
+
+namespace interp {
+
+enum Kind : uint8_t {
+    MOV, ADD, SUB, MUL, DIVS, DIVU, REMS, REMU, SHL, SHRS, SHRU, AND, OR, XOR,
+    EQ, NE, LTS, LTU, LES, LEU, NOT, NEG, LNOT,
+    SEXT8, SEXT16, SEXT32, ZEXT8, ZEXT16, ZEXT32, SEL,
+    LD8S, LD8U, LD16S, LD16U, LD32S, LD32U, LD64, ST8, ST16, ST32, ST64,
+    JMP, BNZ, BZ, JIND, SYSCALL, NOP, HALT, KindCount
+};
+
+// d = a op b; SEL: d = a ? b : c; loads: d = [a]; stores: [a] = b;
+// JMP/BNZ/BZ: target c (micro-op index); JIND: target address in a (PC = ...);
+// SYSCALL: the service in a, arguments from Machine::sys, result to d.
+struct UOp { const void* h; uint32_t d, a, b, c; Kind k; };
+
+struct CType {
+    uint8_t bits = 64; bool sgn = true;
+    bool ptr = false; uint8_t pbits = 0; bool psgn = false;
+};
+constexpr CType IntT{32, true}, PtrT{64, true};
+
+// Slot references carry their region in the top bits until decoding ends.
+enum : uint32_t { RegRef = 0u << 30, ConstRef = 1u << 30, TempRef = 2u << 30, RefMask = 3u << 30 };
+
+inline int64_t normalize(int64_t v, CType t) {
+    switch (t.bits) {
+        case 8:  return t.sgn ? (int64_t)(int8_t)v  : (int64_t)(uint8_t)v;
+        case 16: return t.sgn ? (int64_t)(int16_t)v : (int64_t)(uint16_t)v;
+        case 32: return t.sgn ? (int64_t)(int32_t)v : (int64_t)(uint32_t)v;
+        default: return v;
+    }
+}
+
+inline int64_t fold(Kind k, int64_t a, int64_t b) {
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch (k) {
+        case ADD: return (int64_t)(ua + ub);
+        case SUB: return (int64_t)(ua - ub);
+        case MUL: return (int64_t)(ua * ub);
+        case DIVS: return b ? (b == -1 ? (int64_t)(0 - ua) : a / b) : 0;
+        case DIVU: return ub ? (int64_t)(ua / ub) : 0;
+        case REMS: return b ? (b == -1 ? 0 : a % b) : 0;
+        case REMU: return ub ? (int64_t)(ua % ub) : 0;
+        case SHL:  return (int64_t)(ua << (ub & 63));
+        case SHRS: return a >> (ub & 63);
+        case SHRU: return (int64_t)(ua >> (ub & 63));
+        case AND: return a & b;
+        case OR:  return a | b;
+        case XOR: return a ^ b;
+        case EQ:  return a == b;
+        case NE:  return a != b;
+        case LTS: return a < b;
+        case LTU: return ua < ub;
+        case LES: return a <= b;
+        case LEU: return ua <= ub;
+        case NOT: return ~a;
+        case NEG: return (int64_t)(0 - ua);
+        case LNOT: return !a;
+        default: return a;
+    }
+}
+
+struct Machine {
+    std::vector<UOp> code;
+    std::vector<uint32_t> insnStart;        // instruction index -> first micro-op
+    std::vector<uint32_t> opLine;           // micro-op -> source line, for faults
+    std::vector<int64_t> values;            // registers | constants | temporaries
+    std::vector<std::string> regNames;
+    std::unordered_map<std::string, uint32_t> regIndex;
+    std::vector<int64_t> consts;
+    std::unordered_map<int64_t, uint32_t> constIndex;
+    uint32_t maxTemps = 0;
+    uint8_t* mem = nullptr;
+    uint64_t memSize = 0;
+    uint64_t addrMask = ~0ull;              // 32-bit guests drop the upper address bits
+    SyscallABI abi{};
+    uint32_t sys[5] = {};                   // syscall registers: number, three arguments, result
+    uint64_t brk = 0, heapBase = 0, heapLimit = 0;
+    std::vector<uint8_t> in;                // read(0) buffer, as in the emitted runtime
+    size_t inAt = 0, inEnd = 0;
+
+    Machine() = default;
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+    ~Machine() { unmapGuestMemory(mem, memSize); }
+
+    uint32_t reg(std::string_view name) {
+        auto it = regIndex.find(std::string(name));
+        if (it != regIndex.end()) return it->second;
+        uint32_t i = (uint32_t)regNames.size();
+        regNames.emplace_back(name);
+        regIndex.emplace(std::string(name), i);
+        return RegRef | i;
+    }
+    uint32_t constant(int64_t v) {
+        auto [it, fresh] = constIndex.try_emplace(v, (uint32_t)consts.size());
+        if (fresh) consts.push_back(v);
+        return ConstRef | it->second;
+    }
+
+    [[noreturn]] void fault(const UOp* ip, const char* what, uint64_t addr) const {
+        std::fflush(stdout);
+        size_t i = ip - code.data();
+        std::fprintf(stderr, "Interpreter: %s 0x%llx (line %u)\n", what, (unsigned long long)addr,
+                     i < opLine.size() ? opLine[i] : 0);
+        std::exit(1);
+    }
+
+    int run();
+    bool syscall(const UOp* ip, int& status);
+
+private:
+    uint8_t* span(const UOp* ip, int64_t a, uint64_t n) const {
+        uint64_t at = (uint64_t)a & addrMask;
+        if (n > memSize || at > memSize - n) fault(ip, "memory access out of bounds at", at);
+        return mem + at;
+    }
+    int inByte();
+    int64_t readInt();
+};
+
+// Compiles one rendered C statement into micro-ops.
+struct StmtCompiler {
+    Machine& m;
+    std::string_view s;
+    size_t i = 0;
+    uint32_t line, temps = 0;
+    int64_t pc;                                           // address of this instruction
+    const std::unordered_map<std::string, uint64_t>& symbols;     // &name -> address
+    std::vector<std::pair<uint32_t, std::string>>& gotos;         // micro-op, label
+    std::unordered_map<std::string, CType> locals;
+    CType regType = PtrT;                                 // how registers are declared in the emitted C
+
+    struct Val { uint32_t slot; CType t; bool isConst; int64_t k; };
+
+    [[noreturn]] void fail(const std::string& why) {
+        throw std::runtime_error(why + " in \"" + std::string(trimView(s)) + "\"");
+    }
+
+    // Tokens
+    void skip() {
+        for (;;) {
+            while (i<s.size() && std::isspace((unsigned char)s[i])) ++i;
+            if (s.compare(i, 2, "/*") == 0) {
+                size_t e = s.find("*/", i+2);
+                i = e == std::string_view::npos ? s.size() : e + 2;
+                continue;
+            }
+            return;
+        }
+    }
+    bool at(std::string_view t) { skip(); return s.compare(i, t.size(), t) == 0; }
+    bool eat(std::string_view t) { if (!at(t)) return false; i += t.size(); return true; }
+    void want(std::string_view t) { if (!eat(t)) fail("expected '" + std::string(t) + "'"); }
+    bool atIdent() { skip(); return i<s.size() && (std::isalpha((unsigned char)s[i]) || s[i]=='_'); }
+    std::string_view ident() {
+        skip();
+        size_t a = i;
+        while (i<s.size() && (std::isalnum((unsigned char)s[i]) || s[i]=='_')) ++i;
+        if (a == i) fail("expected identifier");
+        return s.substr(a, i-a);
+    }
+    static bool typeName(std::string_view w, CType& t) {
+        static const std::pair<std::string_view, CType> types[] = {
+            {"int8_t", {8, true}}, {"uint8_t", {8, false}}, {"int16_t", {16, true}}, {"uint16_t", {16, false}},
+            {"int32_t", {32, true}}, {"uint32_t", {32, false}}, {"int64_t", {64, true}}, {"uint64_t", {64, false}},
+            {"intptr_t", {64, true}}, {"uintptr_t", {64, false}}, {"int", {32, true}}, {"char", {8, true}},
+            {"void", {0, false}},
+        };
+        for (auto& [n, ty] : types) if (w == n) { t = ty; return true; }
+        return false;
+    }
+    // The runtime's guest memory accessors: load_i8 .. load_i64, load_u8 .. load_u32, store_8 .. store_64.
+    static bool memoryHelper(std::string_view name, std::string_view prefix, CType& t) {
+        if (name.compare(0, prefix.size(), prefix) != 0) return false;
+        name.remove_prefix(prefix.size());
+        t.sgn = false;
+        if (prefix == "load_") {
+            if (name.empty() || (name[0] != 'i' && name[0] != 'u')) return false;
+            t.sgn = name[0] == 'i';
+            name.remove_prefix(1);
+        }
+        if (name == "8") t.bits = 8;
+        else if (name == "16") t.bits = 16;
+        else if (name == "32") t.bits = 32;
+        else if (name == "64") t.bits = 64;
+        else return false;
+        return true;
+    }
+    // "(type)" or "(type*)" at the cursor; consumes it on success.
+    bool castAhead(CType& t) {
+        size_t save = i;
+        if (!eat("(") || !atIdent()) { i = save; return false; }
+        CType base;
+        if (!typeName(ident(), base)) { i = save; return false; }
+        if (eat("*")) { t = PtrT; t.ptr = true; t.pbits = base.bits; t.psgn = base.sgn; }
+        else t = base;
+        if (!eat(")")) { i = save; return false; }
+        return true;
+    }
+
+    // Emission
+    uint32_t temp() { return TempRef | temps++; }
+    void op(Kind k, uint32_t d, uint32_t a, uint32_t b = 0, uint32_t c = 0) {
+        m.code.push_back({nullptr, d, a, b, c, k});
+        m.opLine.push_back(line);
+    }
+    Val konst(int64_t v, CType t) { v = normalize(v, t); return {m.constant(v), t, true, v}; }
+    Val unary(Kind k, Val a, CType t) {
+        if (a.isConst) return konst(fold(k, a.k, 0), t);
+        uint32_t d = temp(); op(k, d, a.slot);
+        return norm({d, t, false, 0}, t);
+    }
+    // Re-canonicalizes a 64-bit result into a narrower type.
+    Val norm(Val v, CType t) {
+        if (t.bits >= 64 || t.ptr) { v.t = t; return v; }
+        if (v.isConst) return konst(v.k, t);
+        static const Kind sx[] = {SEXT8, SEXT16, SEXT32}, zx[] = {ZEXT8, ZEXT16, ZEXT32};
+        int w = t.bits == 8 ? 0 : t.bits == 16 ? 1 : 2;
+        uint32_t d = temp(); op(t.sgn ? sx[w] : zx[w], d, v.slot);
+        return {d, t, false, 0};
+    }
+    Val convert(Val v, CType to) {
+        if (to.ptr || to.bits == 0) { v.t = to; if (to.bits == 0) v.t.bits = 64; return v; }
+        CType from = v.t;
+        if (from.ptr) from = PtrT;
+        if (to.bits == 64) { v.t = to; if (v.isConst) v = konst(v.k, to); return v; }
+        bool same = from.bits == to.bits && from.sgn == to.sgn;
+        bool widening = from.bits < to.bits && (from.sgn == to.sgn || !from.sgn);
+        if (same || widening) { v.t = to; return v; }
+        return norm(v, to);
+    }
+    static CType promote(CType t) { return (t.ptr || t.bits >= 32) ? (t.ptr ? PtrT : t) : IntT; }
+    static CType common(CType a, CType b) {
+        a = promote(a); b = promote(b);
+        if (a.bits != b.bits) return a.bits > b.bits ? a : b;
+        return {a.bits, a.sgn && b.sgn};
+    }
+    Val binary(std::string_view o, Val a, Val b) {
+        CType t = (o=="<<" || o==">>") ? promote(a.t) : common(a.t, b.t);
+        if (o!="<<" && o!=">>") { a = convert(a, t); b = convert(b, t); }
+        else { a = convert(a, t); b = convert(b, promote(b.t)); }
+        Kind k; CType rt = t; bool wrap = false;
+        if      (o=="+")  { k = ADD; wrap = true; }
+        else if (o=="-")  { k = SUB; wrap = true; }
+        else if (o=="*")  { k = MUL; wrap = true; }
+        else if (o=="/")  { k = t.sgn ? DIVS : DIVU; wrap = true; }
+        else if (o=="%")  { k = t.sgn ? REMS : REMU; }
+        else if (o=="<<") { k = SHL; wrap = true; }
+        else if (o==">>") { k = t.sgn ? SHRS : SHRU; }
+        else if (o=="&")  k = AND;
+        else if (o=="|")  k = OR;
+        else if (o=="^")  k = XOR;
+        else {
+            rt = IntT;
+            bool sw = o==">" || o==">=";
+            if (sw) std::swap(a, b);
+            if      (o=="==") k = EQ;
+            else if (o=="!=") k = NE;
+            else if (o=="<" || o==">")   k = t.sgn ? LTS : LTU;
+            else                         k = t.sgn ? LES : LEU;
+        }
+        if (a.isConst && b.isConst) return konst(fold(k, a.k, b.k), rt);
+        uint32_t d = temp(); op(k, d, a.slot, b.slot);
+        Val r{d, rt, false, 0};
+        return wrap ? norm(r, rt) : r;
+    }
+    Val load(Val addr, uint8_t bits, bool sgn) {
+        static const Kind ks[] = {LD8S, LD16S, LD32S, LD64}, ku[] = {LD8U, LD16U, LD32U, LD64};
+        int w = bits == 8 ? 0 : bits == 16 ? 1 : bits == 32 ? 2 : 3;
+        uint32_t d = temp(); op(sgn ? ks[w] : ku[w], d, addr.slot);
+        return {d, {bits, sgn}, false, 0};
+    }
+    void store(Val addr, Val v, uint8_t bits) {
+        static const Kind k[] = {ST8, ST16, ST32, ST64};
+        int w = bits == 8 ? 0 : bits == 16 ? 1 : bits == 32 ? 2 : 3;
+        op(k[w], 0, addr.slot, v.slot);
+    }
+
+    // Expressions
+    Val number() {
+        skip();
+        size_t a = i;
+        while (i<s.size() && std::isalnum((unsigned char)s[i])) ++i;
+        std::string txt(s.substr(a, i-a));
+        char* end = nullptr;
+        uint64_t v = std::strtoull(txt.c_str(), &end, 0);
+        bool isLong = false, isUnsigned = false;
+        for (; *end; ++end) {
+            if (*end=='l' || *end=='L') isLong = true;
+            else if (*end=='u' || *end=='U') isUnsigned = true;
+            else fail("bad number " + txt);
+        }
+        bool hex = txt.size() > 1 && (txt[1]=='x' || txt[1]=='X');
+        if (isLong || isUnsigned) {
+            if (isLong) return konst((int64_t)v, {64, !isUnsigned && (v <= 0x7FFFFFFFFFFFFFFFull || !hex)});
+            if (v <= 0xFFFFFFFFull) return konst((int64_t)v, {32, false});
+            return konst((int64_t)v, {64, false});
+        }
+        if (v <= 0x7FFFFFFFull) return konst((int64_t)v, IntT);
+        if (hex && v <= 0xFFFFFFFFull) return konst((int64_t)v, {32, false});
+        if (v <= 0x7FFFFFFFFFFFFFFFull) return konst((int64_t)v, {64, true});
+        return konst((int64_t)v, {64, false});
+    }
+    Val primary() {
+        if (eat("(")) { Val v = expr(); want(")"); return v; }
+        skip();
+        if (i<s.size() && std::isdigit((unsigned char)s[i])) return number();
+        std::string name(ident());
+        CType access;
+        if (memoryHelper(name, "load_", access) && eat("(")) {
+            Val addr = convert(expr(), PtrT);
+            want(")");
+            return load(addr, access.bits, access.sgn);
+        }
+        if (name.compare(0, 4, "amo_") == 0 && eat("(")) return atomic(std::string_view(name).substr(4));
+        if (name == "PC") return konst(pc, PtrT);
+        auto lt = locals.find(name);
+        return {m.reg(name), lt == locals.end() ? regType : lt->second, false, 0};
+    }
+    // amo_<op>_<32|64>(addr[, v]) from the A extension's templates, as one
+    // hart sees it: lr is a load, sc a store that succeeds (0), the rest
+    // load, combine and store, returning the old value sign-extended.
+    Val atomic(std::string_view name) {
+        size_t u = name.rfind('_');
+        std::string_view o = name.substr(0, u), w = u == std::string_view::npos ? "" : name.substr(u + 1);
+        if (w != "32" && w != "64") fail("unknown call amo_" + std::string(name));
+        uint8_t bits = w == "32" ? 32 : 64;
+        CType t{bits, true};
+        Val addr = convert(expr(), PtrT);
+        if (o == "lr") { want(")"); return load(addr, bits, true); }
+        want(",");
+        Val v = convert(expr(), t);
+        want(")");
+        if (o == "sc") { store(addr, v, bits); return konst(0, IntT); }
+        Val old = load(addr, bits, true), next;
+        if (o == "swap") next = v;
+        else if (o == "add") next = convert(binary("+", old, v), t);
+        else if (o == "xor" || o == "and" || o == "or") next = convert(binary(o == "xor" ? "^" : o == "and" ? "&" : "|", old, v), t);
+        else if (o == "min" || o == "max" || o == "minu" || o == "maxu") {
+            CType ct{bits, o.size() == 3};
+            Val c = binary(o.compare(0, 3, "min") == 0 ? "<" : ">", convert(old, ct), convert(v, ct));
+            uint32_t d = temp(); op(SEL, d, c.slot, old.slot, v.slot);
+            next = {d, t, false, 0};
+        } else fail("unknown call amo_" + std::string(name));
+        store(addr, next, bits);
+        return old;
+    }
+    Val unaryExpr() {
+        CType t;
+        if (castAhead(t)) {
+            Val v = unaryExpr();
+            return convert(v, t);
+        }
+        if (eat("&")) {
+            std::string name(ident());
+            auto it = symbols.find(name);
+            if (it == symbols.end()) fail("unknown symbol " + name);
+            return konst((int64_t)it->second, PtrT);
+        }
+        if (eat("-")) { Val v = unaryExpr(); CType r = promote(v.t); return unary(NEG, convert(v, r), r); }
+        if (eat("~")) { Val v = unaryExpr(); CType r = promote(v.t); return unary(NOT, convert(v, r), r); }
+        if (eat("!")) { Val v = unaryExpr(); return unary(LNOT, v, IntT); }
+        if (eat("*")) {
+            Val p = unaryExpr();
+            if (!p.t.ptr || !p.t.pbits) fail("dereference of a non-pointer");
+            return load(p, p.t.pbits, p.t.psgn);
+        }
+        return primary();
+    }
+    static int precedence(std::string_view o) {
+        if (o=="|") return 1;
+        if (o=="^") return 2;
+        if (o=="&") return 3;
+        if (o=="==" || o=="!=") return 4;
+        if (o=="<" || o=="<=" || o==">" || o==">=") return 5;
+        if (o=="<<" || o==">>") return 6;
+        if (o=="+" || o=="-") return 7;
+        if (o=="*" || o=="/" || o=="%") return 8;
+        return 0;
+    }
+    std::string_view peekOp() {
+        skip();
+        static const std::string_view ops[] = {"<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+                                               "|", "^", "&", "<", ">", "+", "-", "*", "/", "%"};
+        for (auto o : ops) if (s.compare(i, o.size(), o) == 0) return o;
+        return {};
+    }
+    Val binaryExpr(int minPrec) {
+        Val lhs = unaryExpr();
+        for (;;) {
+            std::string_view o = peekOp();
+            int p = precedence(o);
+            if (!p || p < minPrec) return lhs;
+            i += o.size();
+            Val rhs = binaryExpr(p + 1);
+            lhs = binary(o, lhs, rhs);
+        }
+    }
+    Val expr() {
+        Val c = binaryExpr(1);
+        if (!eat("?")) return c;
+        Val a = expr();
+        want(":");
+        Val b = expr();
+        CType t = common(a.t, b.t);
+        a = convert(a, t); b = convert(b, t);
+        if (c.isConst) return c.k ? a : b;
+        uint32_t d = temp(); op(SEL, d, c.slot, a.slot, b.slot);
+        return {d, t, false, 0};
+    }
+
+    // Statements
+    void assign(uint32_t slot, Val v, CType t) {
+        v = convert(v, t);
+        UOp* last = m.code.empty() ? nullptr : &m.code.back();
+        if (!v.isConst && (v.slot & RefMask) == TempRef && last && last->d == v.slot && (size_t)(last - m.code.data()) + 1 == m.code.size()
+            && last->k < ST8)
+            last->d = slot;                   // retarget the temporary instead of copying it
+        else
+            op(MOV, slot, v.slot);
+    }
+    void statement() {
+        if (eat(";")) return;
+        if (eat("{")) { while (!eat("}")) { if (i >= s.size()) fail("unterminated block"); statement(); } return; }
+        if (at("if") && !atIdentCont(2)) {
+            i += 2;
+            want("(");
+            Val c = expr();
+            want(")");
+            if (at("goto") && !atIdentCont(4)) {
+                i += 4;
+                std::string label(ident());
+                want(";");
+                if (c.isConst) { if (c.k) jumpTo(label); return; }
+                op(BNZ, 0, c.slot);
+                gotos.push_back({(uint32_t)m.code.size() - 1, label});
+                return;
+            }
+            uint32_t skipAt = (uint32_t)m.code.size();
+            op(BZ, 0, c.isConst ? m.constant(c.k) : c.slot);
+            statement();
+            m.code[skipAt].c = (uint32_t)m.code.size();
+            return;
+        }
+        if (at("goto") && !atIdentCont(4)) {
+            i += 4;
+            std::string label(ident());
+            want(";");
+            jumpTo(label);
+            return;
+        }
+        if (eat("*")) {
+            Val p = unaryExpr();
+            if (!p.t.ptr || !p.t.pbits) fail("store through a non-pointer");
+            want("=");
+            Val v = expr();
+            want(";");
+            store(p, convert(v, {p.t.pbits, p.t.psgn}), p.t.pbits);
+            return;
+        }
+        std::string name(ident());
+        CType declType;
+        if (typeName(name, declType)) {
+            std::string local(ident());
+            locals[local] = declType;
+            want("=");
+            Val v = expr();
+            want(";");
+            assign(m.reg(local), v, declType);
+            return;
+        }
+        CType access;
+        if (memoryHelper(name, "store_", access) && eat("(")) {
+            Val addr = convert(expr(), PtrT);
+            want(",");
+            Val v = expr();
+            want(")"); want(";");
+            store(addr, convert(v, access), access.bits);
+            return;
+        }
+        if (eat("(")) {
+            want(")"); want(";");
+            if (name == "system_call") {
+                uint32_t regs[5] = {m.reg(m.abi.numReg), m.reg(m.abi.argReg[0]), m.reg(m.abi.argReg[1]),
+                                    m.reg(m.abi.argReg[2]), m.reg(m.abi.retReg)};
+                std::copy(regs, regs + 5, m.sys);
+                op(SYSCALL, regs[4], regs[0], regs[1]);
+            } else if (name != "debug_break" && name != "amo_fence") fail("unknown call " + name);
+            return;
+        }
+        want("=");
+        Val v = expr();
+        want(";");
+        if (name == "PC") { op(JIND, 0, convert(v, PtrT).slot); return; }
+        auto lt = locals.find(name);
+        assign(m.reg(name), v, lt == locals.end() ? regType : lt->second);
+    }
+    bool atIdentCont(size_t n) {
+        return i + n < s.size() && (std::isalnum((unsigned char)s[i+n]) || s[i+n]=='_');
+    }
+    void jumpTo(const std::string& label) {
+        op(JMP, 0, 0);
+        gotos.push_back({(uint32_t)m.code.size() - 1, label});
+    }
+
+    uint32_t compile() {
+        while (skip(), i < s.size()) statement();
+        return temps;
+    }
+};
+
+inline void decode(Machine& m, const Program& prog, const AsmDefinition* def, uint64_t memSize = DefaultMemSize) {
+    m.abi = syscallABI(def);
+    DataImage image = layoutData(prog);
+    std::string bad = checkMemSize(memSize, def->xlen, image);
+    if (!bad.empty()) throw std::runtime_error(bad);
+    m.memSize = memSize;
+    m.heapBase = m.brk = image.heapBase();
+    m.heapLimit = DataImage::heapLimit(memSize);
+    m.addrMask = def->xlen < 64 ? (1ull << def->xlen) - 1 : ~0ull;
+    m.mem = mapGuestMemory(memSize);
+    if (!m.mem) throw std::runtime_error("cannot allocate guest memory");
+    for (auto& piece : image.pieces)
+        if (!image.read(piece, m.mem + DataBase + piece.at)) throw std::runtime_error("cannot read " + piece.file);
+    Translator tr(prog, def, image);
+    tr.grow();
+    std::unordered_map<std::string, uint64_t> symbols;
+    std::unordered_map<std::string, uint32_t> labels;
+    for (auto& l : prog.labels) {
+        labels.emplace(std::string(tr.labelOperand(l.name)), l.at);
+        symbols.emplace(std::string(prog.name(l.name)), TextBase + 4ull * l.at);
+    }
+
+    std::vector<std::pair<uint32_t, std::string>> gotos;
+    std::string stmt;
+    CType regType = def->xlen < 64 ? IntT : PtrT;       // as registerType() declares them under -O
+    size_t n = prog.text.size();
+    m.insnStart.resize(n + 1);
+    for (size_t i = 0; i < n; ++i) {
+        m.insnStart[i] = (uint32_t)m.code.size();
+        stmt.clear();
+        if (!tr.translateLine(prog.text[i], stmt)) continue;
+        StmtCompiler c{m, stmt, 0, prog.text[i].line, 0, (int64_t)(TextBase + 4*i), symbols, gotos, {}, regType};
+        try {
+            m.maxTemps = std::max(m.maxTemps, c.compile());
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(std::string(e.what()) + " (line " + std::to_string(prog.text[i].line) + ")");
+        }
+    }
+    m.insnStart[n] = (uint32_t)m.code.size();
+    m.code.push_back({nullptr, 0, 0, 0, 0, HALT});
+    m.opLine.push_back(0);
+    for (auto& [at, label] : gotos) {
+        auto it = labels.find(label);
+        if (it == labels.end()) throw std::runtime_error("unknown label " + label);
+        m.code[at].c = m.insnStart[it->second];
+    }
+
+    uint32_t regs = (uint32_t)m.regNames.size(), consts = (uint32_t)m.consts.size();
+    m.values.assign(regs + consts + m.maxTemps, 0);
+    std::copy(m.consts.begin(), m.consts.end(), m.values.begin() + regs);
+    if (!def->stackReg.empty()) {
+        auto sp = m.regIndex.find(sanitizeIdent(def->stackReg));
+        if (sp != m.regIndex.end()) m.values[sp->second] = (int64_t)memSize;
+    }
+    if (def->harts()) {                 // the one hart there is: id 0 of 1
+        auto count = m.regIndex.find(sanitizeIdent(def->hartCountReg));
+        if (count != m.regIndex.end()) m.values[count->second] = 1;
+    }
+    auto resolve = [&](uint32_t& ref) {
+        uint32_t i = ref & ~RefMask;
+        switch (ref & RefMask) {
+            case ConstRef: ref = regs + i; break;
+            case TempRef:  ref = regs + consts + i; break;
+            default:       ref = i; break;
+        }
+    };
+    for (auto& u : m.code) {
+        resolve(u.d); resolve(u.a); resolve(u.b);
+        if (u.k == SEL) resolve(u.c);
+    }
+}
+
+inline int Machine::run() {
+    int64_t* V = values.data();
+    UOp* const base = code.data();
+    const uint64_t textEnd = insnStart.size() - 1;
+    UOp* ip = base;
+    auto jumpIndirect = [&](int64_t addr) -> UOp* {
+        uint64_t off = (uint64_t)addr - TextBase;
+        if ((off & 3) || (off >> 2) > textEnd) fault(ip, "jump to non-instruction address", (uint64_t)addr);
+        return base + insnStart[off >> 2];
+    };
+#define EZM_CHECK(n) uint64_t ad = (uint64_t)V[ip->a] & addrMask; \
+    if (ad > memSize - (n)) fault(ip, "memory access out of bounds at", ad);
+#if defined(__GNUC__)
+    static const void* const handlers[KindCount] = {
+        &&L_MOV, &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIVS, &&L_DIVU, &&L_REMS, &&L_REMU, &&L_SHL, &&L_SHRS, &&L_SHRU,
+        &&L_AND, &&L_OR, &&L_XOR, &&L_EQ, &&L_NE, &&L_LTS, &&L_LTU, &&L_LES, &&L_LEU, &&L_NOT, &&L_NEG, &&L_LNOT,
+        &&L_SEXT8, &&L_SEXT16, &&L_SEXT32, &&L_ZEXT8, &&L_ZEXT16, &&L_ZEXT32, &&L_SEL,
+        &&L_LD8S, &&L_LD8U, &&L_LD16S, &&L_LD16U, &&L_LD32S, &&L_LD32U, &&L_LD64, &&L_ST8, &&L_ST16, &&L_ST32, &&L_ST64,
+        &&L_JMP, &&L_BNZ, &&L_BZ, &&L_JIND, &&L_SYSCALL, &&L_NOP, &&L_HALT,
+    };
+    for (auto& u : code) u.h = handlers[u.k];
+#  define EZM_OP(k)   L_##k:
+#  define EZM_NEXT    do { ++ip; goto *ip->h; } while (0)
+#  define EZM_GO(p)   do { ip = (p); goto *ip->h; } while (0)
+    goto *ip->h;
+#else
+#  define EZM_OP(k)   case k:
+#  define EZM_NEXT    do { ++ip; goto dispatch; } while (0)
+#  define EZM_GO(p)   do { ip = (p); goto dispatch; } while (0)
+dispatch:
+    switch (ip->k) {
+#endif
+    EZM_OP(MOV)    V[ip->d] = V[ip->a]; EZM_NEXT;
+    EZM_OP(ADD)    V[ip->d] = (int64_t)((uint64_t)V[ip->a] + (uint64_t)V[ip->b]); EZM_NEXT;
+    EZM_OP(SUB)    V[ip->d] = (int64_t)((uint64_t)V[ip->a] - (uint64_t)V[ip->b]); EZM_NEXT;
+    EZM_OP(MUL)    V[ip->d] = (int64_t)((uint64_t)V[ip->a] * (uint64_t)V[ip->b]); EZM_NEXT;
+    EZM_OP(DIVS)   if (!V[ip->b]) fault(ip, "division by zero", 0); V[ip->d] = fold(DIVS, V[ip->a], V[ip->b]); EZM_NEXT;
+    EZM_OP(DIVU)   if (!V[ip->b]) fault(ip, "division by zero", 0); V[ip->d] = fold(DIVU, V[ip->a], V[ip->b]); EZM_NEXT;
+    EZM_OP(REMS)   if (!V[ip->b]) fault(ip, "division by zero", 0); V[ip->d] = fold(REMS, V[ip->a], V[ip->b]); EZM_NEXT;
+    EZM_OP(REMU)   if (!V[ip->b]) fault(ip, "division by zero", 0); V[ip->d] = fold(REMU, V[ip->a], V[ip->b]); EZM_NEXT;
+    EZM_OP(SHL)    V[ip->d] = (int64_t)((uint64_t)V[ip->a] << (V[ip->b] & 63)); EZM_NEXT;
+    EZM_OP(SHRS)   V[ip->d] = V[ip->a] >> (V[ip->b] & 63); EZM_NEXT;
+    EZM_OP(SHRU)   V[ip->d] = (int64_t)((uint64_t)V[ip->a] >> (V[ip->b] & 63)); EZM_NEXT;
+    EZM_OP(AND)    V[ip->d] = V[ip->a] & V[ip->b]; EZM_NEXT;
+    EZM_OP(OR)     V[ip->d] = V[ip->a] | V[ip->b]; EZM_NEXT;
+    EZM_OP(XOR)    V[ip->d] = V[ip->a] ^ V[ip->b]; EZM_NEXT;
+    EZM_OP(EQ)     V[ip->d] = V[ip->a] == V[ip->b]; EZM_NEXT;
+    EZM_OP(NE)     V[ip->d] = V[ip->a] != V[ip->b]; EZM_NEXT;
+    EZM_OP(LTS)    V[ip->d] = V[ip->a] < V[ip->b]; EZM_NEXT;
+    EZM_OP(LTU)    V[ip->d] = (uint64_t)V[ip->a] < (uint64_t)V[ip->b]; EZM_NEXT;
+    EZM_OP(LES)    V[ip->d] = V[ip->a] <= V[ip->b]; EZM_NEXT;
+    EZM_OP(LEU)    V[ip->d] = (uint64_t)V[ip->a] <= (uint64_t)V[ip->b]; EZM_NEXT;
+    EZM_OP(NOT)    V[ip->d] = ~V[ip->a]; EZM_NEXT;
+    EZM_OP(NEG)    V[ip->d] = (int64_t)(0 - (uint64_t)V[ip->a]); EZM_NEXT;
+    EZM_OP(LNOT)   V[ip->d] = !V[ip->a]; EZM_NEXT;
+    EZM_OP(SEXT8)  V[ip->d] = (int8_t)V[ip->a]; EZM_NEXT;
+    EZM_OP(SEXT16) V[ip->d] = (int16_t)V[ip->a]; EZM_NEXT;
+    EZM_OP(SEXT32) V[ip->d] = (int32_t)V[ip->a]; EZM_NEXT;
+    EZM_OP(ZEXT8)  V[ip->d] = (uint8_t)V[ip->a]; EZM_NEXT;
+    EZM_OP(ZEXT16) V[ip->d] = (uint16_t)V[ip->a]; EZM_NEXT;
+    EZM_OP(ZEXT32) V[ip->d] = (uint32_t)V[ip->a]; EZM_NEXT;
+    EZM_OP(SEL)    V[ip->d] = V[ip->a] ? V[ip->b] : V[ip->c]; EZM_NEXT;
+    EZM_OP(LD8S)   { EZM_CHECK(1) int8_t v;   std::memcpy(&v, mem + ad, 1); V[ip->d] = v; } EZM_NEXT;
+    EZM_OP(LD8U)   { EZM_CHECK(1) uint8_t v;  std::memcpy(&v, mem + ad, 1); V[ip->d] = v; } EZM_NEXT;
+    EZM_OP(LD16S)  { EZM_CHECK(2) int16_t v;  std::memcpy(&v, mem + ad, 2); V[ip->d] = v; } EZM_NEXT;
+    EZM_OP(LD16U)  { EZM_CHECK(2) uint16_t v; std::memcpy(&v, mem + ad, 2); V[ip->d] = v; } EZM_NEXT;
+    EZM_OP(LD32S)  { EZM_CHECK(4) int32_t v;  std::memcpy(&v, mem + ad, 4); V[ip->d] = v; } EZM_NEXT;
+    EZM_OP(LD32U)  { EZM_CHECK(4) uint32_t v; std::memcpy(&v, mem + ad, 4); V[ip->d] = v; } EZM_NEXT;
+    EZM_OP(LD64)   { EZM_CHECK(8) int64_t v;  std::memcpy(&v, mem + ad, 8); V[ip->d] = v; } EZM_NEXT;
+    EZM_OP(ST8)    { EZM_CHECK(1) std::memcpy(mem + ad, &V[ip->b], 1); } EZM_NEXT;
+    EZM_OP(ST16)   { EZM_CHECK(2) std::memcpy(mem + ad, &V[ip->b], 2); } EZM_NEXT;
+    EZM_OP(ST32)   { EZM_CHECK(4) std::memcpy(mem + ad, &V[ip->b], 4); } EZM_NEXT;
+    EZM_OP(ST64)   { EZM_CHECK(8) std::memcpy(mem + ad, &V[ip->b], 8); } EZM_NEXT;
+    EZM_OP(JMP)    EZM_GO(base + ip->c);
+    EZM_OP(BNZ)    if (V[ip->a]) EZM_GO(base + ip->c); EZM_NEXT;
+    EZM_OP(BZ)     if (!V[ip->a]) EZM_GO(base + ip->c); EZM_NEXT;
+    EZM_OP(JIND)   EZM_GO(jumpIndirect(V[ip->a]));
+    EZM_OP(SYSCALL) { int status; if (!syscall(ip, status)) return status; } EZM_NEXT;
+    EZM_OP(NOP)    EZM_NEXT;
+    EZM_OP(HALT)   std::fflush(stdout); return 0;
+#if !defined(__GNUC__)
+    default: return 0;
+    }
+#endif
+#undef EZM_CHECK
+#undef EZM_OP
+#undef EZM_NEXT
+#undef EZM_GO
+}
+
+// The services of the emitted runtime (Runtime.h), one for one.
+inline int Machine::inByte() {
+    if (inAt == inEnd) {
+        std::fflush(stdout);
+        in.resize(1 << 16);
+#ifdef _WIN32
+        long n = _read(0, in.data(), (unsigned)in.size());
+#else
+        long n = (long)::read(0, in.data(), in.size());
+#endif
+        if (n <= 0) return -1;
+        inAt = 0;
+        inEnd = (size_t)n;
+    }
+    return in[inAt++];
+}
+
+inline int64_t Machine::readInt() {
+    uint64_t v = 0;
+    int c, neg = 0;
+    do c = inByte(); while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    if (c == '-' || c == '+') { neg = c == '-'; c = inByte(); }
+    for (; c >= '0' && c <= '9'; c = inByte()) v = v * 10 + (uint64_t)(c - '0');
+    while (c != '\n' && c != -1) c = inByte();
+    return neg ? (int64_t)(0 - v) : (int64_t)v;
+}
+
+// False when the program exits, with its status.
+inline bool Machine::syscall(const UOp* ip, int& status) {
+    int64_t* V = values.data();
+    const bool narrow = addrMask != ~0ull;
+    auto guestInt = [&](int64_t v) { return narrow ? (int64_t)(int32_t)v : v; };
+    int64_t num = V[ip->a], a0 = V[sys[1]], a1 = V[sys[2]], a2 = V[sys[3]];
+    int64_t& ret = V[ip->d];
+    switch (abi.service(num)) {
+        case (int)SysService::PrintInt: {
+            int64_t v = guestInt(a0);
+            char t[24], *p = t + sizeof t;
+            uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+            do *--p = (char)('0' + u % 10); while (u /= 10);
+            if (v < 0) *--p = '-';
+            std::fwrite(p, 1, (size_t)(t + sizeof t - p), stdout);
+            break;
+        }
+        case (int)SysService::PrintString: {
+            uint64_t at = (uint64_t)a0 & addrMask;
+            if (at >= memSize) fault(ip, "memory access out of bounds at", at);
+            const void* nul = std::memchr(mem + at, 0, memSize - at);
+            std::fwrite(mem + at, 1, nul ? (const uint8_t*)nul - (mem + at) : memSize - at, stdout);
+            break;
+        }
+        case (int)SysService::PrintChar: std::putc((int)(uint8_t)a0, stdout); break;
+        case (int)SysService::ReadInt: ret = guestInt(readInt()); break;
+        case (int)SysService::ReadString: {
+            int64_t n = guestInt(a1), k = 0;
+            if (n < 1) break;
+            uint8_t* p = span(ip, a0, (uint64_t)n);
+            for (int c; k < n - 1 && (c = inByte()) != -1;) {
+                p[k++] = (uint8_t)c;
+                if (c == '\n') break;
+            }
+            p[k] = 0;
+            break;
+        }
+        case (int)SysService::ReadChar: ret = inByte(); break;
+        case (int)SysService::Read: {
+            uint64_t len = (uint64_t)a2 & addrMask;
+            uint8_t* p = span(ip, a1, len);
+            if (guestInt(a0) == 0 && inAt < inEnd) {
+                size_t k = (size_t)std::min<uint64_t>(inEnd - inAt, len);
+                std::memcpy(p, in.data() + inAt, k);
+                inAt += k;
+                ret = guestInt((int64_t)k);
+                break;
+            }
+            std::fflush(stdout);
+#ifdef _WIN32
+            long got = _read((int)guestInt(a0), p, (unsigned)len);
+#else
+            long got = (long)::read((int)guestInt(a0), p, (size_t)len);
+#endif
+            ret = guestInt(got < 0 ? -1 : got);
+            break;
+        }
+        case (int)SysService::Write: {
+            uint64_t len = (uint64_t)a2 & addrMask;
+            uint8_t* p = span(ip, a1, len);
+            if (guestInt(a0) == 1) {
+                std::fwrite(p, 1, (size_t)len, stdout);
+                ret = guestInt((int64_t)len);
+                break;
+            }
+            std::fflush(stdout);
+#ifdef _WIN32
+            long put = _write((int)guestInt(a0), p, (unsigned)len);
+#else
+            long put = (long)::write((int)guestInt(a0), p, (size_t)len);
+#endif
+            ret = guestInt(put < 0 ? -1 : put);
+            break;
+        }
+        case (int)SysService::Sbrk: {
+            uint64_t old = brk, to = old + (uint64_t)guestInt(a0);
+            if (to < heapBase || to > heapLimit) { ret = -1; break; }
+            brk = to;
+            ret = guestInt((int64_t)old);
+            break;
+        }
+        case (int)SysService::Brk: {
+            uint64_t to = (uint64_t)a0 & addrMask;
+            if (to >= heapBase && to <= heapLimit) brk = to;
+            ret = guestInt((int64_t)brk);
+            break;
+        }
+        case (int)SysService::Mmap: {
+            uint64_t len = (uint64_t)a1 & addrMask, at = (brk + MemPage - 1) & ~(MemPage - 1);
+            if (!len || len > heapLimit) { ret = -1; break; }
+            len = (len + MemPage - 1) & ~(MemPage - 1);
+            if (at + len > heapLimit) { ret = -1; break; }
+            std::memset(mem + at, 0, (size_t)len);
+            brk = at + len;
+            ret = guestInt((int64_t)at);
+            break;
+        }
+        case (int)SysService::Exit:
+            std::fflush(stdout);
+            status = 0;
+            return false;
+        case (int)SysService::ExitWith:
+            std::fflush(stdout);
+            status = (int)a0;
+            return false;
+        default:
+            std::printf("[unknown syscall %d]\n", (int)num);
+            break;
+    }
+    return true;
+}
+
+}
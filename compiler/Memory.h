@@ -0,0 +1,236 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Program.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// Guest memory is the same in the emitted C and in -interp: one flat space of
+// memSize bytes starting at guest address 0, the data section copied in at
+// DataBase, and the stack register starting at the top. Instruction i has the
+// address TextBase + 4*i, which is what PC and return addresses hold; code is
+// not stored in guest memory. 32-bit guests only ever see the low 32 bits of
+// an address.
+
+constexpr uint64_t DataBase = 0x10000;
+constexpr uint64_t TextBase = 0x400000;
+constexpr uint64_t DefaultMemSize = 256ull << 20;
+constexpr uint64_t MemPage = 4096;
+
+// Decodes a C string literal body (without quotes) into bytes.
+inline std::string decodeCString(std::string_view v) {
+    std::string out;
+    for (size_t i=0; i<v.size(); ++i) {
+        char c = v[i];
+        if (c == '"') continue;                   // adjacent literals
+        if (c != '\\' || i+1 >= v.size()) { out += c; continue; }
+        char e = v[++i];
+        switch (e) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'a': out += '\a'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'v': out += '\v'; break;
+            case 'x': {
+                int n = 0, k = 0;
+                while (i+1<v.size() && k<2 && std::isxdigit((unsigned char)v[i+1])) {
+                    char h = v[++i]; ++k;
+                    n = n*16 + (std::isdigit((unsigned char)h) ? h-'0' : (std::tolower((unsigned char)h)-'a'+10));
+                }
+                out += (char)n;
+                break;
+            }
+            default:
+                if (e >= '0' && e <= '7') {
+                    int n = e - '0', k = 1;
+                    while (i+1<v.size() && k<3 && v[i+1]>='0' && v[i+1]<='7') { n = n*8 + (v[++i]-'0'); ++k; }
+                    out += (char)n;
+                } else out += e;
+        }
+    }
+    return out;
+}
+
+// One run of initialized data: size bytes at DataBase + at, taken from the
+// image's bytes at from or, for .incbin, from file at from.
+struct DataPiece {
+    uint64_t at = 0, size = 0, from = 0;
+    std::string file;
+};
+
+// Guest memory from DataBase on: the initialized pieces, and the zero-filled
+// reservations (.space, .zero) around them, which cost nothing here, in the
+// emitted C or in an executable. Also where each data symbol landed.
+struct DataImage {
+    static constexpr uint64_t DenseZeros = 64;  // shorter zero runs are stored like any data
+
+    std::vector<uint8_t> bytes;             // the pieces without a file, back to back
+    std::vector<DataPiece> pieces;
+    uint64_t size = 0;                      // reservations included
+    std::vector<uint64_t> address;          // by Sym; 0 for anything that is not a data label
+
+    uint64_t end() const { return DataBase + size; }
+    // The heap sbrk/brk/mmap hand out: from the first page after the data up
+    // to the top eighth of memory, which is left to the stack.
+    uint64_t heapBase() const { return (end() + MemPage - 1) & ~(MemPage - 1); }
+    static uint64_t heapLimit(uint64_t memSize) { return memSize - memSize / 8; }
+
+    void append(const void* p, size_t n) {
+        if (!n) return;
+        if (pieces.empty() || !pieces.back().file.empty() || pieces.back().at + pieces.back().size != size)
+            pieces.push_back({size, 0, bytes.size(), {}});
+        bytes.insert(bytes.end(), (const uint8_t*)p, (const uint8_t*)p + n);
+        pieces.back().size += n;
+        size += n;
+    }
+    void zeros(uint64_t n) {
+        if (n >= DenseZeros) { size += n; return; }
+        static const uint8_t none[DenseZeros] = {};
+        append(none, (size_t)n);
+    }
+    void align(uint64_t a) { zeros((a - size % a) % a); }
+
+    // Copies a piece to dst; false when its file cannot be read.
+    bool read(const DataPiece& piece, uint8_t* dst) const {
+        if (piece.file.empty()) {
+            std::memcpy(dst, bytes.data() + piece.from, piece.size);
+            return true;
+        }
+        std::ifstream in(piece.file, std::ios::binary);
+        in.seekg((std::streamoff)piece.from);
+        return in && in.read((char*)dst, (std::streamsize)piece.size);
+    }
+};
+
+// Data directives, each continuing where the one before ended:
+//   .byte/.half/.word/.dword a, b, ...   1/2/4/8-byte integers
+//   .asciiz "..."                         a NUL-terminated string
+//   .space/.zero n[, fill]                n bytes of fill, 0 by default
+//   .align n, .balign n                   pad to 2^n, or to n, bytes
+//   .incbin "file"[, skip[, count]]       a file's bytes, relative to prog.dir
+// A labelled directive starts at the next multiple of 8, an unlabelled one
+// at a multiple of its element size. Throws std::runtime_error on an
+// unreadable .incbin or a bad alignment.
+inline DataImage layoutData(const Program& prog) {
+    DataImage img;
+    img.address.assign(prog.syms.size(), 0);
+    auto fail = [](const DataDecl& d, const std::string& what) {
+        throw std::runtime_error("line " + std::to_string(d.line) + ": " + what);
+    };
+    // Comma-separated numbers, or with quoted set a string and then the numbers.
+    auto items = [](std::string_view list, bool quoted, std::vector<std::string>& out) {
+        out.clear();
+        size_t p = 0;
+        if (quoted) {
+            size_t q1 = list.find('"'), q2 = list.find('"', q1 == std::string_view::npos ? 0 : q1 + 1);
+            if (q1 == std::string_view::npos || q2 == std::string_view::npos) return;
+            out.emplace_back(list.substr(q1 + 1, q2 - q1 - 1));
+            p = list.find(',', q2);
+            if (p == std::string_view::npos) return;
+            ++p;
+        }
+        while (p != std::string_view::npos && p <= list.size()) {
+            size_t e = list.find(',', p);
+            std::string_view item = trimView(list.substr(p, e == std::string_view::npos ? std::string_view::npos : e - p));
+            if (!item.empty()) out.emplace_back(item);
+            p = e == std::string_view::npos ? e : e + 1;
+        }
+    };
+    auto number = [](const std::string& s) { return (uint64_t)std::strtoll(s.c_str(), nullptr, 0); };
+    std::vector<std::string> args;
+    for (auto& d : prog.data) {
+        std::string_view dir = d.directive;
+        unsigned width = dir == ".byte" ? 1 : dir == ".half" ? 2 : dir == ".word" ? 4 : dir == ".dword" ? 8 : 0;
+        if (dir == ".align" || dir == ".balign") {
+            items(d.value, false, args);
+            uint64_t a = args.empty() ? 0 : number(args[0]);
+            if (dir == ".align") a = a < 32 ? 1ull << a : 0;
+            if (!a || (a & (a - 1)) || a > (1ull << 31)) fail(d, "bad alignment " + std::string(d.value));
+            img.align(a);
+            if (d.name) img.address[d.name] = DataBase + img.size;
+            continue;
+        }
+        img.align(d.name ? 8 : width ? width : 1);
+        uint64_t at = DataBase + img.size;
+        if (width) {
+            items(d.value, false, args);
+            for (auto& item : args) {
+                uint64_t v = number(item);
+                uint8_t le[8];
+                for (unsigned k = 0; k < width; ++k) le[k] = (uint8_t)(v >> 8*k);
+                img.append(le, width);
+            }
+        } else if (dir == ".asciiz") {
+            std::string_view v = d.value;
+            size_t q1 = v.find('"'), q2 = v.find_last_of('"');
+            std::string bytes = (q1 != std::string_view::npos && q2 > q1) ? decodeCString(v.substr(q1+1, q2-q1-1)) : std::string(v);
+            bytes.push_back('\0');
+            img.append(bytes.data(), bytes.size());
+        } else if (dir == ".space" || dir == ".zero") {
+            items(d.value, false, args);
+            uint64_t n = args.empty() ? 0 : number(args[0]);
+            uint8_t fill = args.size() > 1 ? (uint8_t)number(args[1]) : 0;
+            if (!fill) img.zeros(n);
+            else for (std::string run(4096, (char)fill); n; n -= std::min<uint64_t>(n, run.size())) img.append(run.data(), (size_t)std::min<uint64_t>(n, run.size()));
+        } else if (dir == ".incbin") {
+            items(d.value, true, args);
+            if (args.empty()) fail(d, ".incbin needs a quoted file name");
+            DataPiece piece;
+            piece.file = args[0];
+            if (!prog.dir.empty() && !piece.file.empty() && piece.file[0] != '/') piece.file = prog.dir + "/" + piece.file;
+            std::ifstream in(piece.file, std::ios::binary | std::ios::ate);
+            if (!in) fail(d, "cannot read " + piece.file);
+            uint64_t total = (uint64_t)in.tellg();
+            piece.from = args.size() > 1 ? number(args[1]) : 0;
+            piece.size = args.size() > 2 ? number(args[2]) : total - std::min(piece.from, total);
+            if (piece.from + piece.size > total) fail(d, piece.file + " is shorter than " + std::to_string(piece.from + piece.size) + " bytes");
+            piece.at = img.size;
+            img.size += piece.size;
+            if (piece.size) img.pieces.push_back(std::move(piece));
+        } else if (!dir.empty()) {
+            continue;                       // unknown directive: no data, no address
+        }
+        if (d.name) img.address[d.name] = at;
+    }
+    return img;
+}
+
+// Rounds a requested size to whole pages and checks it against the guest's
+// address width and the data section; empty on success.
+inline std::string checkMemSize(uint64_t& size, unsigned xlen, const DataImage& img) {
+    size = (size + MemPage - 1) & ~(MemPage - 1);
+    if (xlen < 64 && size > (1ull << xlen)) return "guest memory larger than the " + std::to_string(xlen) + "-bit address space";
+    if (img.end() > size) return "data section does not fit in guest memory";
+    return {};
+}
+
+// Zero-filled on demand; pages nobody touches never get backed.
+inline uint8_t* mapGuestMemory(uint64_t size) {
+#ifdef _WIN32
+    return (uint8_t*)std::calloc(size, 1);
+#else
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? nullptr : (uint8_t*)p;
+#endif
+}
+
+inline void unmapGuestMemory(uint8_t* mem, uint64_t size) {
+    if (!mem) return;
+#ifdef _WIN32
+    (void)size;
+    std::free(mem);
+#else
+    munmap(mem, size);
+#endif
+}
@@ -0,0 +1,790 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Interp.h"
+#include "Memory.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// -native writes a static x86-64 Linux ELF executable straight from the
+// interpreter's micro-ops (Interp.h), so no C compiler runs at all. Every
+// micro-op becomes a short fixed sequence over the value array, which lives in
+// the writable segment and is addressed off rbx; constants are folded into
+// immediates and guest memory is an anonymous mapping addressed off rbp.
+// Memory accesses, prints and indirect jumps are checked like the emitted C
+// checks them and fault with the same messages. The runtime is a few hand
+// assembled routines: the system_call services of the emitted runtime
+// (Runtime.h) over the same output and input buffering and heap, which live
+// in a zeroed area after the value array, and hex and decimal formatting. The
+// generated C stays the reference; -native and the default build of the same
+// program should agree on output and exit status.
+
+namespace native {
+
+constexpr uint64_t LoadBase = 0x10000000;   // clear of the guest addresses the program computes
+constexpr size_t HeaderBytes = 64 + 3 * 56, CodeOffset = 240;
+
+enum Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+enum Cond : uint8_t {
+    Below = 2, AboveEq = 3, Equal = 4, NotEqual = 5, BelowEq = 6, Above = 7, Sign = 8, NotSign = 9,
+    LessEq = 0xE, Greater = 0xF,
+};
+
+struct Assembler {
+    std::vector<uint8_t> b;
+
+    size_t here() const { return b.size(); }
+    void bytes(std::initializer_list<uint8_t> v) { b.insert(b.end(), v); }
+    void u32(uint32_t v) { for (int k = 0; k < 4; ++k) b.push_back((uint8_t)(v >> 8*k)); }
+    void u64(uint64_t v) { for (int k = 0; k < 8; ++k) b.push_back((uint8_t)(v >> 8*k)); }
+    void patch32(size_t at, uint32_t v) { for (int k = 0; k < 4; ++k) b[at + k] = (uint8_t)(v >> 8*k); }
+    void text(std::string_view s) { b.insert(b.end(), s.begin(), s.end()); }
+    void align(size_t n) { while (b.size() % n) b.push_back(0); }
+
+    // mov r, imm in the shortest form that keeps all 64 bits.
+    void movImm(Reg r, uint64_t v) {
+        if (v <= 0xFFFFFFFFull) { b.push_back(0xB8 + r); u32((uint32_t)v); }
+        else if ((int64_t)v >= INT32_MIN && (int64_t)v < 0) { bytes({0x48, 0xC7, (uint8_t)(0xC0 + r)}); u32((uint32_t)v); }
+        else { bytes({0x48, (uint8_t)(0xB8 + r)}); u64(v); }
+    }
+    // mov r, [rbx + disp] / mov [rbx + disp], r
+    void load(Reg r, uint32_t disp) { bytes({0x48, 0x8B, (uint8_t)(0x83 | r << 3)}); u32(disp); }
+    void store(uint32_t disp, Reg r) { bytes({0x48, 0x89, (uint8_t)(0x83 | r << 3)}); u32(disp); }
+    // lea r, [rbx + disp] / cmp r, [rbx + disp]
+    void lea(Reg r, uint32_t disp) { bytes({0x48, 0x8D, (uint8_t)(0x83 | r << 3)}); u32(disp); }
+    void cmpMem(Reg r, uint32_t disp) { bytes({0x48, 0x3B, (uint8_t)(0x83 | r << 3)}); u32(disp); }
+    void push(Reg r) { b.push_back((uint8_t)(0x50 + r)); }
+    void pop(Reg r) { b.push_back((uint8_t)(0x58 + r)); }
+    void ret() { b.push_back(0xC3); }
+    // op dst, src for the 0x01-style register forms (add, or, and, sub, xor, cmp)
+    void alu(uint8_t opcode, Reg dst, Reg src) { bytes({0x48, opcode, (uint8_t)(0xC0 | src << 3 | dst)}); }
+    void syscall() { bytes({0x0F, 0x05}); }
+    // Jumps return the position of their rel32 for bind() or link().
+    size_t jmp() { b.push_back(0xE9); u32(0); return here() - 4; }
+    size_t jcc(Cond c) { bytes({0x0F, (uint8_t)(0x80 | c)}); u32(0); return here() - 4; }
+    size_t call() { b.push_back(0xE8); u32(0); return here() - 4; }
+    void link(size_t rel, size_t target) { patch32(rel, (uint32_t)(int32_t)((int64_t)target - (int64_t)(rel + 4))); }
+    void bind(size_t rel) { link(rel, here()); }
+};
+
+// Compiled program as an executable image.
+class Backend {
+public:
+    Backend(const interp::Machine& machine, const DataImage& img, unsigned xlen)
+        : m(machine), image(img), narrow(xlen < 64), regs((uint32_t)m.regNames.size()), consts((uint32_t)m.consts.size()) {}
+
+    std::string elf() {
+        strings();
+        routines();
+        prologue();
+        program();
+        return link();
+    }
+
+private:
+    const interp::Machine& m;
+    const DataImage& image;
+    bool narrow;                        // 32-bit guest: addresses are the low 32 bits
+    uint32_t regs, consts;
+    Assembler a;
+    size_t memFault = 0, jumpFault = 0, divFault = 0, sysCall = 0, quit = 0, entry = 0;
+    size_t flushOut = 0, writeAll = 0, putBytes = 0, printDec = 0, getByte = 0, checkSpan = 0;
+    size_t sMem = 0, sJump = 0, sDiv = 0, sAlloc = 0, sUnknown = 0, sClose = 0, sDigits = 0;
+    std::vector<size_t> tableRefs, valuesRefs;                 // abs32 operands patched in link()
+    std::vector<std::pair<size_t, uint64_t>> imageRefs;         // abs32 -> offset into the data pieces
+    std::vector<std::pair<size_t, uint32_t>> jumps;             // rel32 -> micro-op
+    std::vector<size_t> at;                                     // micro-op -> code offset
+
+    static constexpr std::string_view MemMsg = "memory access out of bounds at 0x";
+    static constexpr std::string_view JumpMsg = "jump to non-instruction address 0x";
+    static constexpr std::string_view DivMsg = "division by zero\n";
+    static constexpr std::string_view AllocMsg = "cannot allocate guest memory\n";
+    static constexpr std::string_view UnknownMsg = "[unknown syscall ";
+
+    // Runtime state after the value array, addressed off rbx like the values.
+    static constexpr uint32_t OutCap = 1 << 16, InCap = 1 << 16;
+    enum : uint32_t { OutLen = 0, InAt = 8, InEnd = 16, Brk = 24, OutBuf = 32, InBuf = OutBuf + OutCap, StateBytes = InBuf + InCap };
+    uint32_t state(uint32_t off) const { return (uint32_t)(8 * m.values.size()) + off; }
+
+    uint32_t addr(size_t off) const { return (uint32_t)(LoadBase + CodeOffset + off); }
+    bool isConst(uint32_t slot) const { return slot >= regs && slot < regs + consts; }
+    void get(Reg r, uint32_t slot) {
+        if (isConst(slot)) a.movImm(r, (uint64_t)m.values[slot]);
+        else a.load(r, slot * 8);
+    }
+    void put(uint32_t slot) { a.store(slot * 8, RAX); }
+
+    void strings() {
+        sMem = a.here();     a.text(MemMsg);
+        sJump = a.here();    a.text(JumpMsg);
+        sDiv = a.here();     a.text(DivMsg);
+        sAlloc = a.here();   a.text(AllocMsg);
+        sUnknown = a.here(); a.text(UnknownMsg);
+        sClose = a.here();   a.text("]\n");
+        sDigits = a.here();  a.text("0123456789abcdef");
+        a.align(16);
+    }
+
+    // write(fd, rsi, rdx)
+    void write(int fd) {
+        a.b.push_back(0xBF); a.u32((uint32_t)fd);       // mov edi, fd
+        a.movImm(RAX, 1);
+        a.syscall();
+    }
+    void exitWith(int status) {
+        a.b.push_back(0xBF); a.u32((uint32_t)status);
+        a.movImm(RAX, 231);                             // exit_group
+        a.syscall();
+    }
+    void message(size_t str, size_t len) {
+        a.b.push_back(0xBE); a.u32(addr(str));          // mov esi, str
+        a.b.push_back(0xBA); a.u32((uint32_t)len);      // mov edx, len
+    }
+
+    // A syscall register as the emitted C reads it with GUEST_INT / GUEST_ADDR.
+    void guestInt(Reg r, uint32_t slot) {
+        a.load(r, slot * 8);
+        if (narrow) a.bytes({0x48, 0x63, (uint8_t)(0xC0 | r << 3 | r)});     // movsxd r, r32
+    }
+    void guestAddr(Reg r, uint32_t slot) {
+        a.load(r, slot * 8);
+        if (narrow) a.bytes({0x89, (uint8_t)(0xC0 | r << 3 | r)});           // mov r32, r32
+    }
+
+    void routines() {
+        // write(edi, rsi, rdx) until it is all out or fails.
+        writeAll = a.here();
+        size_t more = a.here();
+        a.bytes({0x48, 0x85, 0xD2});                    // test rdx, rdx
+        size_t written = a.jcc(Equal);
+        a.movImm(RAX, 1);
+        a.syscall();
+        a.bytes({0x48, 0x85, 0xC0});                    // test rax, rax
+        size_t failed = a.jcc(LessEq);
+        a.alu(0x01, RSI, RAX);                          // add rsi, rax
+        a.alu(0x29, RDX, RAX);                          // sub rdx, rax
+        a.link(a.jmp(), more);
+        a.bind(written); a.bind(failed);
+        a.ret();
+
+        // Empties the output buffer. Clobbers rax, rcx, rdx, rsi, rdi, r11.
+        flushOut = a.here();
+        a.load(RDX, state(OutLen));
+        a.lea(RSI, state(OutBuf));
+        a.b.push_back(0xBF); a.u32(1);                  // mov edi, 1
+        a.link(a.call(), writeAll);
+        a.bytes({0x31, 0xC0});                          // xor eax, eax
+        a.store(state(OutLen), RAX);
+        a.ret();
+
+        // rsi/rdx: bytes for stdout, through the buffer unless they would fill it.
+        putBytes = a.here();
+        a.load(RAX, state(OutLen));
+        a.movImm(RCX, OutCap);
+        a.alu(0x29, RCX, RAX);                          // sub rcx, rax: room left
+        a.alu(0x39, RDX, RCX);                          // cmp rdx, rcx
+        size_t fits = a.jcc(BelowEq);
+        a.push(RSI); a.push(RDX);
+        a.link(a.call(), flushOut);
+        a.pop(RDX); a.pop(RSI);
+        a.bytes({0x31, 0xC0});                          // xor eax, eax
+        a.bytes({0x48, 0x81, 0xFA}); a.u32(OutCap);     // cmp rdx, OutCap
+        size_t small = a.jcc(Below);
+        a.b.push_back(0xBF); a.u32(1);                  // mov edi, 1
+        a.link(a.jmp(), writeAll);
+        a.bind(fits); a.bind(small);
+        a.lea(RDI, state(OutBuf));
+        a.alu(0x01, RDI, RAX);                          // add rdi, rax
+        a.alu(0x01, RAX, RDX);                          // add rax, rdx
+        a.store(state(OutLen), RAX);
+        a.alu(0x89, RCX, RDX);                          // mov rcx, rdx
+        a.bytes({0xF3, 0xA4});                          // rep movsb
+        a.ret();
+
+        // rax: signed value for stdout in decimal.
+        printDec = a.here();
+        a.bytes({0x48, 0x83, 0xEC, 0x28});              // sub rsp, 40
+        a.bytes({0x48, 0x8D, 0x74, 0x24, 0x28});        // lea rsi, [rsp+40]
+        a.bytes({0x49, 0x89, 0xC0});                    // mov r8, rax
+        a.bytes({0x48, 0x85, 0xC0});                    // test rax, rax
+        size_t positive = a.jcc(NotSign);
+        a.bytes({0x48, 0xF7, 0xD8});                    // neg rax
+        a.bind(positive);
+        a.movImm(RCX, 10);
+        size_t digit = a.here();
+        a.bytes({0x31, 0xD2, 0x48, 0xF7, 0xF1});        // xor edx, edx; div rcx
+        a.bytes({0x80, 0xC2, 0x30});                    // add dl, '0'
+        a.bytes({0x48, 0xFF, 0xCE, 0x88, 0x16});        // dec rsi; mov [rsi], dl
+        a.bytes({0x48, 0x85, 0xC0});                    // test rax, rax
+        a.link(a.jcc(NotEqual), digit);
+        a.bytes({0x4D, 0x85, 0xC0});                    // test r8, r8
+        size_t unsignedNum = a.jcc(NotSign);
+        a.bytes({0x48, 0xFF, 0xCE, 0xC6, 0x06, 0x2D});  // dec rsi; mov byte [rsi], '-'
+        a.bind(unsignedNum);
+        a.bytes({0x48, 0x8D, 0x54, 0x24, 0x28});        // lea rdx, [rsp+40]
+        a.alu(0x29, RDX, RSI);                          // sub rdx, rsi
+        a.link(a.call(), putBytes);
+        a.bytes({0x48, 0x83, 0xC4, 0x28});              // add rsp, 40
+        a.ret();
+
+        // rax = next byte of stdin, or -1 at its end. Keeps r8-r10.
+        getByte = a.here();
+        a.load(RAX, state(InAt));
+        a.cmpMem(RAX, state(InEnd));
+        size_t have = a.jcc(Below);
+        a.link(a.call(), flushOut);
+        a.bytes({0x31, 0xFF});                          // xor edi, edi
+        a.lea(RSI, state(InBuf));
+        a.movImm(RDX, InCap);
+        a.bytes({0x31, 0xC0});                          // xor eax, eax: read
+        a.syscall();
+        a.bytes({0x48, 0x85, 0xC0});                    // test rax, rax
+        size_t filled = a.jcc(Greater);
+        a.movImm(RAX, ~0ull);
+        a.ret();
+        a.bind(filled);
+        a.store(state(InEnd), RAX);
+        a.bytes({0x31, 0xC0});                          // xor eax, eax
+        a.bind(have);
+        a.bytes({0x48, 0x8D, 0x48, 0x01});              // lea rcx, [rax+1]
+        a.store(state(InAt), RCX);
+        a.bytes({0x0F, 0xB6, 0x84, 0x03}); a.u32(state(InBuf));   // movzx eax, byte [rbx + rax + InBuf]
+        a.ret();
+
+        // rsi/rdx: message, rax: value. Prints "<message><hex>\n" to stderr and exits 1.
+        size_t hexFault = a.here();
+        a.push(RAX); a.push(RSI); a.push(RDX);
+        a.link(a.call(), flushOut);
+        a.pop(RDX); a.pop(RSI);
+        write(2);
+        a.pop(RAX);
+        a.bytes({0x48, 0x83, 0xEC, 0x40});              // sub rsp, 64
+        a.bytes({0x48, 0x8D, 0x74, 0x24, 0x3F});        // lea rsi, [rsp+63]
+        a.bytes({0xC6, 0x06, 0x0A});                    // mov byte [rsi], '\n'
+        size_t loop = a.here();
+        a.bytes({0x89, 0xC1, 0x83, 0xE1, 0x0F});        // mov ecx, eax; and ecx, 15
+        a.bytes({0x8A, 0x89}); a.u32(addr(sDigits));    // mov cl, [rcx + digits]
+        a.bytes({0x48, 0xFF, 0xCE, 0x88, 0x0E});        // dec rsi; mov [rsi], cl
+        a.bytes({0x48, 0xC1, 0xE8, 0x04});              // shr rax, 4
+        a.link(a.jcc(NotEqual), loop);
+        a.bytes({0x48, 0x8D, 0x54, 0x24, 0x40});        // lea rdx, [rsp+64]
+        a.alu(0x29, RDX, RSI);                          // sub rdx, rsi
+        write(2);
+        exitWith(1);
+
+        memFault = a.here();
+        message(sMem, MemMsg.size());
+        a.link(a.jmp(), hexFault);
+        jumpFault = a.here();
+        message(sJump, JumpMsg.size());
+        a.link(a.jmp(), hexFault);
+        divFault = a.here();
+        a.link(a.call(), flushOut);
+        message(sDiv, DivMsg.size());
+        write(2);
+        exitWith(1);
+
+        // edi: exit status, once stdout is out.
+        quit = a.here();
+        a.push(RDI);
+        a.link(a.call(), flushOut);
+        a.pop(RDI);
+        a.movImm(RAX, 231);                             // exit_group
+        a.syscall();
+
+        // rdi/rdx: guest address and length. rdi = the bytes, or a memory fault.
+        checkSpan = a.here();
+        a.movImm(RCX, m.memSize);
+        a.alu(0x39, RDX, RCX);                          // cmp rdx, rcx
+        size_t tooLong = a.jcc(Above);
+        a.alu(0x29, RCX, RDX);                          // sub rcx, rdx
+        a.alu(0x39, RDI, RCX);                          // cmp rdi, rcx
+        size_t outside = a.jcc(Above);
+        a.alu(0x01, RDI, RBP);                          // add rdi, rbp
+        a.ret();
+        a.bind(tooLong); a.bind(outside);
+        a.alu(0x89, RAX, RDI);                          // mov rax, rdi
+        a.link(a.jmp(), memFault);
+
+        bool calls = false;
+        for (auto& u : m.code) calls |= u.k == interp::SYSCALL;
+        if (calls) services();
+    }
+
+    // system_call(): dispatches on the number register, reads the argument
+    // registers itself and stores a result in the result register.
+    void services() {
+        const SyscallABI& abi = m.abi;
+        const uint32_t arg0 = m.sys[1], arg1 = m.sys[2], arg2 = m.sys[3];
+        sysCall = a.here();
+        a.load(RAX, m.sys[0] * 8);
+        std::vector<std::pair<size_t, SysService>> cases;
+        for (size_t k = 0; k < abi.count; ++k) {
+            a.bytes({0x48, 0x3D}); a.u32((uint32_t)abi.numbers[k].num);   // cmp rax, num
+            cases.push_back({a.jcc(Equal), abi.numbers[k].service});
+        }
+        // "[unknown syscall %d]\n" on stdout, then carry on.
+        a.push(RAX);
+        message(sUnknown, UnknownMsg.size());
+        a.link(a.call(), putBytes);
+        a.pop(RAX);
+        a.bytes({0x48, 0x63, 0xC0});                    // movsxd rax, eax
+        a.link(a.call(), printDec);
+        message(sClose, 2);
+        a.link(a.jmp(), putBytes);
+
+        size_t result = a.here();                       // rax to the result register
+        if (narrow) a.bytes({0x48, 0x63, 0xC0});        // movsxd rax, eax
+        a.store(m.sys[4] * 8, RAX);
+        a.ret();
+        size_t failed = a.here();
+        a.movImm(RAX, ~0ull);
+        a.link(a.jmp(), result);
+        auto toResult = [&]{ a.link(a.jmp(), result); };
+        auto toFailed = [&](Cond c){ a.link(a.jcc(c), failed); };
+
+        std::vector<size_t> body((size_t)SysService::ExitWith + 1, 0);
+        using S = SysService;
+        body[(size_t)S::PrintInt] = a.here();
+        guestInt(RAX, arg0);
+        a.link(a.jmp(), printDec);
+
+        body[(size_t)S::PrintString] = a.here();
+        guestAddr(RDI, arg0);
+        a.movImm(RCX, m.memSize);
+        a.alu(0x39, RDI, RCX);                          // cmp rdi, rcx
+        size_t inside = a.jcc(Below);
+        a.alu(0x89, RAX, RDI);                          // mov rax, rdi
+        a.link(a.jmp(), memFault);
+        a.bind(inside);
+        a.alu(0x29, RCX, RDI);                          // sub rcx, rdi: bytes to the end
+        a.bytes({0x48, 0x8D, 0x7C, 0x3D, 0x00});        // lea rdi, [rbp+rdi]
+        a.alu(0x89, RSI, RDI);                          // mov rsi, rdi
+        a.bytes({0x31, 0xC0, 0xF2, 0xAE});              // xor eax, eax; repne scasb
+        size_t noNul = a.jcc(NotEqual);
+        a.bytes({0x48, 0xFF, 0xCF});                    // dec rdi
+        a.bind(noNul);
+        a.alu(0x89, RDX, RDI);                          // mov rdx, rdi
+        a.alu(0x29, RDX, RSI);                          // sub rdx, rsi
+        a.link(a.jmp(), putBytes);
+
+        body[(size_t)S::PrintChar] = a.here();
+        a.load(RAX, arg0 * 8);
+        a.push(RAX);
+        a.alu(0x89, RSI, RSP);                          // mov rsi, rsp
+        a.movImm(RDX, 1);
+        a.link(a.call(), putBytes);
+        a.pop(RAX);
+        a.ret();
+
+        // Blank space, an optional sign, digits, then the rest of the line.
+        // r8: negative, r9: the value.
+        body[(size_t)S::ReadInt] = a.here();
+        size_t blank = a.here();
+        a.link(a.call(), getByte);
+        for (uint8_t c : {' ', '\t', '\r', '\n'}) {
+            a.bytes({0x83, 0xF8, c});                   // cmp eax, c
+            a.link(a.jcc(Equal), blank);
+        }
+        a.bytes({0x45, 0x31, 0xC0, 0x45, 0x31, 0xC9});  // xor r8d, r8d; xor r9d, r9d
+        a.bytes({0x83, 0xF8, '-'});                     // cmp eax, '-'
+        size_t notMinus = a.jcc(NotEqual);
+        a.bytes({0x49, 0xFF, 0xC0});                    // inc r8
+        size_t signDone = a.jmp();
+        a.bind(notMinus);
+        a.bytes({0x83, 0xF8, '+'});                     // cmp eax, '+'
+        size_t digits = a.jcc(NotEqual);
+        a.bind(signDone);
+        size_t nextDigit = a.here();
+        a.link(a.call(), getByte);
+        a.bind(digits);
+        a.bytes({0x8D, 0x48, 0xD0});                    // lea ecx, [rax-'0']
+        a.bytes({0x83, 0xF9, 0x09});                    // cmp ecx, 9
+        size_t rest = a.jcc(Above);
+        a.bytes({0x4D, 0x6B, 0xC9, 0x0A});              // imul r9, r9, 10
+        a.bytes({0x49, 0x01, 0xC9});                    // add r9, rcx
+        a.link(a.jmp(), nextDigit);
+        a.bind(rest);
+        size_t skip = a.here();
+        a.bytes({0x83, 0xF8, '\n'});                    // cmp eax, '\n'
+        size_t lineEnd = a.jcc(Equal);
+        a.bytes({0x48, 0x83, 0xF8, 0xFF});              // cmp rax, -1
+        size_t inputEnd = a.jcc(Equal);
+        a.link(a.call(), getByte);
+        a.link(a.jmp(), skip);
+        a.bind(lineEnd); a.bind(inputEnd);
+        a.bytes({0x4C, 0x89, 0xC8});                    // mov rax, r9
+        a.bytes({0x4D, 0x85, 0xC0});                    // test r8, r8
+        size_t plus = a.jcc(Equal);
+        a.bytes({0x48, 0xF7, 0xD8});                    // neg rax
+        a.bind(plus);
+        toResult();
+
+        // Like fgets. r8: next byte of the buffer, r9: room left before the NUL.
+        body[(size_t)S::ReadString] = a.here();
+        guestInt(RDX, arg1);
+        a.bytes({0x48, 0x85, 0xD2});                    // test rdx, rdx
+        size_t noRoom = a.jcc(LessEq);
+        guestAddr(RDI, arg0);
+        a.link(a.call(), checkSpan);
+        a.bytes({0x49, 0x89, 0xF8});                    // mov r8, rdi
+        a.bytes({0x4C, 0x8D, 0x4A, 0xFF});              // lea r9, [rdx-1]
+        size_t nextChar = a.here();
+        a.bytes({0x4D, 0x85, 0xC9});                    // test r9, r9
+        size_t full = a.jcc(Equal);
+        a.link(a.call(), getByte);
+        a.bytes({0x48, 0x83, 0xF8, 0xFF});              // cmp rax, -1
+        size_t eof = a.jcc(Equal);
+        a.bytes({0x41, 0x88, 0x00});                    // mov [r8], al
+        a.bytes({0x49, 0xFF, 0xC0, 0x49, 0xFF, 0xC9});  // inc r8; dec r9
+        a.bytes({0x83, 0xF8, '\n'});                    // cmp eax, '\n'
+        a.link(a.jcc(NotEqual), nextChar);
+        a.bind(full); a.bind(eof);
+        a.bytes({0x41, 0xC6, 0x00, 0x00});              // mov byte [r8], 0
+        a.bind(noRoom);
+        a.ret();
+
+        body[(size_t)S::ReadChar] = a.here();
+        a.link(a.call(), getByte);
+        toResult();
+
+        // fd 0 takes what is buffered first; anything else is one read(2).
+        body[(size_t)S::Read] = a.here();
+        guestAddr(RDI, arg1);
+        guestAddr(RDX, arg2);
+        a.link(a.call(), checkSpan);
+        guestInt(RAX, arg0);
+        a.bytes({0x48, 0x85, 0xC0});                    // test rax, rax
+        size_t rawRead = a.jcc(NotEqual);
+        a.load(RSI, state(InAt));
+        a.load(RCX, state(InEnd));
+        a.alu(0x29, RCX, RSI);                          // sub rcx, rsi: buffered
+        size_t empty = a.jcc(Equal);
+        a.alu(0x39, RCX, RDX);                          // cmp rcx, rdx
+        size_t fewer = a.jcc(BelowEq);
+        a.alu(0x89, RCX, RDX);                          // mov rcx, rdx
+        a.bind(fewer);
+        a.alu(0x89, RAX, RCX);                          // mov rax, rcx
+        a.bytes({0x48, 0x8D, 0x14, 0x0E});              // lea rdx, [rsi+rcx]
+        a.store(state(InAt), RDX);
+        a.bytes({0x48, 0x8D, 0xB4, 0x33}); a.u32(state(InBuf));   // lea rsi, [rbx + rsi + InBuf]
+        a.bytes({0xF3, 0xA4});                          // rep movsb
+        toResult();
+        a.bind(rawRead); a.bind(empty);
+        a.push(RAX); a.push(RDI); a.push(RDX);
+        a.link(a.call(), flushOut);
+        a.pop(RDX); a.pop(RSI); a.pop(RDI);
+        a.bytes({0x31, 0xC0});                          // xor eax, eax: read
+        a.syscall();
+        a.bytes({0x48, 0x85, 0xC0});                    // test rax, rax
+        toFailed(Sign);
+        toResult();
+
+        // fd 1 goes through the buffer; anything else is one write(2).
+        body[(size_t)S::Write] = a.here();
+        guestAddr(RDI, arg1);
+        guestAddr(RDX, arg2);
+        a.link(a.call(), checkSpan);
+        a.alu(0x89, RSI, RDI);                          // mov rsi, rdi
+        guestInt(RAX, arg0);
+        a.bytes({0x48, 0x83, 0xF8, 0x01});              // cmp rax, 1
+        size_t rawWrite = a.jcc(NotEqual);
+        a.push(RDX);
+        a.link(a.call(), putBytes);
+        a.pop(RAX);
+        toResult();
+        a.bind(rawWrite);
+        a.push(RAX); a.push(RSI); a.push(RDX);
+        a.link(a.call(), flushOut);
+        a.pop(RDX); a.pop(RSI); a.pop(RDI);
+        a.movImm(RAX, 1);
+        a.syscall();
+        a.bytes({0x48, 0x85, 0xC0});                    // test rax, rax
+        toFailed(Sign);
+        toResult();
+
+        const uint64_t heapBase = m.heapBase, heapLimit = m.heapLimit;
+        body[(size_t)S::Sbrk] = a.here();
+        guestInt(RAX, arg0);
+        a.load(RDX, state(Brk));
+        a.alu(0x01, RAX, RDX);                          // add rax, rdx: the new break
+        a.movImm(RCX, heapBase);
+        a.alu(0x39, RAX, RCX);                          // cmp rax, rcx
+        toFailed(Below);
+        a.movImm(RCX, heapLimit);
+        a.alu(0x39, RAX, RCX);
+        toFailed(Above);
+        a.store(state(Brk), RAX);
+        a.alu(0x89, RAX, RDX);                          // mov rax, rdx
+        toResult();
+
+        body[(size_t)S::Brk] = a.here();
+        guestAddr(RAX, arg0);
+        a.movImm(RCX, heapBase);
+        a.alu(0x39, RAX, RCX);
+        size_t low = a.jcc(Below);
+        a.movImm(RCX, heapLimit);
+        a.alu(0x39, RAX, RCX);
+        size_t high = a.jcc(Above);
+        a.store(state(Brk), RAX);
+        a.bind(low); a.bind(high);
+        a.load(RAX, state(Brk));
+        toResult();
+
+        // Whole zeroed pages from the heap; the address hint is ignored.
+        body[(size_t)S::Mmap] = a.here();
+        guestAddr(RDX, arg1);
+        a.bytes({0x48, 0x85, 0xD2});                    // test rdx, rdx
+        toFailed(Equal);
+        a.movImm(RCX, heapLimit);
+        a.alu(0x39, RDX, RCX);                          // cmp rdx, rcx
+        toFailed(Above);
+        a.bytes({0x48, 0x81, 0xC2}); a.u32(MemPage - 1);            // add rdx, 4095
+        a.bytes({0x48, 0x81, 0xE2}); a.u32((uint32_t)-MemPage);     // and rdx, -4096
+        a.load(RAX, state(Brk));
+        a.bytes({0x48, 0x05}); a.u32(MemPage - 1);                  // add rax, 4095
+        a.bytes({0x48, 0x25}); a.u32((uint32_t)-MemPage);           // and rax, -4096
+        a.bytes({0x48, 0x8D, 0x3C, 0x10});              // lea rdi, [rax+rdx]
+        a.alu(0x39, RDI, RCX);                          // cmp rdi, rcx
+        toFailed(Above);
+        a.store(state(Brk), RDI);
+        a.push(RAX);
+        a.bytes({0x48, 0x8D, 0x7C, 0x05, 0x00});        // lea rdi, [rbp+rax]
+        a.alu(0x89, RCX, RDX);                          // mov rcx, rdx
+        a.bytes({0x31, 0xC0, 0xF3, 0xAA});              // xor eax, eax; rep stosb
+        a.pop(RAX);
+        toResult();
+
+        body[(size_t)S::Exit] = a.here();
+        a.bytes({0x31, 0xFF});                          // xor edi, edi
+        a.link(a.jmp(), quit);
+        body[(size_t)S::ExitWith] = a.here();
+        a.load(RDI, arg0 * 8);
+        a.link(a.jmp(), quit);
+
+        for (auto& [rel, service] : cases) a.link(rel, body[(size_t)service]);
+    }
+
+    // Maps guest memory, copies the data image in and points rbx at the values.
+    void prologue() {
+        entry = a.here();
+        a.movImm(RAX, 9);                                    // mmap
+        a.bytes({0x31, 0xFF});                               // xor edi, edi
+        a.movImm(RSI, m.memSize);
+        a.movImm(RDX, 3);                                    // PROT_READ | PROT_WRITE
+        a.bytes({0x41, 0xBA}); a.u32(0x4022);                // mov r10d, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+        a.bytes({0x49, 0xC7, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF}); // mov r8, -1
+        a.bytes({0x45, 0x31, 0xC9});                         // xor r9d, r9d
+        a.syscall();
+        a.bytes({0x48, 0x3D}); a.u32((uint32_t)-4096);       // cmp rax, -4096
+        size_t mapped = a.jcc(BelowEq);
+        message(sAlloc, AllocMsg.size());
+        write(2);
+        exitWith(1);
+        a.bind(mapped);
+        a.alu(0x89, RBP, RAX);                               // mov rbp, rax
+        uint64_t copied = 0;                                 // pieces sit back to back after the tables
+        for (auto& piece : image.pieces) {
+            a.movImm(RDI, DataBase + piece.at);
+            a.alu(0x01, RDI, RBP);                           // add rdi, rbp
+            a.b.push_back(0xBE); imageRefs.emplace_back(a.here(), copied); a.u32(0);
+            a.movImm(RCX, piece.size);
+            a.bytes({0xF3, 0xA4});                           // rep movsb
+            copied += piece.size;
+        }
+        a.b.push_back(0xBB); valuesRefs.push_back(a.here()); a.u32(0);   // mov ebx, values
+        a.movImm(RAX, m.heapBase);
+        a.store(state(Brk), RAX);
+    }
+
+    // rax = checked guest address from slot `from` for an n-byte access, rebased onto rbp.
+    void address(uint32_t from, unsigned n) {
+        get(RAX, from);
+        if (narrow) a.bytes({0x89, 0xC0});                   // mov eax, eax
+        a.movImm(RDX, m.memSize - n);
+        a.alu(0x39, RAX, RDX);                               // cmp rax, rdx
+        a.link(a.jcc(Above), memFault);
+        a.alu(0x01, RAX, RBP);                               // add rax, rbp
+    }
+
+    void division(const interp::UOp& u) {
+        using namespace interp;
+        get(RAX, u.a);
+        get(RCX, u.b);
+        a.bytes({0x48, 0x85, 0xC9});                         // test rcx, rcx
+        a.link(a.jcc(Equal), divFault);
+        size_t done = 0;
+        if (u.k == DIVS || u.k == REMS) {
+            // x / -1 wraps instead of trapping, x % -1 is 0.
+            a.bytes({0x48, 0x83, 0xF9, 0xFF});               // cmp rcx, -1
+            size_t general = a.jcc(NotEqual);
+            if (u.k == DIVS) a.bytes({0x48, 0xF7, 0xD8});    // neg rax
+            else a.bytes({0x31, 0xC0});                      // xor eax, eax
+            done = a.jmp();
+            a.bind(general);
+            a.bytes({0x48, 0x99, 0x48, 0xF7, 0xF9});         // cqo; idiv rcx
+        } else {
+            a.bytes({0x31, 0xD2, 0x48, 0xF7, 0xF1});         // xor edx, edx; div rcx
+        }
+        if (u.k == REMS || u.k == REMU) a.alu(0x89, RAX, RDX);
+        if (done) a.bind(done);
+        put(u.d);
+    }
+
+    void op(const interp::UOp& u) {
+        using namespace interp;
+        switch (u.k) {
+            case MOV: get(RAX, u.a); put(u.d); break;
+            case ADD: case SUB: case AND: case OR: case XOR: case MUL: {
+                get(RAX, u.a); get(RCX, u.b);
+                if (u.k == MUL) a.bytes({0x48, 0x0F, 0xAF, 0xC1});  // imul rax, rcx
+                else a.alu(u.k == ADD ? 0x01 : u.k == SUB ? 0x29 : u.k == AND ? 0x21 : u.k == OR ? 0x09 : 0x31, RAX, RCX);
+                put(u.d);
+                break;
+            }
+            case DIVS: case DIVU: case REMS: case REMU: division(u); break;
+            case SHL: case SHRS: case SHRU:
+                get(RAX, u.a); get(RCX, u.b);
+                a.bytes({0x48, 0xD3, (uint8_t)(u.k == SHL ? 0xE0 : u.k == SHRS ? 0xF8 : 0xE8)});
+                put(u.d);
+                break;
+            case EQ: case NE: case LTS: case LTU: case LES: case LEU: {
+                static const uint8_t set[] = {0x94, 0x95, 0x9C, 0x92, 0x9E, 0x96};
+                get(RAX, u.a); get(RCX, u.b);
+                a.alu(0x39, RAX, RCX);                       // cmp rax, rcx
+                a.bytes({0x0F, set[u.k - EQ], 0xC0, 0x0F, 0xB6, 0xC0});   // setcc al; movzx eax, al
+                put(u.d);
+                break;
+            }
+            case NOT: get(RAX, u.a); a.bytes({0x48, 0xF7, 0xD0}); put(u.d); break;
+            case NEG: get(RAX, u.a); a.bytes({0x48, 0xF7, 0xD8}); put(u.d); break;
+            case LNOT:
+                get(RAX, u.a);
+                a.bytes({0x48, 0x85, 0xC0, 0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0});
+                put(u.d);
+                break;
+            case SEXT8:  get(RAX, u.a); a.bytes({0x48, 0x0F, 0xBE, 0xC0}); put(u.d); break;
+            case SEXT16: get(RAX, u.a); a.bytes({0x48, 0x0F, 0xBF, 0xC0}); put(u.d); break;
+            case SEXT32: get(RAX, u.a); a.bytes({0x48, 0x63, 0xC0}); put(u.d); break;
+            case ZEXT8:  get(RAX, u.a); a.bytes({0x0F, 0xB6, 0xC0}); put(u.d); break;
+            case ZEXT16: get(RAX, u.a); a.bytes({0x0F, 0xB7, 0xC0}); put(u.d); break;
+            case ZEXT32: get(RAX, u.a); a.bytes({0x89, 0xC0}); put(u.d); break;
+            case SEL:
+                get(RAX, u.a); get(RCX, u.b); get(RDX, u.c);
+                a.bytes({0x48, 0x85, 0xC0});                 // test rax, rax
+                a.bytes({0x48, 0x0F, 0x44, 0xCA});           // cmovz rcx, rdx
+                a.store(u.d * 8, RCX);
+                break;
+            case LD8S:  address(u.a, 1); a.bytes({0x48, 0x0F, 0xBE, 0x00}); put(u.d); break;
+            case LD8U:  address(u.a, 1); a.bytes({0x0F, 0xB6, 0x00}); put(u.d); break;
+            case LD16S: address(u.a, 2); a.bytes({0x48, 0x0F, 0xBF, 0x00}); put(u.d); break;
+            case LD16U: address(u.a, 2); a.bytes({0x0F, 0xB7, 0x00}); put(u.d); break;
+            case LD32S: address(u.a, 4); a.bytes({0x48, 0x63, 0x00}); put(u.d); break;
+            case LD32U: address(u.a, 4); a.bytes({0x8B, 0x00}); put(u.d); break;
+            case LD64:  address(u.a, 8); a.bytes({0x48, 0x8B, 0x00}); put(u.d); break;
+            case ST8:  address(u.a, 1); get(RCX, u.b); a.bytes({0x88, 0x08}); break;
+            case ST16: address(u.a, 2); get(RCX, u.b); a.bytes({0x66, 0x89, 0x08}); break;
+            case ST32: address(u.a, 4); get(RCX, u.b); a.bytes({0x89, 0x08}); break;
+            case ST64: address(u.a, 8); get(RCX, u.b); a.bytes({0x48, 0x89, 0x08}); break;
+            case JMP: jumps.push_back({a.jmp(), u.c}); break;
+            case BNZ: case BZ:
+                get(RAX, u.a);
+                a.bytes({0x48, 0x85, 0xC0});
+                jumps.push_back({a.jcc(u.k == BNZ ? NotEqual : Equal), u.c});
+                break;
+            case JIND: {
+                // Any instruction is a valid target, as under -interp.
+                uint32_t last = (uint32_t)m.insnStart.size() - 1;
+                get(RAX, u.a);
+                if (narrow) a.bytes({0x89, 0xC0});
+                a.alu(0x89, RCX, RAX);                       // mov rcx, rax
+                a.bytes({0x48, 0x81, 0xE9}); a.u32((uint32_t)TextBase);   // sub rcx, TextBase
+                a.bytes({0xF6, 0xC1, 0x03});                 // test cl, 3
+                a.link(a.jcc(NotEqual), jumpFault);
+                a.bytes({0x48, 0xC1, 0xE9, 0x02});           // shr rcx, 2
+                a.bytes({0x48, 0x81, 0xF9}); a.u32(last);    // cmp rcx, last
+                a.link(a.jcc(Above), jumpFault);
+                a.bytes({0xFF, 0x24, 0xCD}); tableRefs.push_back(a.here()); a.u32(0);   // jmp [rcx*8 + table]
+                break;
+            }
+            case SYSCALL: a.link(a.call(), sysCall); break;
+            case HALT:
+                a.bytes({0x31, 0xFF});                       // xor edi, edi
+                a.link(a.jmp(), quit);
+                break;
+            default: break;
+        }
+    }
+
+    void program() {
+        at.resize(m.code.size());
+        for (size_t k = 0; k < m.code.size(); ++k) {
+            at[k] = a.here();
+            op(m.code[k]);
+        }
+        for (auto& [rel, target] : jumps) a.link(rel, at[target]);
+    }
+
+    std::string link() {
+        a.align(8);
+        size_t table = a.here();
+        for (uint32_t start : m.insnStart) a.u64(LoadBase + CodeOffset + at[start]);
+        size_t img = a.here();
+        for (auto& piece : image.pieces) {
+            if (a.b.size() + piece.size > 0x80000000ull) throw std::runtime_error("program too large for -native");
+            a.b.resize(a.b.size() + piece.size);
+            if (!image.read(piece, a.b.data() + a.b.size() - piece.size)) throw std::runtime_error("cannot read " + piece.file);
+        }
+        size_t textEnd = CodeOffset + a.here();
+        size_t valuesOff = (textEnd + 4095) & ~(size_t)4095;
+        uint64_t values = LoadBase + valuesOff;
+        if (values + 8 * m.values.size() + StateBytes > 0x80000000ull) throw std::runtime_error("program too large for -native");
+        for (size_t r : tableRefs) a.patch32(r, addr(table));
+        for (auto& [r, off] : imageRefs) a.patch32(r, addr(img) + (uint32_t)off);
+        for (size_t r : valuesRefs) a.patch32(r, (uint32_t)values);
+
+        std::string out;
+        auto put16 = [&](uint16_t v) { out.push_back((char)v); out.push_back((char)(v >> 8)); };
+        auto put32 = [&](uint32_t v) { for (int k = 0; k < 4; ++k) out.push_back((char)(v >> 8*k)); };
+        auto put64 = [&](uint64_t v) { for (int k = 0; k < 8; ++k) out.push_back((char)(v >> 8*k)); };
+        out.append("\x7F" "ELF\x02\x01\x01", 7);
+        out.append(9, '\0');
+        put16(2); put16(62); put32(1);                       // ET_EXEC, EM_X86_64
+        put64(LoadBase + CodeOffset + entry);
+        put64(64); put64(0);                                 // program headers, no sections
+        put32(0); put16(64); put16(56); put16(3); put16(64); put16(0); put16(0);
+        auto segment = [&](uint32_t type, uint32_t flags, uint64_t off, uint64_t size, uint64_t memSize) {
+            put32(type); put32(flags);
+            put64(off); put64(LoadBase + off); put64(LoadBase + off);
+            put64(size); put64(memSize); put64(4096);
+        };
+        segment(1, 5, 0, textEnd, textEnd);                  // PT_LOAD r-x: headers, code, tables, data image
+        segment(1, 6, valuesOff, 8 * m.values.size(), 8 * m.values.size() + StateBytes);   // PT_LOAD rw-: values, runtime state
+        segment(0x6474E551, 6, 0, 0, 0);                     // PT_GNU_STACK: no executable stack
+        out.resize(CodeOffset, '\0');
+        out.append((const char*)a.b.data(), a.b.size());
+        out.resize(valuesOff, '\0');
+        for (int64_t v : m.values) put64((uint64_t)v);
+        return out;
+    }
+};
+
+// Writes the executable to path. Throws std::runtime_error when it cannot.
+inline void writeExecutable(const interp::Machine& m, const DataImage& image, unsigned xlen, const std::string& path) {
+    std::string bytes = Backend(m, image, xlen).elf();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out || !out.write(bytes.data(), (std::streamsize)bytes.size())) throw std::runtime_error("cannot write " + path);
+    out.close();
+#ifndef _WIN32
+    chmod(path.c_str(), 0755);
+#endif
+}
+
+}
@@ -0,0 +1,528 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Interp.h"
+#include "Translator.h"
+
+// Dataflow optimizer between translation and emission. Every instruction is
+// rendered as usual and compiled into the interpreter's micro-ops, which gives
+// exact register defs/uses and an evaluator for folding. Blocks come from the
+// text labels and the jumps the micro-ops contain. The passes:
+//   constprop  global constant propagation; fully constant instructions become
+//              plain assignments, constant register operands become literals
+//   copyprop   block-local: reads of a copied register read the original
+//   dse        global liveness; pure instructions whose results are never read
+//              (including writes to the zero register) are dropped
+// Rewrites are still template renderings with some operands replaced, so the
+// output keeps one C statement per instruction. A module of a multi-file
+// program (open) may be entered at any label from another file, so it gets
+// block-local propagation only, as a program with indirect jumps does.
+
+struct OptStats {
+    size_t blocks = 0, folded = 0, constOperands = 0, copies = 0, deadStores = 0, zeroWrites = 0;
+    std::string skipped;                // why the program was left alone
+    std::vector<std::string> loops;     // loop idioms replaced, "line N: what"
+    size_t whiles = 0, ifs = 0, elses = 0, breaks = 0;     // blocks rebuilt from branches (Structure.h)
+};
+
+struct OptimizedText {
+    enum Action : uint8_t { Keep, Drop, Replace };
+    std::vector<uint8_t> action;
+    std::unordered_map<uint32_t, std::string> replacement;
+    std::unordered_map<uint32_t, std::array<std::string, 3>> operands;    // a Replace's overridden operands, "" where kept
+    std::unordered_map<uint32_t, std::string> before, after;    // loop idioms: code ahead of an instruction's labels, and after it
+    OptStats stats;
+};
+
+// C type of the register variables: intptr_t unless -O narrowed them.
+inline const char* registerType(const AsmDefinition* def, bool localRegs) {
+    if (!localRegs) return "intptr_t";
+    return def->xlen == 64 ? "int64_t" : "int32_t";
+}
+
+inline std::string cLiteral(int64_t v) {
+    if (v == INT64_MIN) return "(-9223372036854775807LL - 1)";
+    if (v >= INT32_MIN && v <= INT32_MAX) return std::to_string(v);
+    return std::to_string(v) + "LL";
+}
+
+namespace opt {
+using namespace interp;
+
+enum : uint8_t {
+    FxEffect = 1, FxLoad = 2, FxCond = 4,       // FxCond: some writes are conditional
+    FxJump = 8, FxBranch = 16, FxIndirect = 32,
+    FxNoFold = 64,                              // uses PC
+};
+
+struct InsnInfo {
+    uint32_t uop0 = 0, uop1 = 0;                // micro-ops [uop0, uop1)
+    uint32_t def0 = 0, use0 = 0, target0 = 0;   // into Optimizer::list
+    uint8_t defs = 0, uses = 0, targets = 0;
+    uint8_t fx = 0;
+    bool ok = false;                            // the opcode has a template
+};
+
+struct Lattice {
+    std::vector<int64_t> val;
+    std::vector<uint8_t> state;                 // 0 unreached, 1 constant, 2 unknown
+};
+
+struct Optimizer {
+    const Program& prog;
+    Translator& tr;
+    Machine m;
+    std::unordered_map<std::string, uint64_t> symbols;
+    std::unordered_map<std::string, uint32_t> labelAt;
+    std::vector<std::pair<uint32_t, std::string>> gotos;
+    std::vector<InsnInfo> info;
+    std::vector<uint32_t> list;
+    std::vector<uint8_t> local;                 // register id declared inside a template
+    std::vector<uint32_t> blockStart;           // plus a sentinel
+    std::vector<std::vector<uint32_t>> succ;
+    std::vector<uint8_t> allLiveOut;            // block ends in an indirect jump
+    std::string typeName;
+    CType regType = PtrT;
+    uint32_t discard = ~0u;                     // where writes to the zero register go
+    uint32_t maxTemps = 0;
+    bool indirect = false;
+    OptimizedText result;
+
+    Optimizer(const Program& p, Translator& t) : prog(p), tr(t) {}
+
+    uint32_t regs() const { return (uint32_t)m.regNames.size(); }
+    const uint32_t* defsOf(const InsnInfo& in) const { return list.data() + in.def0; }
+    const uint32_t* usesOf(const InsnInfo& in) const { return list.data() + in.use0; }
+    bool isReg(uint32_t ref) const { return (ref & RefMask) == RegRef && !local[ref]; }
+
+    // Compiles one rendered statement and records its defs, uses and effects.
+    void analyze(uint32_t i, const std::string& stmt) {
+        InsnInfo& in = info[i];
+        in.uop0 = (uint32_t)m.code.size();
+        size_t g0 = gotos.size();
+        StmtCompiler c{m, stmt, 0, prog.text[i].line, 0, (int64_t)(tr.textBase + 4ull*i), symbols, gotos, {}, regType};
+        maxTemps = std::max(maxTemps, c.compile());
+        in.uop1 = (uint32_t)m.code.size();
+        local.resize(regs(), 0);
+        for (auto& [name, t] : c.locals) local[m.regIndex[name]] = 1;
+
+        std::vector<uint32_t> defs, uses, written;
+        auto has = [](const std::vector<uint32_t>& v, uint32_t r){ return std::find(v.begin(), v.end(), r) != v.end(); };
+        auto read = [&](uint32_t ref){
+            if (isReg(ref) && !has(written, ref) && !has(uses, ref)) uses.push_back(ref);
+        };
+        auto write = [&](uint32_t ref){
+            if (!isReg(ref)) return;
+            if (!has(defs, ref)) defs.push_back(ref);
+            if (!(in.fx & FxCond)) written.push_back(ref);
+        };
+        in.fx &= FxNoFold;
+        for (uint32_t u = in.uop0; u < in.uop1; ++u) {
+            const UOp& op = m.code[u];
+            switch (op.k) {
+                case SEL: read(op.a); read(op.b); read(op.c); write(op.d); break;
+                case LD8S: case LD8U: case LD16S: case LD16U: case LD32S: case LD32U: case LD64:
+                    read(op.a); write(op.d); in.fx |= FxLoad; break;
+                case ST8: case ST16: case ST32: case ST64:
+                    read(op.a); read(op.b); in.fx |= FxEffect; break;
+                case JMP: in.fx |= (in.fx & FxCond) ? FxBranch : FxJump; break;
+                case BNZ: read(op.a); in.fx |= FxBranch; break;
+                case BZ:  read(op.a); in.fx |= FxCond; break;
+                case JIND: read(op.a); in.fx |= FxIndirect; break;
+                case SYSCALL:
+                    for (uint32_t r : m.sys) read(r);
+                    write(op.d); in.fx |= FxEffect; break;
+                case NOP: case HALT: break;
+                case MOV: case NOT: case NEG: case LNOT:
+                case SEXT8: case SEXT16: case SEXT32: case ZEXT8: case ZEXT16: case ZEXT32:
+                    read(op.a); write(op.d); break;
+                default: read(op.a); read(op.b); write(op.d); break;
+            }
+        }
+        in.def0 = (uint32_t)list.size(); in.defs = (uint8_t)defs.size();
+        list.insert(list.end(), defs.begin(), defs.end());
+        in.use0 = (uint32_t)list.size(); in.uses = (uint8_t)uses.size();
+        list.insert(list.end(), uses.begin(), uses.end());
+        in.target0 = (uint32_t)list.size(); in.targets = 0;
+        for (size_t g = g0; g < gotos.size(); ++g) {
+            auto it = labelAt.find(gotos[g].second);
+            if (it == labelAt.end()) { in.fx |= FxIndirect; continue; }
+            list.push_back(it->second);
+            ++in.targets;
+        }
+        gotos.resize(g0);
+        in.ok = true;
+    }
+
+    // Evaluates instruction i over env; known[k]/val[k] describe its k-th def.
+    void eval(uint32_t i, const Lattice& env, std::vector<uint8_t>& known, std::vector<int64_t>& val) {
+        const InsnInfo& in = info[i];
+        known.assign(in.defs, 0);
+        val.assign(in.defs, 0);
+        if (in.fx & (FxNoFold | FxCond)) return;
+        std::vector<uint32_t> wr;                       // registers written so far (incl. template locals)
+        std::vector<int64_t> wv;
+        std::vector<uint8_t> wk;
+        std::vector<int64_t> tv(maxTemps + 1, 0);
+        std::vector<uint8_t> tk(maxTemps + 1, 0);
+        auto get = [&](uint32_t ref, int64_t& v) -> bool {
+            uint32_t x = ref & ~RefMask;
+            switch (ref & RefMask) {
+                case ConstRef: v = m.consts[x]; return true;
+                case TempRef: v = tv[x]; return tk[x];
+                default:
+                    for (size_t k = wr.size(); k-- > 0;)
+                        if (wr[k] == ref) { v = wv[k]; return wk[k]; }
+                    if (local[ref] || env.state[ref] != 1) return false;
+                    v = env.val[ref];
+                    return true;
+            }
+        };
+        auto set = [&](uint32_t ref, bool k, int64_t v) {
+            if ((ref & RefMask) == TempRef) { tk[ref & ~RefMask] = k; tv[ref & ~RefMask] = v; return; }
+            wr.push_back(ref); wk.push_back(k); wv.push_back(v);
+        };
+        for (uint32_t u = in.uop0; u < in.uop1; ++u) {
+            const UOp& op = m.code[u];
+            int64_t a = 0, b = 0, c = 0;
+            bool ka = get(op.a, a);
+            switch (op.k) {
+                case MOV: set(op.d, ka, a); break;
+                case NOT: case NEG: case LNOT: set(op.d, ka, fold(op.k, a, 0)); break;
+                case SEXT8:  set(op.d, ka, normalize(a, {8, true}));   break;
+                case SEXT16: set(op.d, ka, normalize(a, {16, true}));  break;
+                case SEXT32: set(op.d, ka, normalize(a, {32, true}));  break;
+                case ZEXT8:  set(op.d, ka, normalize(a, {8, false}));  break;
+                case ZEXT16: set(op.d, ka, normalize(a, {16, false})); break;
+                case ZEXT32: set(op.d, ka, normalize(a, {32, false})); break;
+                case SEL: {
+                    bool kb = get(op.b, b), kc = get(op.c, c);
+                    set(op.d, ka && (a ? kb : kc), a ? b : c);
+                    break;
+                }
+                case LD8S: case LD8U: case LD16S: case LD16U: case LD32S: case LD32U: case LD64:
+                case SYSCALL:
+                    set(op.d, false, 0); break;
+                case ST8: case ST16: case ST32: case ST64: case JMP: case BNZ: case BZ:
+                case JIND: case NOP: case HALT:
+                    break;
+                default: {
+                    bool kb = get(op.b, b);
+                    set(op.d, ka && kb, fold(op.k, a, b));
+                    break;
+                }
+            }
+        }
+        const uint32_t* d = defsOf(in);
+        for (uint8_t k = 0; k < in.defs; ++k) {
+            int64_t v;
+            known[k] = get(d[k], v);
+            val[k] = known[k] ? v : 0;
+        }
+    }
+
+    void apply(uint32_t i, Lattice& env, const std::vector<uint8_t>& known, const std::vector<int64_t>& val) {
+        const InsnInfo& in = info[i];
+        const uint32_t* d = defsOf(in);
+        for (uint8_t k = 0; k < in.defs; ++k) {
+            bool keepOld = (in.fx & FxCond) && env.state[d[k]] == 1 && known[k] && env.val[d[k]] == val[k];
+            if (keepOld) continue;
+            env.state[d[k]] = known[k] && !(in.fx & FxCond) ? 1 : 2;
+            env.val[d[k]] = val[k];
+        }
+    }
+
+    // The register a plain operand names, if the template reads it as a value.
+    int32_t operandReg(uint32_t i, int k, Sym s) {
+        const SlotProgram* p = tr.find(prog.text[i].op);
+        if (!p || p->bind[SlotD] == k || prog.syms.isLabel(s)) return -1;
+        std::string_view v = tr.operand(s);
+        if (v.empty() || !(std::isalpha((unsigned char)v[0]) || v[0]=='_')) return -1;
+        for (char c : v) if (!std::isalnum((unsigned char)c) && c != '_') return -1;
+        auto it = m.regIndex.find(std::string(v));
+        if (it == m.regIndex.end() || local[it->second]) return -1;
+        const InsnInfo& in = info[i];
+        const uint32_t* d = defsOf(in);
+        for (uint8_t j = 0; j < in.defs; ++j) if (d[j] == it->second) return -1;
+        return (int32_t)it->second;
+    }
+
+    bool alreadyConstant(const InsnInfo& in) const {
+        for (uint32_t u = in.uop0; u < in.uop1; ++u)
+            if (m.code[u].k != MOV || (m.code[u].a & RefMask) != ConstRef) return false;
+        return in.uop1 > in.uop0;
+    }
+
+    void buildBlocks() {
+        uint32_t n = (uint32_t)prog.text.size();
+        std::vector<uint8_t> leader(n + 1, 0);
+        leader[0] = 1;
+        for (auto& l : prog.labels) if (l.at < n) leader[l.at] = 1;
+        for (uint32_t i = 0; i < n; ++i) {
+            if (info[i].fx & (FxJump | FxBranch | FxIndirect)) leader[i+1] = 1;
+            if (info[i].fx & FxIndirect) indirect = true;
+        }
+        std::vector<uint32_t> blockOf(n + 1, 0);
+        for (uint32_t i = 0; i < n; ++i) {
+            if (leader[i]) blockStart.push_back(i);
+            blockOf[i] = (uint32_t)blockStart.size() - 1;
+        }
+        uint32_t nb = (uint32_t)blockStart.size();
+        blockStart.push_back(n);
+        succ.assign(nb, {});
+        allLiveOut.assign(nb, 0);
+        for (uint32_t b = 0; b < nb; ++b) {
+            const InsnInfo& last = info[blockStart[b+1] - 1];
+            if (!(last.fx & (FxJump | FxIndirect)) && b + 1 < nb) succ[b].push_back(b + 1);
+            for (uint8_t t = 0; t < last.targets; ++t) {
+                uint32_t at = list[last.target0 + t];
+                if (at < n) succ[b].push_back(blockOf[at]);
+            }
+            if (last.fx & FxIndirect) allLiveOut[b] = 1;
+        }
+        result.stats.blocks = nb;
+    }
+
+    std::string render(uint32_t i, const std::string* override) {
+        std::string out;
+        tr.translateLine(prog.text[i], out, override);
+        return out;
+    }
+
+    // Forward propagation to a fixpoint, then one rewriting walk per block.
+    void propagate() {
+        uint32_t nb = (uint32_t)succ.size(), nr = regs();
+        bool global = !indirect && (uint64_t)nb * nr <= (1u << 24);
+        std::vector<Lattice> in(global ? nb : 0);
+        std::vector<uint8_t> k8; std::vector<int64_t> vals;
+        if (global) {
+            for (auto& l : in) { l.val.assign(nr, 0); l.state.assign(nr, 0); }
+            in[0].state.assign(nr, 1);                  // registers start out zeroed
+            // but the stack register holds the memory size, and each hart gets its id and the hart count
+            for (std::string_view r : {tr.def->stackReg, tr.def->hartReg, tr.def->hartCountReg}) {
+                if (r.empty()) continue;
+                auto it = m.regIndex.find(sanitizeIdent(r));
+                if (it != m.regIndex.end()) in[0].state[it->second] = 2;
+            }
+            std::vector<uint32_t> work{0};
+            std::vector<uint8_t> queued(nb, 0);
+            queued[0] = 1;
+            while (!work.empty()) {
+                uint32_t b = work.back(); work.pop_back(); queued[b] = 0;
+                Lattice env = in[b];
+                for (uint32_t i = blockStart[b]; i < blockStart[b+1]; ++i) {
+                    eval(i, env, k8, vals);
+                    apply(i, env, k8, vals);
+                }
+                for (uint32_t s : succ[b]) {
+                    bool changed = false;
+                    Lattice& t = in[s];
+                    for (uint32_t r = 0; r < nr; ++r) {
+                        if (!env.state[r] || t.state[r] == 2) continue;
+                        uint8_t ns = !t.state[r] ? env.state[r] : (env.state[r] == 1 && t.val[r] == env.val[r] ? 1 : 2);
+                        if (ns != t.state[r] || (ns == 1 && t.val[r] != env.val[r])) {
+                            t.state[r] = ns; t.val[r] = env.val[r]; changed = true;
+                        }
+                    }
+                    if (changed && !queued[s]) { queued[s] = 1; work.push_back(s); }
+                }
+            }
+        }
+
+        std::vector<int32_t> copyOf(nr, -1);        // register -> register it holds a copy of
+        std::vector<uint32_t> version(nr, 0), copyVersion(nr, 0);
+        for (uint32_t b = 0; b < nb; ++b) {
+            Lattice env;
+            if (global) env = in[b];
+            else { env.val.assign(nr, 0); env.state.assign(nr, 2); }
+            for (uint32_t r = 0; r < nr; ++r) if (!env.state[r]) env.state[r] = 2;   // unreachable so far
+            std::fill(copyOf.begin(), copyOf.end(), -1);
+            for (uint32_t i = blockStart[b]; i < blockStart[b+1]; ++i) {
+                InsnInfo& ii = info[i];
+                if (!ii.ok) continue;
+                eval(i, env, k8, vals);
+                bool allKnown = ii.defs > 0 && ii.fx == 0;
+                for (uint8_t k = 0; k < ii.defs && allKnown; ++k) allKnown = k8[k];
+                if (allKnown && !alreadyConstant(ii)) {
+                    std::string out;
+                    const uint32_t* d = defsOf(ii);
+                    for (uint8_t k = 0; k < ii.defs; ++k)
+                        if (d[k] != discard)
+                            out += "    " + m.regNames[d[k]] + " = " + cLiteral(vals[k]) + ";\n";
+                    result.action[i] = OptimizedText::Replace;
+                    result.replacement[i] = out;
+                    ++result.stats.folded;
+                } else {
+                    Sym syms[3];
+                    std::string override[3];
+                    bool changed = false;
+                    int n = tr.operands(prog.text[i], syms);
+                    for (int k = 0; k < n; ++k) {
+                        int32_t r = operandReg(i, k, syms[k]);
+                        if (r < 0) continue;
+                        if (env.state[r] == 1) {
+                            override[k] = "((" + typeName + ")" + cLiteral(env.val[r]) + ")";
+                            ++result.stats.constOperands;
+                            changed = true;
+                        } else if (copyOf[r] >= 0 && version[copyOf[r]] == copyVersion[r]) {
+                            override[k] = m.regNames[copyOf[r]];
+                            ++result.stats.copies;
+                            changed = true;
+                        }
+                    }
+                    if (changed) {
+                        result.action[i] = OptimizedText::Replace;
+                        result.replacement[i] = render(i, override);
+                        result.operands[i] = {override[0], override[1], override[2]};
+                    }
+                }
+                // A pure register copy, judged on the original micro-ops.
+                int32_t copyFrom = -1;
+                if (ii.uop1 == ii.uop0 + 1 && m.code[ii.uop0].k == MOV && isReg(m.code[ii.uop0].a)
+                    && isReg(m.code[ii.uop0].d) && m.code[ii.uop0].a != m.code[ii.uop0].d) {
+                    uint32_t s = m.code[ii.uop0].a;
+                    copyFrom = (copyOf[s] >= 0 && version[copyOf[s]] == copyVersion[s]) ? copyOf[s] : (int32_t)s;
+                }
+                apply(i, env, k8, vals);
+                const uint32_t* d = defsOf(ii);
+                for (uint8_t k = 0; k < ii.defs; ++k) { ++version[d[k]]; copyOf[d[k]] = -1; }
+                if (copyFrom >= 0 && (uint32_t)copyFrom != m.code[ii.uop0].d) {
+                    uint32_t dst = m.code[ii.uop0].d;
+                    copyOf[dst] = copyFrom;
+                    copyVersion[dst] = version[copyFrom];
+                }
+                if (result.action[i] == OptimizedText::Replace) analyze(i, result.replacement[i]);
+            }
+        }
+    }
+
+    // Backward liveness to a fixpoint, then drops pure instructions whose results die.
+    bool eliminate() {
+        uint32_t nb = (uint32_t)succ.size(), nr = regs();
+        size_t words = (nr + 63) / 64;
+        bool global = (uint64_t)nb * words * 64 <= (1u << 26);
+        using Bits = std::vector<uint64_t>;
+        auto setBit = [](Bits& b, uint32_t r){ b[r >> 6] |= 1ull << (r & 63); };
+        auto clearBit = [](Bits& b, uint32_t r){ b[r >> 6] &= ~(1ull << (r & 63)); };
+        auto testBit = [](const Bits& b, uint32_t r){ return (b[r >> 6] >> (r & 63)) & 1; };
+        Bits all(words, ~0ull);
+        auto pure = [&](const InsnInfo& in){
+            return in.ok && in.defs > 0 && !(in.fx & ~FxNoFold);
+        };
+        auto transfer = [&](uint32_t i, Bits& live) {
+            const InsnInfo& in = info[i];
+            if (result.action[i] == OptimizedText::Drop) return;
+            if (!(in.fx & FxCond)) for (uint8_t k = 0; k < in.defs; ++k) clearBit(live, defsOf(in)[k]);
+            for (uint8_t k = 0; k < in.uses; ++k) setBit(live, usesOf(in)[k]);
+        };
+        std::vector<Bits> liveIn(global ? nb : 0, Bits(words, 0));
+        auto liveOut = [&](uint32_t b) {
+            if (!global || allLiveOut[b]) return all;
+            Bits out(words, 0);
+            for (uint32_t s : succ[b]) for (size_t w = 0; w < words; ++w) out[w] |= liveIn[s][w];
+            return out;
+        };
+        if (global) {
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (uint32_t b = nb; b-- > 0;) {
+                    Bits live = liveOut(b);
+                    for (uint32_t i = blockStart[b+1]; i-- > blockStart[b];) transfer(i, live);
+                    if (live != liveIn[b]) { liveIn[b] = std::move(live); changed = true; }
+                }
+            }
+        }
+        bool removed = false;
+        for (uint32_t b = 0; b < nb; ++b) {
+            Bits live = liveOut(b);
+            for (uint32_t i = blockStart[b+1]; i-- > blockStart[b];) {
+                const InsnInfo& in = info[i];
+                if (result.action[i] != OptimizedText::Drop && pure(in)) {
+                    bool dead = true, zeroOnly = true;
+                    for (uint8_t k = 0; k < in.defs; ++k) {
+                        uint32_t d = defsOf(in)[k];
+                        if (d != discard) zeroOnly = false;
+                        if (d != discard && testBit(live, d)) dead = false;
+                    }
+                    if (dead) {
+                        result.action[i] = OptimizedText::Drop;
+                        result.replacement.erase(i);
+                        result.operands.erase(i);
+                        ++(zeroOnly ? result.stats.zeroWrites : result.stats.deadStores);
+                        removed = true;
+                        continue;
+                    }
+                }
+                transfer(i, live);
+            }
+        }
+        return removed;
+    }
+
+    // Renders and analyzes every instruction and builds the blocks; false,
+    // with stats.skipped saying why, if some statement could not be analyzed.
+    bool prepare(const AsmDefinition* def, bool localRegs, bool open) {
+        uint32_t n = (uint32_t)prog.text.size();
+        result.action.assign(n, OptimizedText::Keep);
+        info.assign(n, {});
+        if (!n) return true;
+        std::string all;
+        std::vector<uint32_t> at(n + 1);
+        tr.grow();
+        for (uint32_t i = 0; i < n; ++i) {
+            at[i] = (uint32_t)all.size();
+            info[i].ok = tr.translateLine(prog.text[i], all);
+        }
+        at[n] = (uint32_t)all.size();
+        typeName = registerType(def, localRegs);
+        StmtCompiler::typeName(typeName, regType);
+
+        m.abi = syscallABI(def);
+        for (auto& l : prog.labels) {
+            labelAt.emplace(std::string(tr.labelOperand(l.name)), l.at);
+            symbols.emplace(std::string(prog.name(l.name)), tr.textBase + 4ull * l.at);
+        }
+        discard = m.reg("_discard");
+        try {
+            for (uint32_t i = 0; i < n; ++i) {
+                if (!info[i].ok) continue;
+                const Insn& insn = prog.text[i];
+                info[i].fx = (tr.find(insn.op)->flags & TmplUsesPC) ? FxNoFold : 0;
+                analyze(i, all.substr(at[i], at[i+1] - at[i]));
+            }
+        } catch (const std::runtime_error& e) {
+            result.stats.skipped = e.what();
+            return false;
+        }
+        local.resize(regs(), 0);
+        indirect = open;
+        buildBlocks();
+        return true;
+    }
+
+    OptimizedText run(const AsmDefinition* def, bool localRegs, bool open) {
+        if (!prepare(def, localRegs, open)) {
+            OptimizedText untouched;
+            untouched.action.assign(prog.text.size(), OptimizedText::Keep);
+            untouched.stats.skipped = result.stats.skipped;
+            return untouched;
+        }
+        if (prog.text.empty()) return std::move(result);
+        propagate();
+        while (eliminate()) {}
+        return std::move(result);
+    }
+};
+
+} // namespace opt
+
+inline OptimizedText optimizeText(const Program& prog, Translator& tr, const AsmDefinition* def, bool localRegs, bool open = false) {
+    opt::Optimizer o(prog, tr);
+    return o.run(def, localRegs, open);
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+// Child processes without a shell. runCommands keeps up to `jobs` children
+// alive and reports each exit status as it is reaped (and, if asked, each
+// start); on Windows it falls back to running them one after another
+// through system(). runCommandCounting drains the child's stdout through a
+// pipe and counts it; runForkCounting does that for a function of ours.
+
+using Command = std::vector<std::string>;
+
+inline std::string quoteCommand(const Command& cmd) {
+    std::string s;
+    for (auto& a : cmd) {
+        if (!s.empty()) s += ' ';
+        s += '"'; s += a; s += '"';
+    }
+    return s;
+}
+
+#ifndef _WIN32
+inline pid_t spawnCommand(const Command& cmd, const posix_spawn_file_actions_t* actions = nullptr) {
+    std::vector<char*> argv;
+    for (auto& a : cmd) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], actions, nullptr, argv.data(), environ) != 0) return -1;
+    return pid;
+}
+
+inline int exitCode(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+// Reaps pid; 127 if it cannot be waited for (ECHILD when SIGCHLD is ignored).
+inline int waitChild(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR) return 127;
+    return exitCode(status);
+}
+#endif
+
+// Runs cmd and waits for it; 127 if it could not be started.
+inline int runCommand(const Command& cmd) {
+#ifdef _WIN32
+    return std::system(quoteCommand(cmd).c_str());
+#else
+    pid_t pid = spawnCommand(cmd);
+    if (pid < 0) return 127;
+    return waitChild(pid);
+#endif
+}
+
+#ifndef _WIN32
+// Reads the child's end of the pipe dry, then reaps the child.
+inline int drainChild(pid_t pid, int fd, uint64_t& bytes, std::string* keep) {
+    std::vector<char> buf(1 << 16);
+    for (;;) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        bytes += (uint64_t)n;
+        if (keep) keep->append(buf.data(), (size_t)n);
+    }
+    close(fd);
+    return waitChild(pid);
+}
+#endif
+
+// Like runCommand; bytes gets how much the child wrote to stdout, which goes
+// nowhere else (but into keep, if given). On Windows the output is not
+// captured and bytes stays 0.
+inline int runCommandCounting(const Command& cmd, uint64_t& bytes, std::string* keep = nullptr) {
+    bytes = 0;
+#ifdef _WIN32
+    return runCommand(cmd);
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return 127;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    pid_t pid = spawnCommand(cmd, &actions);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (pid < 0) { close(fds[0]); return 127; }
+    return drainChild(pid, fds[0], bytes, keep);
+#endif
+}
+
+// The same for code of our own: body runs in a forked child whose stdout is
+// the pipe, and its result is the exit status. On Windows it runs in place.
+inline int runForkCounting(const std::function<int()>& body, uint64_t& bytes, std::string* keep = nullptr) {
+    bytes = 0;
+#ifdef _WIN32
+    return body();
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return 127;
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], 1);
+        close(fds[1]);
+        int status = body();
+        std::fflush(stdout);
+        _exit(status);
+    }
+    close(fds[1]);
+    if (pid < 0) { close(fds[0]); return 127; }
+    return drainChild(pid, fds[0], bytes, keep);
+#endif
+}
+
+inline void runCommands(const std::vector<Command>& cmds, unsigned jobs, const std::function<void(size_t, int)>& done,
+                        const std::function<void(size_t)>& started = {}) {
+#ifdef _WIN32
+    for (size_t i=0; i<cmds.size(); ++i) {
+        if (started) started(i);
+        done(i, runCommand(cmds[i]));
+    }
+#else
+    if (jobs == 0) jobs = 1;
+    std::vector<std::pair<pid_t, size_t>> running;
+    size_t next = 0;
+    while (next < cmds.size() || !running.empty()) {
+        while (next < cmds.size() && running.size() < jobs) {
+            if (started) started(next);
+            pid_t pid = spawnCommand(cmds[next]);
+            if (pid < 0) done(next, 127);
+            else running.push_back({pid, next});
+            ++next;
+        }
+        if (running.empty()) continue;
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            for (auto& child : running) done(child.second, 127);
+            running.clear();
+            continue;
+        }
+        for (size_t k=0; k<running.size(); ++k) {
+            if (running[k].first != pid) continue;
+            size_t i = running[k].second;
+            running[k] = running.back();
+            running.pop_back();
+            done(i, exitCode(status));
+            break;
+        }
+    }
+#endif
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The front end scans the source once into a Program (the streaming emitter
+// scans it twice and never keeps the instructions). Every view in here points
+// into the source text, so the text has to outlive the Program.
+// Instructions, labels and data live in flat vectors and refer to names by
+// interned Sym ids, so later phases compare and look up integers.
+
+using Sym = uint32_t;   // 0 is the empty symbol
+
+enum SymFlag : uint8_t {
+    SymDataLabel = 1,
+    SymTextLabel = 2,
+    SymOpcode    = 4,
+    SymOperand   = 8,       // appears as some instruction's operand
+    SymGlobal    = 16,      // named in .globl/.global/.extern
+    SymImport    = 32,      // defined by another file of a multi-file program
+};
+
+struct SymbolPool {
+    std::vector<std::string_view> names{std::string_view()};
+    std::vector<uint32_t> uses{0};
+    std::vector<uint8_t> flags{0};
+    std::unordered_map<std::string_view, Sym> index;
+
+    Sym intern(std::string_view s) {
+        if (s.empty()) return 0;
+        auto [it, fresh] = index.try_emplace(s, (Sym)names.size());
+        if (fresh) { names.push_back(s); uses.push_back(0); flags.push_back(0); }
+        return it->second;
+    }
+    std::string_view operator[](Sym s) const { return names[s]; }
+    size_t size() const { return names.size(); }
+    bool isLabel(Sym s) const { return flags[s] & (SymDataLabel | SymTextLabel); }
+};
+
+struct Insn      { Sym op, a, b, c; uint32_t line; };
+struct TextLabel { Sym name; uint32_t at, line; };        // at = index of the next Insn
+struct DataDecl  { Sym name; std::string_view directive, value; uint32_t line; };
+
+struct Program {
+    std::string_view src;
+    SymbolPool syms;
+    std::vector<Insn> text;
+    std::vector<TextLabel> labels;
+    std::vector<DataDecl> data;
+    std::vector<std::pair<std::string_view, uint32_t>> includes;   // .include paths and their lines
+    std::string_view archHint;
+    std::string dir;                    // of the source file; .incbin paths are relative to it
+    uint32_t lines = 0;
+
+    std::string_view name(Sym s) const { return syms[s]; }
+};
+
+static inline bool isBlankChar(char c){ return c==' ' || c=='\t' || c=='\r'; }
+
+static inline std::string_view trimView(std::string_view s) {
+    size_t a = 0, b = s.size();
+    while (a<b && isBlankChar(s[a])) ++a;
+    while (b>a && isBlankChar(s[b-1])) --b;
+    return s.substr(a, b-a);
+}
+
+// Index of the first '"', '#' or ';' in s at or after i, else s.size().
+// Sixteen bytes per step with SSE2; most lines hold none of the three.
+static inline size_t findCommentOrQuote(std::string_view s, size_t i) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"'), hash = _mm_set1_epi8('#'), semi = _mm_set1_epi8(';');
+    for (; i + 16 <= s.size(); i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s.data() + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_or_si128(_mm_cmpeq_epi8(v, hash), _mm_cmpeq_epi8(v, semi)));
+        if (int m = _mm_movemask_epi8(hit)) return i + __builtin_ctz(m);
+    }
+#endif
+    for (; i<s.size(); ++i)
+        if (s[i]=='"' || s[i]=='#' || s[i]==';') return i;
+    return s.size();
+}
+
+// Cuts a trailing '#' or ';' comment, ignoring those inside string literals.
+static inline std::string_view stripComment(std::string_view s) {
+    bool quoted = false;
+    for (size_t i = findCommentOrQuote(s, 0); i<s.size(); i = findCommentOrQuote(s, i+1)) {
+        if (s[i]=='"') { if (i==0 || s[i-1]!='\\') quoted = !quoted; }
+        else if (!quoted) return trimView(s.substr(0, i));
+    }
+    return s;
+}
+
+// Next operand token; operands are separated by blanks and/or commas.
+static inline std::string_view nextToken(std::string_view s, size_t& i) {
+    while (i<s.size() && (isBlankChar(s[i]) || s[i]==',')) ++i;
+    size_t a = i;
+    while (i<s.size() && !isBlankChar(s[i]) && s[i]!=',') ++i;
+    return s.substr(a, i-a);
+}
+
+static inline std::string_view parseArchHint(std::string_view line) {
+    if (line.substr(0, 2) != ";!") return {};
+    size_t b = line.find("!;", 2);
+    if (b == std::string_view::npos) return {};
+    return trimView(line.substr(2, b-2));
+}
+
+// Feeds source text to a Program a batch of whole lines at a time, so a large
+// file can be lexed window by window. Instructions go to a callback:
+// lexProgram keeps them in Program::text, the streaming emitter translates
+// each one and forgets it. With collect off (a second pass over source the
+// Program has already seen) labels, data and use counts are left alone.
+struct Lexer {
+    Program& p;
+    bool collect = true;
+    enum { None, Data, Text } section = None;
+    bool first = true;
+    uint32_t lines = 0, insns = 0;
+
+    explicit Lexer(Program& prog, bool collecting = true) : p(prog), collect(collecting) {}
+
+    template<class OnInsn>
+    void feed(std::string_view src, OnInsn&& onInsn) {
+        const char* base = src.data();
+        size_t pos = 0, n = src.size();
+        while (pos < n) {
+            const char* nl = (const char*)std::memchr(base + pos, '\n', n - pos);
+            size_t end = nl ? (size_t)(nl - base) : n;
+            std::string_view line = trimView(src.substr(pos, end - pos));
+            pos = end + 1;
+            uint32_t lineNo = ++lines;
+            if (line.empty()) continue;
+            if (first) { first = false; if (collect) p.archHint = parseArchHint(line); }
+            line = stripComment(line);
+            if (line.empty()) continue;
+
+            size_t i = 0;
+            std::string_view op = nextToken(line, i);
+            if (op == ".data") { section = Data; continue; }
+            if (op == ".text") { section = Text; continue; }
+            if (op == ".section") {
+                std::string_view which = nextToken(line, i);
+                if (which.find(".text") != std::string_view::npos) { section = Text; continue; }
+                if (which.find(".data") != std::string_view::npos) { section = Data; continue; }
+            }
+            if (op == ".globl" || op == ".global" || op == ".extern") {
+                if (collect)
+                    for (std::string_view s; !(s = nextToken(line, i)).empty();) p.syms.flags[p.syms.intern(s)] |= SymGlobal;
+                continue;
+            }
+            if (op == ".include") {
+                std::string_view path = trimView(line.substr(i));
+                if (path.size() >= 2 && path.front() == '"' && path.back() == '"') path = path.substr(1, path.size() - 2);
+                if (collect && !path.empty()) p.includes.emplace_back(path, lineNo);
+                continue;
+            }
+
+            if (section == Data) {
+                if (!collect) continue;
+                // "name: .directive value", or a directive alone that continues the data before it.
+                size_t colon = line.find(':'), quote = line.find('"');
+                bool labelled = colon != std::string_view::npos && colon < quote
+                    && (op.find(':') != std::string_view::npos || op[0] != '.');
+                Sym name = 0;
+                std::string_view rest = line;
+                if (labelled) {
+                    name = p.syms.intern(trimView(line.substr(0, colon)));
+                    p.syms.flags[name] |= SymDataLabel;
+                    rest = trimView(line.substr(colon+1));
+                } else if (op[0] != '.') continue;
+                size_t j = 0;
+                while (j<rest.size() && !isBlankChar(rest[j])) ++j;
+                p.data.push_back({name, rest.substr(0, j), trimView(rest.substr(j)), lineNo});
+                continue;
+            }
+            if (section != Text) continue;
+
+            if (op.size() > 1 && op.back() == ':') {
+                if (collect) {
+                    Sym name = p.syms.intern(op.substr(0, op.size()-1));
+                    p.syms.flags[name] |= SymTextLabel;
+                    p.labels.push_back({name, insns, lineNo});
+                }
+                op = nextToken(line, i);
+                if (op.empty()) continue;
+            }
+            Insn in;
+            in.op = p.syms.intern(op);
+            in.a  = p.syms.intern(nextToken(line, i));
+            in.b  = p.syms.intern(nextToken(line, i));
+            in.c  = p.syms.intern(nextToken(line, i));
+            in.line = lineNo;
+            if (collect) {
+                ++p.syms.uses[in.op]; ++p.syms.uses[in.a]; ++p.syms.uses[in.b]; ++p.syms.uses[in.c];
+                p.syms.flags[in.op] |= SymOpcode;
+                p.syms.flags[in.a] |= SymOperand; p.syms.flags[in.b] |= SymOperand; p.syms.flags[in.c] |= SymOperand;
+            }
+            onInsn(in, insns++);
+        }
+        if (collect) p.lines = lines;
+    }
+};
+
+inline Program lexProgram(std::string_view src) {
+    Program p;
+    p.src = src;
+    p.text.reserve(src.size() / 24);
+    Lexer(p).feed(src, [&](const Insn& in, uint32_t){ p.text.push_back(in); });
+    return p;
+}
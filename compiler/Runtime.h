@@ -0,0 +1,609 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "AsmDefinition.h"
+#include "Memory.h"
+#include "Program.h"
+
+// Syscall conventions shared by the emitted C runtime, the interpreter and
+// -native. The service number is in numReg, arguments in argReg[0..2] and a
+// result, if the service has one, goes to retReg; every other service leaves
+// retReg alone. Numbers follow SPIM for MIPS and RARS plus the Linux calls
+// for RISC-V. Register names are the sanitized C names the emitter declares.
+enum class SysService : uint8_t {
+    PrintInt, PrintString, PrintChar, ReadInt, ReadString, ReadChar,
+    Read, Write, Sbrk, Brk, Mmap, Exit, ExitWith,
+};
+
+struct SysNumber { int num; SysService service; };
+
+struct SyscallABI {
+    std::string_view numReg, argReg[3], retReg;
+    const SysNumber* numbers = nullptr;
+    size_t count = 0;
+
+    // -1 for a number the convention does not know.
+    int service(int64_t num) const {
+        for (size_t k = 0; k < count; ++k)
+            if (numbers[k].num == num) return (int)numbers[k].service;
+        return -1;
+    }
+    bool has(SysService s) const {
+        for (size_t k = 0; k < count; ++k)
+            if (numbers[k].service == s) return true;
+        return false;
+    }
+};
+
+inline SyscallABI syscallABI(const AsmDefinition* def) {
+    using S = SysService;
+    static const SysNumber mips[] = {
+        {1, S::PrintInt}, {4, S::PrintString}, {5, S::ReadInt}, {8, S::ReadString}, {9, S::Sbrk},
+        {10, S::Exit}, {11, S::PrintChar}, {12, S::ReadChar}, {14, S::Read}, {15, S::Write}, {17, S::ExitWith},
+    };
+    static const SysNumber riscv[] = {
+        {1, S::PrintInt}, {4, S::PrintString}, {5, S::ReadInt}, {8, S::ReadString}, {9, S::Sbrk},
+        {10, S::Exit}, {11, S::PrintChar}, {12, S::ReadChar}, {63, S::Read}, {64, S::Write},
+        {93, S::ExitWith}, {94, S::ExitWith}, {214, S::Brk}, {222, S::Mmap},
+    };
+    std::string gt(def->GT);
+    std::transform(gt.begin(), gt.end(), gt.begin(), [](unsigned char c){ return std::tolower(c); });
+    if (gt.find("mips") != std::string::npos) return {"_v0", {"_a0", "_a1", "_a2"}, "_v0", mips, std::size(mips)};
+    return {"a7", {"a0", "a1", "a2"}, "a0", riscv, std::size(riscv)};
+}
+
+// system_call() is a macro that hands the syscall registers to ezm_syscall,
+// which only the unit holding main defines. Output goes through stdout with a
+// large buffer when it is not a terminal, so it leaves in big write(2)s and
+// at exit; the fault paths flush it before they report. Input is read(2) into
+// a buffer of our own, flushing stdout first so prompts show. With harts the
+// services run one at a time under sys_lock.
+inline void emitRuntime(std::ostream& out, const SyscallABI& abi, bool owner, uint64_t heapBase, uint64_t memSize, unsigned xlen, bool harts = false) {
+    out << "\nint64_t ezm_syscall(int64_t num, int64_t a0, int64_t a1, int64_t a2, int64_t ret);\n"
+        << "#define system_call() (" << abi.retReg << " = ezm_syscall(" << abi.numReg << ", " << abi.argReg[0]
+        << ", " << abi.argReg[1] << ", " << abi.argReg[2] << ", " << abi.retReg << "))\n";
+    if (!owner) { out << "\n"; return; }
+    out << "#define HEAP_BASE " << heapBase << "ull\n"
+        << "#define HEAP_LIMIT " << DataImage::heapLimit(memSize) << "ull\n";
+    if (xlen < 64) out << "#define GUEST_INT(v) ((int64_t)(int32_t)(v))\n";
+    else out << "#define GUEST_INT(v) ((int64_t)(v))\n";
+    out << R"(
+static char sys_out[1 << 20];
+static struct { uint8_t buf[1 << 16]; size_t at, end; } sys_in;
+static uint64_t sys_brk = HEAP_BASE;
+
+static void io_init(void) {
+    if (!isatty(1)) setvbuf(stdout, sys_out, _IOFBF, sizeof sys_out);
+}
+
+static uint8_t* sys_span(int64_t a, uint64_t n) {
+    uint64_t at = GUEST_ADDR(a);
+    if (n > MEM_SIZE || at > MEM_SIZE - n) mem_fault(at);
+    return mem + at;
+}
+
+static void sys_print_int(int64_t v) {
+    char t[24], *p = t + sizeof t;
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    do *--p = (char)('0' + u % 10); while (u /= 10);
+    if (v < 0) *--p = '-';
+    fwrite(p, 1, (size_t)(t + sizeof t - p), stdout);
+}
+
+static void sys_print_string(int64_t a) {
+    uint64_t at = GUEST_ADDR(a);
+    const uint8_t* nul;
+    if (at >= MEM_SIZE) mem_fault(at);
+    nul = (const uint8_t*)memchr(mem + at, 0, MEM_SIZE - at);
+    fwrite(mem + at, 1, nul ? (size_t)(nul - (mem + at)) : (size_t)(MEM_SIZE - at), stdout);
+}
+
+static int sys_getc(void) {
+    if (sys_in.at == sys_in.end) {
+        ssize_t n;
+        fflush(stdout);
+        n = read(0, sys_in.buf, sizeof sys_in.buf);
+        if (n <= 0) return -1;
+        sys_in.at = 0;
+        sys_in.end = (size_t)n;
+    }
+    return sys_in.buf[sys_in.at++];
+}
+
+/* Skips blank space, reads an optionally signed decimal and drops the rest of its line. */
+static int64_t sys_read_int(void) {
+    uint64_t v = 0;
+    int c, neg = 0;
+    do c = sys_getc(); while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    if (c == '-' || c == '+') { neg = c == '-'; c = sys_getc(); }
+    for (; c >= '0' && c <= '9'; c = sys_getc()) v = v * 10 + (uint64_t)(c - '0');
+    while (c != '\n' && c != -1) c = sys_getc();
+    return neg ? (int64_t)(0 - v) : (int64_t)v;
+}
+
+/* Like fgets: at most n - 1 bytes, up to and including a newline, then a NUL. */
+static void sys_read_string(int64_t a, int64_t n) {
+    uint8_t* p;
+    int64_t k = 0;
+    int c;
+    if (n < 1) return;
+    p = sys_span(a, (uint64_t)n);
+    while (k < n - 1 && (c = sys_getc()) != -1) {
+        p[k++] = (uint8_t)c;
+        if (c == '\n') break;
+    }
+    p[k] = 0;
+}
+
+static int64_t sys_read(int64_t fd, int64_t a, int64_t n) {
+    uint64_t len = GUEST_ADDR(n);
+    uint8_t* p = sys_span(a, len);
+    ssize_t got;
+    if (fd == 0 && sys_in.at < sys_in.end) {
+        size_t k = sys_in.end - sys_in.at < len ? sys_in.end - sys_in.at : (size_t)len;
+        memcpy(p, sys_in.buf + sys_in.at, k);
+        sys_in.at += k;
+        return (int64_t)k;
+    }
+    fflush(stdout);
+    got = read((int)fd, p, (size_t)len);
+    return got < 0 ? -1 : (int64_t)got;
+}
+
+static int64_t sys_write(int64_t fd, int64_t a, int64_t n) {
+    uint64_t len = GUEST_ADDR(n);
+    uint8_t* p = sys_span(a, len);
+    ssize_t put;
+    if (fd == 1) {
+        fwrite(p, 1, (size_t)len, stdout);
+        return (int64_t)len;
+    }
+    fflush(stdout);
+    put = write((int)fd, p, (size_t)len);
+    return put < 0 ? -1 : (int64_t)put;
+}
+
+static int64_t sys_sbrk(int64_t n) {
+    uint64_t old = sys_brk, to = old + (uint64_t)n;
+    if (to < HEAP_BASE || to > HEAP_LIMIT) return -1;
+    sys_brk = to;
+    return (int64_t)old;
+}
+)";
+    if (abi.has(SysService::Brk))
+        out << R"(
+static int64_t sys_set_brk(int64_t a) {
+    uint64_t to = GUEST_ADDR(a);
+    if (to >= HEAP_BASE && to <= HEAP_LIMIT) sys_brk = to;
+    return (int64_t)sys_brk;
+}
+)";
+    if (abi.has(SysService::Mmap))
+        out << R"(
+/* Whole zeroed pages from the heap; the address hint is ignored. */
+static int64_t sys_mmap(int64_t n) {
+    uint64_t len = GUEST_ADDR(n), at = (sys_brk + 4095) & ~4095ull;
+    if (!len || len > HEAP_LIMIT) return -1;
+    len = (len + 4095) & ~4095ull;
+    if (at + len > HEAP_LIMIT) return -1;
+    memset(mem + at, 0, (size_t)len);
+    sys_brk = at + len;
+    return (int64_t)at;
+}
+)";
+    out << (harts ? "\nstatic int64_t sys_call(" : "\nint64_t ezm_syscall(")
+        << "int64_t num, int64_t a0, int64_t a1, int64_t a2, int64_t ret) {\n    switch (num) {\n";
+    static const char* const body[] = {
+        "sys_print_int(GUEST_INT(a0)); break;",
+        "sys_print_string(a0); break;",
+        "putc((int)(uint8_t)a0, stdout); break;",
+        "return GUEST_INT(sys_read_int());",
+        "sys_read_string(a0, GUEST_INT(a1)); break;",
+        "return sys_getc();",
+        "return GUEST_INT(sys_read(GUEST_INT(a0), a1, a2));",
+        "return GUEST_INT(sys_write(GUEST_INT(a0), a1, a2));",
+        "return GUEST_INT(sys_sbrk(GUEST_INT(a0)));",
+        "return GUEST_INT(sys_set_brk(a0));",
+        "return GUEST_INT(sys_mmap(a1));",
+        "exit(0);",
+        "exit((int)a0);",
+    };
+    for (size_t k = 0; k < abi.count; ++k)
+        out << "        case " << abi.numbers[k].num << ": " << body[(int)abi.numbers[k].service] << "\n";
+    out << "        default: printf(\"[unknown syscall %d]\\n\", (int)num); break;\n"
+        << "    }\n"
+        << "    return ret;\n}\n\n";
+    if (harts)
+        out << R"(static pthread_mutex_t sys_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int64_t ezm_syscall(int64_t num, int64_t a0, int64_t a1, int64_t a2, int64_t ret) {
+    pthread_mutex_lock(&sys_lock);
+    ret = sys_call(num, a0, a1, a2, ret);
+    pthread_mutex_unlock(&sys_lock);
+    return ret;
+}
+
+)";
+}
+
+// The A extension's helpers over guest memory (after emitMemory). Every
+// access is a sequentially consistent C11 atomic on a naturally aligned word;
+// a misaligned one faults like an access out of bounds. A hart's reservation
+// remembers the address and the value its lr read, and sc stores only if the
+// word still holds that value (so an ABA change goes unnoticed, as with a
+// compare-and-swap). amo_fence orders plain accesses too.
+inline void emitAtomics(std::ostream& out) {
+    out << R"(static _Thread_local struct { uint64_t at, v; unsigned n; } amo_resv;
+
+static inline void* amo_at(uint64_t a, unsigned n) {
+    if (GUEST_ADDR(a) & (n - 1)) {
+        fflush(stdout);
+        fprintf(stderr, "misaligned atomic access at 0x%llx\n", (unsigned long long)GUEST_ADDR(a));
+        exit(1);
+    }
+    return MEM_AT(a, n);
+}
+static inline void amo_fence(void) { atomic_thread_fence(memory_order_seq_cst); }
+)";
+    static const std::pair<const char*, const char*> rmw[] = {
+        {"swap", "atomic_exchange"}, {"add", "atomic_fetch_add"}, {"xor", "atomic_fetch_xor"},
+        {"and", "atomic_fetch_and"}, {"or", "atomic_fetch_or"},
+    };
+    for (int bits : {32, 64}) {
+        std::string w = std::to_string(bits), u = "uint" + w + "_t", i = "int" + w + "_t", n = std::to_string(bits / 8);
+        std::string p = "(_Atomic " + u + "*)amo_at(a, " + n + ")";
+        out << "\nstatic inline " << i << " amo_lr_" << w << "(uint64_t a) {\n"
+            << "    " << u << " v = atomic_load(" << p << ");\n"
+            << "    amo_resv.at = GUEST_ADDR(a); amo_resv.v = v; amo_resv.n = " << n << ";\n"
+            << "    return (" << i << ")v;\n}\n"
+            << "static inline int amo_sc_" << w << "(uint64_t a, " << u << " v) {\n"
+            << "    " << u << " seen = (" << u << ")amo_resv.v;\n"
+            << "    int held = amo_resv.n == " << n << " && amo_resv.at == GUEST_ADDR(a);\n"
+            << "    amo_resv.n = 0;\n"
+            << "    return !(held && atomic_compare_exchange_strong(" << p << ", &seen, v));\n}\n";
+        for (auto& [op, fn] : rmw)
+            out << "static inline " << i << " amo_" << op << "_" << w << "(uint64_t a, " << u << " v) { return ("
+                << i << ")" << fn << "(" << p << ", v); }\n";
+        // min/max: retry until the word is already at least as small (large) or the swap lands
+        for (const char* op : {"min", "max", "minu", "maxu"}) {
+            std::string t = op[3] == 'u' ? u : i;
+            const char* cmp = op[1] == 'i' ? "<" : ">";
+            out << "static inline " << i << " amo_" << op << "_" << w << "(uint64_t a, " << u << " v) {\n"
+                << "    _Atomic " << u << "* p = " << p << ";\n"
+                << "    " << u << " old = atomic_load(p);\n"
+                << "    while ((" << t << ")v " << cmp << " (" << t << ")old && !atomic_compare_exchange_weak(p, &old, v)) {}\n"
+                << "    return (" << i << ")old;\n}\n";
+        }
+    }
+    out << "\n";
+}
+
+// Harts: main's body becomes hart_main, which every hart runs from the first
+// instruction on a thread of its own, hart 0 on the main thread. HARTS (a
+// -D flag, -harts) sets how many, $EZM_HARTS overrides it when the program
+// starts. Each stack is an equal share of the top eighth of guest memory.
+inline void emitHarts(std::ostream& out) {
+    out << R"(#ifndef HARTS
+#define HARTS 1
+#endif
+static long ezm_harts = HARTS;
+static void* hart_main(void* hart_arg);
+
+static inline uint64_t hart_stack(intptr_t k) {
+    return (MEM_SIZE - (uint64_t)k * (MEM_SIZE / 8 / (uint64_t)ezm_harts)) & ~15ull;
+}
+
+static void harts_run(void) {
+    const char* env = getenv("EZM_HARTS");
+    pthread_t* t;
+    long k;
+    if (env && *env) ezm_harts = strtol(env, NULL, 10);
+    if (ezm_harts < 1 || ezm_harts > 4096) {
+        fprintf(stderr, "bad hart count %ld\n", ezm_harts);
+        exit(1);
+    }
+    t = (pthread_t*)calloc((size_t)ezm_harts, sizeof *t);
+    for (k = 1; k < ezm_harts; ++k)
+        if (!t || pthread_create(&t[k], NULL, hart_main, (void*)(intptr_t)k) != 0) {
+            fprintf(stderr, "cannot start hart %ld\n", k);
+            exit(1);
+        }
+    hart_main(NULL);
+    for (k = 1; k < ezm_harts; ++k) pthread_join(t[k], NULL);
+    free(t);
+}
+
+)";
+}
+
+// Templates that assign PC are followed by "goto _dispatch;". The dispatch
+// block at the end of main turns PC into an instruction index and jumps
+// through a dense table with one slot per instruction; only text labels and
+// return sites have a C label to land on, every other slot is a fault.
+inline void emitDispatch(std::ostream& out, const std::vector<std::pair<uint32_t, std::string>>& targets, size_t slots, unsigned xlen) {
+    out << "_dispatch: {\n"
+        << "    static const void* const _targets[" << slots << "] = {";
+    for (size_t k=0, n=0; k<targets.size(); ++k) {
+        if (k && targets[k].first == targets[k-1].first) continue;   // several labels on one instruction
+        if (n++ % 4 == 0) out << "\n       ";
+        out << " [" << targets[k].first << "] = &&" << targets[k].second << ",";
+    }
+    out << "\n    };\n"
+        << "    uint64_t _at = " << (xlen < 64 ? "(uint64_t)(uint32_t)PC" : "(uint64_t)PC") << " - " << TextBase << "ull;\n"
+        << "    if ((_at & 3) || (_at >> 2) >= " << slots << " || !_targets[_at >> 2]) {\n"
+        << "        fflush(stdout);\n"
+        << "        fprintf(stderr, \"jump to non-instruction address 0x%llx\\n\", (unsigned long long)(_at + " << TextBase << "ull));\n"
+        << "        exit(1);\n"
+        << "    }\n"
+        << "    goto *(void*)_targets[_at >> 2];\n"
+        << "}\n";
+}
+
+// Initialized data goes into the C as one string literal, which gcc reads far
+// faster than a list of numbers; reservations never appear at all. An
+// .incbin file is not turned into C either: the assembler pulls it in, and a
+// comment with its size and modification time keeps the build cache honest.
+inline void emitDataImage(std::ostream& out, const DataImage& img) {
+    namespace fs = std::filesystem;
+    if (!img.bytes.empty()) {
+        out << "static const uint8_t data_image[" << img.bytes.size() << "] =";
+        std::string line = "\n    \"";
+        for (uint8_t c : img.bytes) {
+            if (c >= 32 && c < 127 && c != '"' && c != '\\' && c != '?') line += (char)c;
+            else {
+                char esc[8];
+                std::snprintf(esc, sizeof esc, "\\%03o", c);
+                line += esc;
+            }
+            if (line.size() >= 100) { out << line << '"'; line = "\n    \""; }
+        }
+        if (line.size() > 6) out << line << '"';
+        out << ";\n";
+    }
+    auto quote = [](const std::string& s) {
+        std::string q;
+        for (char c : s) { if (c == '"' || c == '\\') q += '\\'; q += c; }
+        return q;
+    };
+    for (size_t k = 0; k < img.pieces.size(); ++k) {
+        const DataPiece& piece = img.pieces[k];
+        if (piece.file.empty()) continue;
+        std::error_code ec;
+        fs::path path = fs::absolute(piece.file, ec);
+        auto stamp = fs::last_write_time(path, ec).time_since_epoch().count();
+        std::string blob = "ezm_blob_" + std::to_string(k);
+        std::string incbin = ".incbin \"" + quote(path.string()) + "\", " + std::to_string(piece.from) + ", " + std::to_string(piece.size);
+        out << "/* " << piece.file << ": " << fs::file_size(path, ec) << " bytes, modified " << stamp << " */\n"
+            << "__asm__(\".pushsection .rodata\\n.balign 8\\n" << blob << ":\\n" << quote(incbin) << "\\n.popsection\");\n"
+            << "extern const uint8_t " << blob << "[] __asm__(\"" << blob << "\");\n";
+    }
+}
+
+inline void emitDataCopy(std::ostream& out, const DataImage& img) {
+    for (size_t k = 0; k < img.pieces.size(); ++k) {
+        const DataPiece& piece = img.pieces[k];
+        out << "    memcpy(mem + DATA_BASE + " << piece.at << "ull, ";
+        if (piece.file.empty()) out << "data_image + " << piece.from;
+        else out << "ezm_blob_" << k;
+        out << ", " << piece.size << "ull);\n";
+    }
+}
+
+// Guest memory for the emitted program (see Memory.h). On POSIX the space is
+// reserved with mmap and only [0, MEM_SIZE) is made accessible, so untouched
+// pages cost nothing and accesses past the end land on PROT_NONE guard pages.
+// A 32-bit guest reserves its whole 4 GiB address space, which makes every
+// access safe without a compare; 64-bit guests compare against MEM_SIZE.
+// -DMEM_NO_GUARD (and Windows) falls back to calloc plus the compare.
+// Only the owning translation unit defines mem, the data image and
+// mem_init; the other chunks of a split program declare mem.
+inline void emitMemory(std::ostream& out, const DataImage& img, uint64_t memSize, unsigned xlen, bool owner = true) {
+    out << "#define MEM_SIZE " << memSize << "ull\n"
+        << "#define DATA_BASE " << DataBase << "ull\n";
+    if (xlen < 64) out << "#define GUEST_ADDR(a) ((uint64_t)(uint32_t)(a))\n";
+    else out << "#define GUEST_ADDR(a) ((uint64_t)(a))\n";
+    out << R"(#define MEM_GUARD 65536ull
+#if !defined(_WIN32) && !defined(MEM_NO_GUARD)
+#include <signal.h>
+#include <sys/mman.h>
+#define MEM_MAPPED 1
+#endif
+)";
+    if (xlen < 64)
+        out << "#define MEM_SPAN (0x100000000ull + MEM_GUARD)\n"
+            << "#ifdef MEM_MAPPED\n#define MEM_AT(a, n) (mem + GUEST_ADDR(a))\n#endif\n";
+    else
+        out << "#define MEM_SPAN (MEM_SIZE + MEM_GUARD)\n";
+    out << R"(#ifndef MEM_AT
+#define MEM_AT(a, n) (GUEST_ADDR(a) <= MEM_SIZE - (n) ? mem + GUEST_ADDR(a) : mem_fault(GUEST_ADDR(a)))
+#endif
+)";
+    out << (owner ? "uint8_t* mem;\n" : "extern uint8_t* mem;\n");
+    out << R"(
+static uint8_t* mem_fault(uint64_t a) {
+    fflush(stdout);
+    fprintf(stderr, "memory access out of bounds at 0x%llx\n", (unsigned long long)a);
+    exit(1);
+}
+)";
+    if (owner) {
+        emitDataImage(out, img);
+        out << R"(#ifdef MEM_MAPPED
+static void mem_segv(int sig, siginfo_t* si, void* ctx) {
+    uint8_t* p = (uint8_t*)si->si_addr;
+    (void)ctx;
+    if (p >= mem && p < mem + MEM_SPAN) mem_fault((uint64_t)(p - mem));
+    signal(sig, SIG_DFL);
+}
+static void mem_init(void) {
+    void* p = mmap(NULL, MEM_SPAN, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED || mprotect(p, MEM_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "cannot map %llu bytes of guest memory\n", (unsigned long long)MEM_SIZE);
+        exit(1);
+    }
+    mem = (uint8_t*)p;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = mem_segv;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+)";
+        emitDataCopy(out, img);
+        out << R"(}
+#else
+static void mem_init(void) {
+    mem = (uint8_t*)calloc(MEM_SIZE, 1);
+    if (!mem) {
+        fprintf(stderr, "cannot allocate %llu bytes of guest memory\n", (unsigned long long)MEM_SIZE);
+        exit(1);
+    }
+)";
+        emitDataCopy(out, img);
+        out << "}\n#endif\n";
+    }
+    out << R"(
+static inline int8_t   load_i8(uint64_t a)  { int8_t v;   memcpy(&v, MEM_AT(a, 1), 1); return v; }
+static inline uint8_t  load_u8(uint64_t a)  { uint8_t v;  memcpy(&v, MEM_AT(a, 1), 1); return v; }
+static inline int16_t  load_i16(uint64_t a) { int16_t v;  memcpy(&v, MEM_AT(a, 2), 2); return v; }
+static inline uint16_t load_u16(uint64_t a) { uint16_t v; memcpy(&v, MEM_AT(a, 2), 2); return v; }
+static inline int32_t  load_i32(uint64_t a) { int32_t v;  memcpy(&v, MEM_AT(a, 4), 4); return v; }
+static inline uint32_t load_u32(uint64_t a) { uint32_t v; memcpy(&v, MEM_AT(a, 4), 4); return v; }
+static inline int64_t  load_i64(uint64_t a) { int64_t v;  memcpy(&v, MEM_AT(a, 8), 8); return v; }
+static inline void store_8(uint64_t a, uint8_t v)   { memcpy(MEM_AT(a, 1), &v, 1); }
+static inline void store_16(uint64_t a, uint16_t v) { memcpy(MEM_AT(a, 2), &v, 2); }
+static inline void store_32(uint64_t a, uint32_t v) { memcpy(MEM_AT(a, 4), &v, 4); }
+static inline void store_64(uint64_t a, uint64_t v) { memcpy(MEM_AT(a, 8), &v, 8); }
+
+)";
+}
+
+// -profile: one counter per basic block, bumped where the block starts. Blocks
+// start at text labels, at return sites and after jumps and branches, so
+// every instruction in a block runs as often as the block is entered. With
+// branch counts each conditional branch also counts its fall-throughs, and
+// taken is the block's count minus those. prof_report runs at exit and
+// writes the hottest source lines, blocks and branches to stderr, or to the
+// file $EZM_PROFILE names.
+struct Profile {
+    bool branches = false;
+    std::vector<uint32_t> blockStart;      // first instruction of each block, ascending
+    std::vector<uint32_t> branchAt;        // instruction of each counted branch
+    std::vector<uint32_t> branchBlock;     // and the block it ends
+};
+
+inline std::string cStringLiteral(std::string_view v) {
+    std::string out = "\"";
+    for (unsigned char c : v) {
+        if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+        else if (c < 32 || c > 126) { char esc[8]; std::snprintf(esc, sizeof esc, "\\%03o", c); out += esc; }
+        else out += (char)c;
+    }
+    return out + "\"";
+}
+
+// Declares the counters; shared (split programs) makes them visible to every unit.
+inline void emitProfileCounters(std::ostream& out, const Profile& p, bool owner, bool shared) {
+    const char* storage = !owner ? "extern " : shared ? "" : "static ";
+    out << storage << "uint64_t prof_block[" << std::max<size_t>(1, p.blockStart.size()) << "];\n";
+    if (p.branches) out << storage << "uint64_t prof_fall[" << std::max<size_t>(1, p.branchAt.size()) << "];\n";
+    if (owner) out << "static void prof_report(void);\n";
+    out << "\n";
+}
+
+// The tables prof_report reads and prof_report itself, for the unit holding main.
+inline void emitProfileReport(std::ostream& out, const Profile& p, const Program& prog, uint32_t n) {
+    std::vector<size_t> lineStart{0};
+    for (const char* at = prog.src.data(), *end = at + prog.src.size(); (at = (const char*)std::memchr(at, '\n', end - at)); ++at)
+        lineStart.push_back(at - prog.src.data() + 1);
+    auto source = [&](uint32_t line) {
+        size_t a = lineStart[line - 1], b = line < lineStart.size() ? lineStart[line] : prog.src.size();
+        std::string_view t = prog.src.substr(a, b - a);
+        if (!t.empty() && t.back() == '\n') t.remove_suffix(1);
+        return stripComment(trimView(t));
+    };
+    size_t nb = p.blockStart.size();
+    out << "\n#define PROF_INSNS " << n << "u\n#define PROF_BLOCKS " << nb << "u\n#define PROF_BRANCHES " << p.branchAt.size() << "u\n"
+        << "#define PROF_TOP 20\n";
+    out << "static const uint32_t prof_start[" << nb + 1 << "] = {";
+    for (size_t b = 0; b < nb; ++b) out << (b % 16 ? " " : "\n    ") << p.blockStart[b] << ",";
+    out << " " << n << "\n};\nstatic const uint32_t prof_line[" << std::max<uint32_t>(1, n) << "] = {";
+    for (uint32_t i = 0; i < n; ++i) out << (i % 16 ? " " : "\n    ") << prog.text[i].line << ",";
+    out << "\n};\nstatic const char* const prof_src[" << std::max<uint32_t>(1, n) << "] = {";
+    for (uint32_t i = 0; i < n; ++i) out << "\n    " << cStringLiteral(source(prog.text[i].line)) << ",";
+    out << "\n};\n";
+    if (p.branches) {
+        out << "static const uint32_t prof_branch_at[" << std::max<size_t>(1, p.branchAt.size()) << "] = {";
+        for (size_t k = 0; k < p.branchAt.size(); ++k) out << (k % 16 ? " " : "\n    ") << p.branchAt[k] << ",";
+        out << "\n};\nstatic const uint32_t prof_branch_block[" << std::max<size_t>(1, p.branchAt.size()) << "] = {";
+        for (size_t k = 0; k < p.branchBlock.size(); ++k) out << (k % 16 ? " " : "\n    ") << p.branchBlock[k] << ",";
+        out << "\n};\n";
+    }
+    out << R"(
+/* Indices of the (up to) PROF_TOP largest keys, largest first. */
+static int prof_top(const uint64_t* key, uint32_t count, uint32_t* top) {
+    int n = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!key[i] || (n == PROF_TOP && key[i] <= key[top[n-1]])) continue;
+        int at = n < PROF_TOP ? n++ : n - 1;
+        while (at > 0 && key[top[at-1]] < key[i]) { top[at] = top[at-1]; --at; }
+        top[at] = i;
+    }
+    return n;
+}
+
+static void prof_report(void) {
+    FILE* f = stderr;
+    const char* path = getenv("EZM_PROFILE");
+    if (path && *path && !(f = fopen(path, "w"))) f = stderr;
+    uint64_t* count = (uint64_t*)calloc(PROF_INSNS + PROF_BLOCKS + PROF_BRANCHES + 1, sizeof(uint64_t));
+    uint64_t* weight = count + PROF_INSNS;
+    uint64_t total = 0;
+    uint32_t top[PROF_TOP];
+    int n, k;
+    if (!count) return;
+    for (uint32_t b = 0; b < PROF_BLOCKS; ++b) {
+        weight[b] = prof_block[b] * (prof_start[b+1] - prof_start[b]);
+        total += weight[b];
+        for (uint32_t i = prof_start[b]; i < prof_start[b+1]; ++i) count[i] = prof_block[b];
+    }
+    fflush(stdout);
+    fprintf(f, "\n== ezm profile: %llu instructions executed in %u blocks ==\n", (unsigned long long)total, PROF_BLOCKS);
+    fprintf(f, "hottest lines:\n%14s %6s %6s  %s\n", "count", "%", "line", "source");
+    n = prof_top(count, PROF_INSNS, top);
+    for (k = 0; k < n; ++k)
+        fprintf(f, "%14llu %6.2f %6u  %s\n", (unsigned long long)count[top[k]],
+                total ? 100.0 * count[top[k]] / total : 0.0, prof_line[top[k]], prof_src[top[k]]);
+    fprintf(f, "hottest blocks (by instructions executed):\n%14s %14s %6s  %s\n", "entries", "instructions", "%", "lines");
+    n = prof_top(weight, PROF_BLOCKS, top);
+    for (k = 0; k < n; ++k)
+        fprintf(f, "%14llu %14llu %6.2f  %u-%u\n", (unsigned long long)prof_block[top[k]], (unsigned long long)weight[top[k]],
+                total ? 100.0 * weight[top[k]] / total : 0.0, prof_line[prof_start[top[k]]], prof_line[prof_start[top[k]+1] - 1]);
+)";
+    if (p.branches)
+        out << R"(    {
+        uint64_t* runs = weight + PROF_BLOCKS;
+        for (uint32_t b = 0; b < PROF_BRANCHES; ++b) runs[b] = prof_block[prof_branch_block[b]];
+        fprintf(f, "hottest branches:\n%14s %14s %14s %6s  %s\n", "executed", "taken", "not taken", "line", "source");
+        n = prof_top(runs, PROF_BRANCHES, top);
+        for (k = 0; k < n; ++k) {
+            uint64_t fall = prof_fall[top[k]] < runs[top[k]] ? prof_fall[top[k]] : runs[top[k]];
+            fprintf(f, "%14llu %14llu %14llu %6u  %s\n", (unsigned long long)runs[top[k]], (unsigned long long)(runs[top[k]] - fall),
+                    (unsigned long long)fall, prof_line[prof_branch_at[top[k]]], prof_src[prof_branch_at[top[k]]]);
+        }
+    }
+)";
+    out << R"(    free(count);
+    if (f != stderr) fclose(f);
+}
+)";
+}
@@ -0,0 +1,218 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+// Compile server. `ezm -server <socket>` warms what every build needs once
+// and then forks a child per request, so requests start warm and run side by
+// side without sharing a working directory or stdio. A client connects, passes
+// its stdin, stdout and stderr across the socket (SCM_RIGHTS) and sends its
+// working directory, arguments and environment; the child adopts all of them,
+// runs the build as if it had been started there, so its output and that of
+// -r programs go straight to the client's terminal, and sends back the exit
+// status. The socket is private to the user that started the server.
+//
+// Request: a uint32 byte count (carrying the three descriptors), then that
+// many bytes of NUL-terminated strings: cwd, argument count, the arguments,
+// then the environment. Reply: the exit status as an int32.
+
+namespace server {
+
+#ifndef _WIN32
+inline bool address(const std::string& path, sockaddr_un& sa) {
+    if (path.empty() || path.size() >= sizeof sa.sun_path) return false;
+    std::memset(&sa, 0, sizeof sa);
+    sa.sun_family = AF_UNIX;
+    std::memcpy(sa.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+inline bool writeAll(int fd, const void* p, size_t n) {
+    for (const char* c = (const char*)p; n;) {
+        ssize_t k = ::write(fd, c, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        c += k; n -= (size_t)k;
+    }
+    return true;
+}
+
+inline bool readAll(int fd, void* p, size_t n) {
+    for (char* c = (char*)p; n;) {
+        ssize_t k = ::read(fd, c, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        c += k; n -= (size_t)k;
+    }
+    return true;
+}
+
+inline int connectTo(const std::string& path) {
+    sockaddr_un sa;
+    if (!address(path, sa)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&sa, sizeof sa) != 0) { close(fd); return -1; }
+    return fd;
+}
+#endif
+
+// Runs argv on the server at path. False when no server answers there, so the
+// caller builds in-process instead.
+inline bool forward(const std::string& path, int argc, char* argv[], int& status) {
+#ifdef _WIN32
+    (void)path; (void)argc; (void)argv; (void)status;
+    return false;
+#else
+    int fd = connectTo(path);
+    if (fd < 0) return false;
+    std::string body;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof cwd)) { close(fd); return false; }
+    body.append(cwd).push_back('\0');
+    body.append(std::to_string(argc - 1)).push_back('\0');
+    for (int i = 1; i < argc; ++i) body.append(argv[i]).push_back('\0');
+    for (char** e = environ; *e; ++e) body.append(*e).push_back('\0');
+
+    uint32_t size = (uint32_t)body.size();
+    int fds[3] = {0, 1, 2};
+    char control[CMSG_SPACE(sizeof fds)] = {};
+    iovec iov{&size, sizeof size};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof fds);
+    std::memcpy(CMSG_DATA(cm), fds, sizeof fds);
+    std::cout.flush();
+    int32_t reply = 1;
+    bool sent = sendmsg(fd, &msg, 0) == (ssize_t)sizeof size && writeAll(fd, body.data(), body.size());
+    if (sent && !readAll(fd, &reply, sizeof reply)) {
+        std::cerr << "ezm server at " << path << " dropped the request\n";
+        reply = 1;
+    }
+    close(fd);
+    if (!sent) return false;
+    status = reply;
+    return true;
+#endif
+}
+
+#ifndef _WIN32
+// The child's side of one request: adopt the client's stdio, directory and
+// environment, run, reply. Never returns.
+[[noreturn]] inline void handle(int conn, const std::function<int(std::vector<std::string>&)>& run) {
+    signal(SIGCHLD, SIG_DFL);           // the build waits for its own gcc children
+    uint32_t size = 0;
+    int fds[3] = {-1, -1, -1};
+    char control[CMSG_SPACE(sizeof fds)] = {};
+    iovec iov{&size, sizeof size};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if (recvmsg(conn, &msg, MSG_WAITALL) != (ssize_t)sizeof size) _exit(1);
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(sizeof fds)) _exit(1);
+    std::memcpy(fds, CMSG_DATA(cm), sizeof fds);
+    std::string body(size, '\0');
+    if (!readAll(conn, body.data(), size)) _exit(1);
+
+    std::vector<std::string> strings;
+    for (size_t b = 0, e; b < body.size(); b = e + 1) {
+        e = body.find('\0', b);
+        if (e == std::string::npos) e = body.size();
+        strings.emplace_back(body, b, e - b);
+    }
+    if (strings.size() < 2) _exit(1);
+    size_t argc = std::strtoul(strings[1].c_str(), nullptr, 10);
+    if (argc > strings.size() - 2) _exit(1);
+    for (int k = 0; k < 3; ++k) { dup2(fds[k], k); close(fds[k]); }
+    if (chdir(strings[0].c_str()) != 0) {
+        std::cerr << "ezm server: cannot enter " << strings[0] << "\n";
+        int32_t reply = 1;
+        writeAll(conn, &reply, sizeof reply);
+        _exit(1);
+    }
+    clearenv();
+    for (size_t k = 2 + argc; k < strings.size(); ++k) putenv(strings[k].data());
+    std::vector<std::string> args(strings.begin() + 2, strings.begin() + 2 + argc);
+
+    int32_t reply = run(args);
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+    writeAll(conn, &reply, sizeof reply);
+    _exit(reply);
+}
+#endif
+
+// Serves requests on path until killed; warm() runs once before the first.
+// Returns only when the socket cannot be set up.
+inline int serve(const std::string& path, const std::function<void()>& warm, const std::function<int(std::vector<std::string>&)>& run) {
+#ifdef _WIN32
+    (void)path; (void)warm; (void)run;
+    std::cerr << "-server needs Unix domain sockets\n";
+    return 1;
+#else
+    sockaddr_un sa;
+    if (!address(path, sa)) { std::cerr << "Bad socket path: " << path << "\n"; return 1; }
+    if (int live = connectTo(path); live >= 0) {
+        close(live);
+        std::cerr << "An ezm server is already listening on " << path << "\n";
+        return 1;
+    }
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) { std::cerr << path << " exists and is not a socket\n"; return 1; }
+        unlink(path.c_str());           // left behind by a server that was killed
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t mask = umask(077);
+    bool bound = fd >= 0 && bind(fd, (sockaddr*)&sa, sizeof sa) == 0;
+    umask(mask);
+    if (!bound || listen(fd, 64) != 0) {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    warm();
+    signal(SIGCHLD, SIG_IGN);           // children are never waited for
+    std::cerr << "ezm server listening on " << path << "\n";
+    for (;;) {
+        int conn = accept(fd, nullptr, nullptr);
+        if (conn < 0) continue;
+        fcntl(conn, F_SETFD, FD_CLOEXEC);   // not inherited by gcc or -r programs
+        std::cout.flush();
+        std::cerr.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fd);
+            handle(conn, run);
+        }
+        if (pid < 0) std::cerr << "ezm server: fork failed: " << std::strerror(errno) << "\n";
+        close(conn);
+    }
+#endif
+}
+
+} // namespace server
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A source file mapped read-only, so lexing reads the page cache directly and
+// nothing is copied. Interned names keep pointing into the mapping, which has
+// to outlive the Program. windows() walks the text a batch of whole lines at
+// a time and drops each batch's pages once it has been handed out, so a pass
+// over a file of any size keeps only one window resident; dropped pages fault
+// back in from the page cache if a name in them is read later. Windows, and
+// files that cannot be mapped, are read into memory instead.
+struct SourceFile {
+    static constexpr size_t Window = 16u << 20;
+
+    std::string_view text;
+
+    SourceFile() = default;
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+    ~SourceFile() {
+#ifndef _WIN32
+        if (map) munmap(map, text.size());
+#endif
+    }
+
+    bool open(const std::string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::close(fd);
+                map = p;
+                text = std::string_view((const char*)p, (size_t)st.st_size);
+                madvise(p, text.size(), MADV_SEQUENTIAL);
+                return true;
+            }
+        }
+        ::close(fd);
+#endif
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        std::stringstream ss; ss << in.rdbuf();
+        copy = ss.str();
+        text = copy;
+        return true;
+    }
+
+    // Gives back the resident pages of text[0, upTo).
+    void release(size_t upTo) {
+#ifndef _WIN32
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t n = std::min(upTo, text.size()) / page * page;
+        if (map && n) madvise(map, n, MADV_DONTNEED);
+#else
+        (void)upTo;
+#endif
+    }
+
+    // fn(window) over consecutive windows of whole lines, about Window bytes each.
+    template<class Fn>
+    void windows(Fn&& fn) {
+        size_t pos = 0, n = text.size();
+        while (pos < n) {
+            size_t end = n;
+            if (n - pos > Window) {
+                size_t nl = text.rfind('\n', pos + Window - 1);
+                if (nl == std::string_view::npos || nl < pos) nl = text.find('\n', pos + Window);
+                end = nl == std::string_view::npos ? n : nl + 1;
+            }
+            fn(text.substr(pos, end - pos));
+            release(end);
+            pos = end;
+        }
+    }
+
+private:
+    void* map = nullptr;
+    std::string copy;
+};
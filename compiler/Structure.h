@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Optimizer.h"
+#include "Translator.h"
+
+// Structured control flow. The branches of one run of instructions become
+// nested C blocks wherever they nest:
+//   loop     a branch back to a label:      do { L: ... } while (c);
+//            or an unconditional one:       for (;;) { L: ... }
+//   if       a branch forward over code:    if (!(c)) { ... } L:
+//   if/else  ... whose skipped code ends in a jump forward again:
+//                                           if (!(c)) { ... } else { L: ... } K:
+// Inside a loop, other branches to just after it become break, and jumps to
+// the top of a for (;;) continue. Everything else stays a goto. Labels stay
+// where they are, so jumps into a block (other entries, the dispatcher,
+// return sites) still land correctly; C allows gotos into blocks, so an
+// irreducible region only costs the gotos it keeps. Candidates are taken
+// innermost first and kept only if they nest with what was taken before.
+
+struct ControlPlan {
+    struct Mark {
+        std::string text;
+        int8_t before = 0, after = 0;   // nesting depth change around text
+    };
+    std::unordered_map<uint32_t, std::vector<Mark>> close, open;   // ahead of an instruction's labels
+    std::unordered_map<uint32_t, Mark> branch;                      // replaces a branch's statement
+    size_t loops = 0, ifs = 0, elses = 0, breaks = 0;
+};
+
+namespace control {
+
+struct Jump {
+    uint32_t to = ~0u;                  // target instruction
+    bool cond = false;
+    std::string test;                   // cond: the C condition
+};
+
+// Blocks live on a grid of two slots per instruction: 2i ahead of its
+// labels, 2i+1 at its statement.
+struct Block {
+    uint32_t a, b, mid = ~0u;           // open and close slot; if/else: the else slot
+    enum Kind : uint8_t { DoWhile, Forever, If, IfElse } kind;
+    uint32_t at, alt = ~0u;             // the branch; if/else: the jump ending the then part
+    Jump jump;
+};
+
+struct Planner {
+    const Program& prog;
+    Translator& tr;
+    const OptimizedText& opt;
+    uint32_t begin, end;
+    std::vector<uint32_t> labelAt;      // by Sym
+    static constexpr uint32_t MaxSpan = 4096;   // longer blocks keep their gotos
+
+    Planner(const Program& p, Translator& t, const OptimizedText& o, uint32_t b, uint32_t e)
+        : prog(p), tr(t), opt(o), begin(b), end(e) {
+        labelAt.assign(prog.syms.size(), ~0u);
+        for (auto& l : prog.labels) labelAt[l.name] = l.at;
+    }
+
+    // The direct jump at i within [begin, end), if it does nothing else.
+    bool jump(uint32_t i, Jump& j) {
+        if (!opt.action.empty() && opt.action[i] == OptimizedText::Drop) return false;
+        const Insn& in = prog.text[i];
+        const SlotProgram* p = tr.find(in.op);
+        if (!p || !(p->flags & TmplBranches) || (p->flags & TmplJumpsPC)) return false;
+        Sym target = 0;
+        for (Sym s : {in.a, in.b, in.c}) if (s && (prog.syms.flags[s] & SymTextLabel)) target = s;
+        if (!target || labelAt[target] < begin || labelAt[target] >= end) return false;
+        j.to = labelAt[target];
+        j.cond = p->flags & TmplConditional;
+        std::string text;
+        if (!opt.action.empty() && opt.action[i] == OptimizedText::Replace) text = opt.replacement.at(i);
+        else if (!tr.translateLine(in, text)) return false;
+        std::string tail = ") goto " + std::string(tr.labelOperand(target)) + ";\n";
+        if (j.cond) {
+            if (p->flags & (TmplLinks | TmplUsesPC)) return false;
+            if (text.compare(0, 8, "    if (") != 0 || text.size() < 8 + tail.size()
+                || text.compare(text.size() - tail.size(), tail.size(), tail) != 0) return false;
+            j.test = text.substr(8, text.size() - 8 - tail.size());
+            return text.find('\n') == text.size() - 1;
+        }
+        std::string go = "goto " + std::string(tr.labelOperand(target)) + ";\n";
+        if (text.size() < go.size() || text.compare(text.size() - go.size(), go.size(), go) != 0) return false;
+        if (!(p->flags & (TmplLinks | TmplUsesPC))) return text == "    " + go;
+        // a call that links into the zero register: a plain jump
+        Sym syms[3];
+        int n = tr.operands(in, syms), d = p->bind[SlotD];
+        return (p->flags & TmplLinks) && tr.foldZero && d >= 0 && d < n
+            && !tr.def->zeroReg.empty() && prog.name(syms[d]) == tr.def->zeroReg;
+    }
+
+    std::vector<Block> taken;
+    std::multimap<uint32_t, size_t> byStart;
+    std::vector<uint8_t> used;          // by instruction - begin: a branch some block consumes
+
+    static bool inside(const Block& in, const Block& out) {
+        return out.a <= in.a && in.b <= out.b && (out.mid == ~0u || in.b <= out.mid || in.a >= out.mid);
+    }
+    bool fits(const Block& c) {
+        if (used[c.at - begin] || (c.alt != ~0u && used[c.alt - begin])) return false;
+        auto from = byStart.lower_bound(c.a > 4 * MaxSpan ? c.a - 4 * MaxSpan : 0);
+        for (auto it = from; it != byStart.end() && it->first < c.b; ++it) {
+            const Block& t = taken[it->second];
+            if (t.b <= c.a || c.b <= t.a) continue;
+            if (!inside(t, c) && !inside(c, t)) return false;
+        }
+        return true;
+    }
+    void take(const Block& c) {
+        used[c.at - begin] = 1;
+        if (c.alt != ~0u) used[c.alt - begin] = 1;
+        byStart.emplace(c.a, taken.size());
+        taken.push_back(c);
+    }
+
+    ControlPlan run(bool breaks) {
+        ControlPlan plan;
+        if (begin >= end) return plan;
+        used.assign(end - begin, 0);
+        std::vector<Jump> jumps(end - begin);
+        std::vector<uint8_t> isJump(end - begin, 0);
+        for (uint32_t i = begin; i < end; ++i) isJump[i - begin] = jump(i, jumps[i - begin]);
+
+        std::vector<Block> loops, ifs;
+        for (uint32_t i = begin; i < end; ++i) {
+            if (!isJump[i - begin]) continue;
+            const Jump& j = jumps[i - begin];
+            if (j.to <= i) {
+                if (i - j.to < MaxSpan) loops.push_back({2 * j.to, 2 * i + 1, ~0u, j.cond ? Block::DoWhile : Block::Forever, i, ~0u, j});
+                continue;
+            }
+            if (!j.cond || j.to == i + 1 || j.to - i >= MaxSpan) continue;
+            uint32_t k = j.to - 1;
+            if (k > i && isJump[k - begin] && !jumps[k - begin].cond && jumps[k - begin].to > j.to && jumps[k - begin].to - i < MaxSpan)
+                ifs.push_back({2 * i + 1, 2 * jumps[k - begin].to, 2 * k + 1, Block::IfElse, i, k, j});
+            ifs.push_back({2 * i + 1, 2 * j.to, ~0u, Block::If, i, ~0u, j});
+        }
+        // An if/else sorts by its then part, just ahead of the plain if it would replace.
+        auto size = [](const Block& x) { return x.kind == Block::IfElse ? x.mid - x.a : x.b - x.a; };
+        auto bySize = [&](const Block& x, const Block& y) { return size(x) < size(y) || (size(x) == size(y) && x.a < y.a); };
+        std::stable_sort(loops.begin(), loops.end(), bySize);
+        std::stable_sort(ifs.begin(), ifs.end(), bySize);
+        for (auto& c : loops) if (fits(c)) take(c);
+        for (auto& c : ifs) if (fits(c)) take(c);
+
+        // Outer blocks open first and close last where they share an instruction.
+        std::vector<const Block*> sorted;
+        for (auto& t : taken) sorted.push_back(&t);
+        std::sort(sorted.begin(), sorted.end(), [](const Block* x, const Block* y) { return x->a < y->a || (x->a == y->a && x->b > y->b); });
+        for (const Block* t : sorted) {
+            const std::string& test = t->jump.test;
+            switch (t->kind) {
+            case Block::DoWhile:
+            case Block::Forever:
+                plan.open[t->a / 2].push_back({t->kind == Block::DoWhile ? "do {" : "for (;;) {", 0, 1});
+                plan.branch[t->at] = {t->kind == Block::DoWhile ? "} while (" + test + ");" : "}", -1, 0};
+                ++plan.loops;
+                break;
+            case Block::IfElse:
+                plan.branch[t->alt] = {"} else {", -1, 1};
+                ++plan.elses;
+                [[fallthrough]];
+            case Block::If:
+                plan.branch[t->at] = {"if (!(" + test + ")) {", 0, 1};
+                ++plan.ifs;
+                break;
+            }
+        }
+        for (auto it = sorted.rbegin(); it != sorted.rend(); ++it)
+            if ((*it)->kind == Block::If || (*it)->kind == Block::IfElse) plan.close[(*it)->b / 2].push_back({"}", -1, 0});
+
+        if (breaks) {
+            // The innermost loop around each remaining jump: smaller loops mark last.
+            std::vector<const Block*> loop(end - begin, nullptr);
+            for (const Block* t : sorted)
+                if (t->kind == Block::DoWhile || t->kind == Block::Forever)
+                    for (uint32_t i = t->a / 2; i < t->at; ++i) loop[i - begin] = t;
+            for (uint32_t i = begin; i < end; ++i) {
+                const Block* l = loop[i - begin];
+                if (!l || !isJump[i - begin] || used[i - begin]) continue;
+                const Jump& j = jumps[i - begin];
+                const char* stmt = j.to == l->at + 1 ? "break;"
+                                 : l->kind == Block::Forever && j.to == l->a / 2 ? "continue;" : nullptr;
+                if (!stmt) continue;
+                plan.branch[i] = {j.cond ? "if (" + j.test + ") " + stmt : std::string(stmt), 0, 0};
+                ++plan.breaks;
+            }
+        }
+        return plan;
+    }
+};
+
+} // namespace control
+
+// The plan for instructions [begin, end). breaks off keeps the jumps out of
+// loops as gotos (a profile counts the statements just after a loop).
+inline ControlPlan planControl(const Program& prog, Translator& tr, const OptimizedText& opt, uint32_t begin, uint32_t end, bool breaks) {
+    return control::Planner(prog, tr, opt, begin, end).run(breaks);
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "AsmDefinition.h"
+#include "Memory.h"
+
+// Synthetic .ezm programs for -bench and -fuzz. A program is a loop over `insns`
+// generated instructions, split into blocks of eight behind a label each:
+// register ALU operations, word loads and stores into a 256-byte data
+// buffer, forward branches to the next block and, for print-heavy programs,
+// output lines (a register in decimal and a newline, two system calls). The
+// mix gives the share of each kind in percent. The loop runs `iters` times, then RISC-V programs
+// exit with a checksum of the registers (MIPS with 0). The same spec and
+// seed always give the same program.
+
+struct SynthSpec {
+    size_t insns = 20000;
+    unsigned alu = 70, mem = 20, branch = 10, io = 0;
+    uint32_t iters = 0;                 // 0: about 50M instructions in total
+    uint64_t seed = 1;
+    bool compares = false;              // also slt/sltu/sra and signed branches (-fuzz)
+};
+
+inline std::string synthProgram(const AsmDefinition* def, const SynthSpec& spec) {
+    const bool mips = def->GT.find("MIPS") != std::string_view::npos;
+    const bool wide = def->xlen == 64;
+    uint64_t state = spec.seed * 0x9E3779B97F4A7C15ull + 1;
+    auto next = [&](uint32_t bound) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        return (uint32_t)(state % bound);
+    };
+    // Working registers, the buffer base and the loop counter.
+    static const char* const riscv[] = {"x5","x6","x7","x8","x9","x10","x11","x12","x13","x14","x15","x16","x18","x19","x20","x21","x22","x23","x24","x25","x26","x27"};
+    static const char* const mipsRegs[] = {"$t0","$t1","$t2","$t3","$t4","$t5","$t6","$t7","$s0","$s1","$s2","$s3","$s4","$s5","$t8","$t9"};
+    const char* const* regs = mips ? mipsRegs : riscv;
+    const uint32_t nregs = mips ? 16 : 22;
+    const char* base = mips ? "$s7" : "x28";
+    const char* count = mips ? "$s6" : "x29";
+    const char* zero = mips ? "$zero" : "x0";
+    // With compares, the ops past the first seven (six) also read the upper
+    // bits, so a result left wider than the architecture changes the output.
+    static const char* const riscvAlu[] = {"add","sub","xor","or","and","sll","srl","slt","sltu","sra"};
+    static const char* const mipsAlu[] = {"addu","subu","xor","or","and","nor","sllv","slt","sltu","srav"};
+    static const char* const riscvImm[] = {"addi","xori","ori","andi","slli","srli","slti","srai"};
+    static const char* const mipsImm[] = {"addiu","xori","ori","andi","sll","srl","slti","sra"};
+    const uint32_t aluOps = spec.compares ? 10 : 7, immOps = spec.compares ? 8 : 6;
+    const char* const* alu = mips ? mipsAlu : riscvAlu;
+    const char* const* imm = mips ? mipsImm : riscvImm;
+    uint32_t iters = spec.iters ? spec.iters : (uint32_t)std::max<size_t>(1, 50000000 / std::max<size_t>(1, spec.insns));
+    unsigned total = std::max(1u, spec.alu + spec.mem + spec.branch + spec.io);
+
+    std::string out;
+    out.reserve(spec.insns * 24 + 1024);
+    out += ";! " + def->fullName() + " !;\n.data\nbuf: .word ";
+    for (int k = 0; k < 64; ++k) out += std::to_string(k * 2654435761u % 1000) + (k < 63 ? "," : "\n");
+    out += ".text\nmain:\n";
+    out += "    li " + std::string(base) + ", " + std::to_string(DataBase) + "\n";
+    out += "    li " + std::string(count) + ", " + std::to_string(iters) + "\n";
+    for (uint32_t r = 0; r < nregs; ++r) out += "    li " + std::string(regs[r]) + ", " + std::to_string(r * 37 + 1) + "\n";
+    out += "loop:\n";
+    auto reg = [&]{ return std::string(regs[next(nregs)]); };
+    for (size_t i = 0; i < spec.insns; ++i) {
+        size_t block = i / 8;
+        if (i % 8 == 0) out += "B" + std::to_string(block) + ":\n";
+        unsigned kind = next(total);
+        if (kind < spec.alu) {
+            if (next(2)) out += std::string("    ") + alu[next(aluOps)] + " " + reg() + ", " + reg() + ", " + reg() + "\n";
+            else {
+                uint32_t k = next(immOps);
+                uint32_t v = k == 4 || k == 5 || k == 7 ? next(31) + 1 : next(2047);
+                out += std::string("    ") + imm[k] + " " + reg() + ", " + reg() + ", " + std::to_string(v) + "\n";
+            }
+        } else if (kind < spec.alu + spec.mem) {
+            bool dword = wide && next(2);
+            uint32_t off = dword ? next(32) * 8 : next(64) * 4;
+            const char* op = next(2) ? (dword ? "ld" : "lw") : (dword ? "sd" : "sw");
+            out += std::string("    ") + op + " " + reg() + ", " + std::to_string(off) + "(" + base + ")\n";
+        } else if (kind < spec.alu + spec.mem + spec.branch) {
+            // Taken or not, the branch lands on the next block.
+            std::string to = "B" + std::to_string(block + 1);
+            switch (spec.compares ? next(3) : 0) {
+            case 0: out += "    bne " + reg() + ", " + reg() + ", " + to + "\n"; break;
+            case 1: out += mips ? "    bltz " + reg() + ", " + to + "\n" : "    blt " + reg() + ", " + reg() + ", " + to + "\n"; break;
+            default: out += mips ? "    bgez " + reg() + ", " + to + "\n" : "    bge " + reg() + ", " + reg() + ", " + to + "\n"; break;
+            }
+        } else if (mips) {
+            out += "    move $a0, " + reg() + "\n    li $v0, 1\n    syscall\n    li $a0, 10\n    li $v0, 11\n    syscall\n";
+        } else {
+            out += "    mv a0, " + reg() + "\n    li a7, 1\n    ecall\n    li a0, 10\n    li a7, 11\n    ecall\n";
+        }
+    }
+    out += "B" + std::to_string((spec.insns + 7) / 8) + ":\n";
+    out += std::string("    ") + (mips ? "addiu " : "addi ") + count + ", " + count + ", -1\n";
+    out += "    bne " + std::string(count) + ", " + zero + ", loop\n";
+    if (mips) out += "    li $v0, 10\n    syscall\n";
+    else {
+        out += "    mv a0, " + std::string(regs[0]) + "\n";
+        for (uint32_t r = 1; r < nregs; ++r) out += "    xor a0, a0, " + std::string(regs[r]) + "\n";
+        out += "    andi a0, a0, 255\n    li a7, 93\n    ecall\n";
+    }
+    return out;
+}
+
+// The -scale kernel for a multi-hart architecture: `items` independent
+// xorshift steps, hart k taking items k, k + n, k + 2n, ... of n. Each hart
+// adds its sum to a shared total with amoadd.d and counts itself done with
+// amoadd.w; hart 0 then waits with lr.w until all n are, prints the total and
+// exits with its low byte, which is the same for any number of harts.
+inline std::string synthParallel(const AsmDefinition* def, uint64_t items) {
+    std::string out = ";! " + def->fullName() + " !;\n.data\ntotal: .dword 0\ndone: .word 0\n.text\nmain:\n";
+    out += "    li x5, " + std::to_string(items) + "\n";
+    out += R"(    mv x6, a0
+    li x7, 0
+    bgeu x6, x5, fold
+item:
+    addi x8, x6, 1
+    slli x9, x8, 13
+    xor x8, x8, x9
+    srli x9, x8, 7
+    xor x8, x8, x9
+    slli x9, x8, 17
+    xor x8, x8, x9
+    srli x9, x8, 48
+    add x7, x7, x9
+    add x6, x6, a1
+    bltu x6, x5, item
+fold:
+    la x28, total
+    amoadd.d x0, x7, (x28)
+    la x29, done
+    li x30, 1
+    amoadd.w x0, x30, (x29)
+    bne a0, x0, end
+wait:
+    lr.w x30, (x29)
+    bne x30, a1, wait
+    amoor.d x31, x0, (x28)
+    mv a0, x31
+    li a7, 1
+    ecall
+    li a0, 10
+    li a7, 11
+    ecall
+    andi a0, x31, 255
+    li a7, 93
+    ecall
+end:
+)";
+    return out;
+}
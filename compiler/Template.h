@@ -0,0 +1,134 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A template such as "{d} = {s1} + {imm};" is split at compile time into
+// literal pieces and operand slots, so emitting an instruction is a run of
+// appends. Pieces, literal text and written-state names live in pools owned
+// by the architecture table; a SlotProgram only holds offsets into them.
+// Templates read PC as the address of their own instruction, and assigning
+// PC jumps to whatever instruction address the value holds.
+
+enum TemplateSlot : uint8_t { SlotD, SlotS1, SlotS2, SlotImm, SlotAddr, SlotLabel, SlotNone = 0xFF };
+
+enum TemplateFlag : uint8_t {
+    TmplUsesMem   = 1,      // load_*/store_* on guest memory
+    TmplBranches  = 2,      // goto: a direct jump or branch, so the basic block ends here
+    TmplUsesPC    = 4,
+    TmplRuntime   = 8,      // calls system_call()/debug_break()
+    TmplJumpsPC   = 16,     // assigns PC: an indirect jump, always the template's last statement
+    TmplLinks     = 32,     // reads PC and transfers control, so the next instruction is a return site
+    TmplConditional = 64,   // the goto is guarded by an if
+    TmplAtomic    = 128,    // amo_*: LR/SC, AMOs and fences (also TmplUsesMem)
+};
+
+struct TemplatePiece { uint16_t lit, len; uint8_t slot; };   // lits[lit, lit+len) then slot
+struct TemplateName  { uint16_t lit, len; };
+
+struct SlotProgram {
+    uint16_t piece = 0, pieceCount = 0;
+    uint16_t write = 0, writeCount = 0;    // state the template assigns itself (LO, $ra, a7, ...)
+    // Assembly operands fill the slots present in this order: {d}, {s1}, {s2},
+    // then whichever of {imm}/{addr}/{label} the template uses.
+    int8_t bind[4] = {-1, -1, -1, -1};
+    uint8_t arity = 0;
+    uint8_t flags = 0;
+
+    constexpr int operandFor(uint8_t slot) const { return bind[slot < SlotImm ? slot : 3]; }
+};
+
+struct TemplateSizes { size_t lits = 0, pieces = 0, writes = 0; };
+
+constexpr bool tmplIdentChar(char c) {
+    return (c>='a' && c<='z') || (c>='A' && c<='Z') || (c>='0' && c<='9') || c=='_';
+}
+constexpr bool tmplIdentStart(char c) { return (c>='a' && c<='z') || (c>='A' && c<='Z'); }
+
+// Upper bounds for the pool space one template needs.
+constexpr TemplateSizes measureTemplate(std::string_view t) {
+    TemplateSizes s;
+    s.lits = t.size();
+    s.pieces = 1;
+    for (char c : t) { if (c=='{') ++s.pieces; if (c=='=') ++s.writes; }
+    return s;
+}
+
+template<size_t L, size_t P, size_t W>
+struct TemplatePools {
+    char lits[L + 1] = {};
+    TemplatePiece pieces[P + 1] = {};
+    TemplateName writes[W + 1] = {};
+    size_t litCount = 0, pieceCount = 0, writeCount = 0;
+
+    constexpr void put(char c) { lits[litCount++] = c; }
+
+    constexpr SlotProgram compile(std::string_view t) {
+        constexpr std::string_view keys[] = {"{d}", "{s1}", "{s2}", "{imm}", "{addr}", "{label}"};
+        SlotProgram p;
+        p.piece = (uint16_t)pieceCount;
+        p.write = (uint16_t)writeCount;
+        bool present[4] = {false, false, false, false};
+        size_t litStart = litCount;
+        size_t prevWord = 0, prevLen = 0;      // last identifier, if only blanks followed it
+        bool readsPC = false;
+        auto flush = [&](uint8_t slot) {
+            pieces[pieceCount++] = {(uint16_t)litStart, (uint16_t)(litCount - litStart), slot};
+            litStart = litCount;
+        };
+        for (size_t i=0; i<t.size();) {
+            uint8_t slot = SlotNone;
+            if (t[i]=='{')
+                for (uint8_t k=0; k<6; ++k)
+                    if (t.substr(i, keys[k].size()) == keys[k]) { slot = k; break; }
+            if (slot != SlotNone) {
+                flush(slot);
+                present[slot < SlotImm ? slot : 3] = true;
+                i += keys[slot].size();
+                prevLen = 0;
+                continue;
+            }
+            // '$' is not an identifier character in C; registers like $ra become _ra.
+            bool dollar = t[i]=='$' && i+1<t.size() && tmplIdentChar(t[i+1]);
+            if ((dollar || tmplIdentStart(t[i])) && (i==0 || !tmplIdentChar(t[i-1]))) {
+                size_t e = i+1; while (e<t.size() && tmplIdentChar(t[e])) ++e;
+                size_t start = litCount;
+                put(dollar ? '_' : t[i]);
+                for (size_t j=i+1; j<e; ++j) put(t[j]);
+                size_t k = e; while (k<t.size() && t[k]==' ') ++k;
+                bool assigned = k<t.size() && t[k]=='=' && (k+1>=t.size() || t[k+1]!='=');
+                bool declared = prevLen>2 && lits[prevWord+prevLen-2]=='_' && lits[prevWord+prevLen-1]=='t';
+                if (assigned && !declared) writes[writeCount++] = {(uint16_t)start, (uint16_t)(e-i)};
+                if (t.substr(i, e-i) == "PC") {
+                    if (assigned) p.flags |= TmplJumpsPC;
+                    else readsPC = true;
+                }
+                prevWord = start; prevLen = e-i;
+                i = e;
+                continue;
+            }
+            if (t[i]!=' ') prevLen = 0;
+            put(t[i++]);
+        }
+        if (litStart < litCount || pieceCount == p.piece) flush(SlotNone);
+        p.pieceCount = (uint16_t)(pieceCount - p.piece);
+        p.writeCount = (uint16_t)(writeCount - p.write);
+        for (int k=0; k<4; ++k)
+            if (present[k]) p.bind[k] = (int8_t)p.arity++;
+        if (t.find("load_") != std::string_view::npos || t.find("store_") != std::string_view::npos)
+            p.flags |= TmplUsesMem;
+        if (t.find("amo_") != std::string_view::npos)
+            p.flags |= TmplAtomic | TmplUsesMem;
+        if (t.find("PC") != std::string_view::npos)     p.flags |= TmplUsesPC;
+        if (t.find("goto") != std::string_view::npos) {
+            p.flags |= TmplBranches;
+            if (t.find("if (") != std::string_view::npos || t.find("if(") != std::string_view::npos)
+                p.flags |= TmplConditional;
+        }
+        if (readsPC && ((p.flags & TmplJumpsPC) || t.find("goto") != std::string_view::npos))
+            p.flags |= TmplLinks;
+        if (t.find("system_call") != std::string_view::npos || t.find("debug_break") != std::string_view::npos)
+            p.flags |= TmplRuntime;
+        return p;
+    }
+};
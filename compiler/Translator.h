@@ -0,0 +1,174 @@
+#pragma once
+#include <cctype>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "AsmDefinition.h"
+#include "Memory.h"
+#include "Program.h"
+
+static inline std::string sanitizeIdent(std::string_view v) {
+    std::string s(v);
+    for (char& c : s)
+        if (!std::isalnum((unsigned char)c) && c != '_') c = '_';
+    return s;
+}
+
+inline std::string resolveOperand(Sym sym, const Program& prog) {
+    std::string tok(prog.name(sym));
+    if (tok.empty()) return tok;
+
+    size_t lp = tok.find('(');
+    size_t rp = tok.find(')');
+    if (lp != std::string::npos && rp != std::string::npos && rp > lp) {
+        std::string imm = tok.substr(0, lp);
+        std::string reg = tok.substr(lp + 1, rp - lp - 1);
+        auto trim = [](std::string s){
+            size_t a = s.find_first_not_of(" \t");
+            size_t b = s.find_last_not_of(" \t");
+            return (a==std::string::npos)?std::string():s.substr(a,b-a+1);
+        };
+        imm = trim(imm);
+        reg = sanitizeIdent(trim(reg));
+        if (imm.empty()) imm = "0";
+        return "(" + reg + " + " + imm + ")";
+    }
+
+    return tok;
+}
+
+// Templates and rendered operands are resolved once per distinct symbol, so
+// translating a line is a table lookup followed by appends into one buffer.
+struct Translator {
+    const Program& prog;
+    const AsmDefinition* def;
+    const DataImage& image;             // data labels render as their guest addresses
+    std::vector<const SlotProgram*> tmpl;
+    std::vector<uint32_t> textIndex;    // by Sym: instruction a text label names, so it can render as TextBase + 4*i
+    std::vector<std::string> value, label;
+    std::vector<uint8_t> state;         // bit 0: template looked up, 1: value rendered, 2: label rendered
+    uint8_t flags = 0;                  // TemplateFlag union over translated lines
+    std::set<std::string> writes;       // state assigned by the templates that were used
+    bool foldZero = true;               // read the zero register as 0, send writes to _discard
+    bool discards = false;              // some write went to _discard
+    uint64_t textBase = TextBase;       // address of instruction 0; a module of a multi-file program sits higher
+    std::string dataBase;               // non-empty: data labels render as offsets from this C expression
+
+    Translator(const Program& p, const AsmDefinition* d, const DataImage& img) : prog(p), def(d), image(img) {}
+
+    void grow() {
+        size_t n = prog.syms.size();
+        if (tmpl.size() < n) { tmpl.resize(n, nullptr); value.resize(n); label.resize(n); state.resize(n, 0); }
+    }
+    const SlotProgram* find(Sym op) {
+        grow();
+        if (!(state[op] & 1)) {
+            state[op] |= 1;
+            tmpl[op] = def->find(prog.name(op));
+        }
+        return tmpl[op];
+    }
+    std::string_view operand(Sym s) {
+        if (!(state[s] & 2)) {
+            state[s] |= 2;
+            if (prog.syms.flags[s] & SymImport) {
+                value[s] = "ezm_sym_" + sanitizeIdent(prog.name(s));
+                return value[s];
+            }
+            if (prog.syms.isLabel(s)) {
+                uint64_t at = image.address[s];
+                bool data = prog.syms.flags[s] & SymDataLabel;
+                if (!data) {
+                    if (textIndex.empty()) {
+                        textIndex.assign(prog.syms.size(), 0);
+                        for (auto& l : prog.labels) textIndex[l.name] = l.at;
+                    }
+                    at = textBase + 4ull * textIndex[s];
+                }
+                char hex[24];
+                if (data && !dataBase.empty()) {
+                    std::snprintf(hex, sizeof hex, " + 0x%llx)", (unsigned long long)(at - DataBase));
+                    value[s] = "(" + dataBase + hex;
+                    return value[s];
+                }
+                std::snprintf(hex, sizeof hex, "0x%llx", (unsigned long long)at);
+                value[s] = hex;
+                return value[s];
+            }
+            std::string t = resolveOperand(s, prog);
+            bool keep = t.empty() || std::isdigit((unsigned char)t[0])
+                || t.find("x") != std::string::npos || t.find("&") != std::string::npos
+                || t.find("+") != std::string::npos || t.find("-") != std::string::npos;
+            value[s] = keep ? std::move(t) : sanitizeIdent(t);
+            if (foldZero && !def->zeroReg.empty()) {
+                std::string base = "(" + sanitizeIdent(def->zeroReg) + " + ";
+                if (value[s].compare(0, base.size(), base) == 0) value[s].replace(0, base.size(), "(0 + ");
+            }
+        }
+        return value[s];
+    }
+    std::string_view labelOperand(Sym s) {
+        if (!(state[s] & 4)) { state[s] |= 4; label[s] = sanitizeIdent(prog.name(s)); }
+        return label[s];
+    }
+
+    // The instruction's operands in slot order; stores list the value after the address.
+    int operands(const Insn& in, Sym out[3]) const {
+        std::string_view opcode = prog.name(in.op);
+        Sym sa = in.a, sb = in.b, sc = in.c;
+        if (opcode=="sb" || opcode=="sh" || opcode=="sw" || opcode=="sd") {
+            if (!sc && sa && sb) {
+                sc = sa;
+                sa = 0;
+            }
+        }
+        int n = 0;
+        for (Sym s : {sa, sb, sc})
+            if (s) out[n++] = s;
+        return n;
+    }
+
+    // override[k], when non-empty, replaces the rendered k-th operand (the optimizer's rewrites).
+    bool translateLine(const Insn& in, std::string& out, const std::string* override = nullptr) {
+        const SlotProgram* p = find(in.op);
+        if (!p) return false;
+        // Operands fill the template's slots in order; resolveOperand still needs
+        // the full "imm(base)" form (e.g., "0(x1)") to turn it into "(x1 + 0)".
+        Sym syms[3];
+        std::string_view ops[3], labels[3];
+        int n = operands(in, syms);
+        for (int k = 0; k < n; ++k) {
+            Sym s = syms[k];
+            ops[k] = operand(s);
+            labels[k] = labelOperand(s);
+            if (foldZero && prog.name(s) == def->zeroReg && !def->zeroReg.empty())
+            {
+                ops[k] = k == p->bind[SlotD] ? "_discard" : "0";
+                discards |= k == p->bind[SlotD];
+            }
+            if (override && !override[k].empty()) ops[k] = override[k];
+        }
+        flags |= p->flags;
+        for (size_t k = 0; k < p->writeCount; ++k) writes.emplace(def->write(*p, k));
+        out += "    ";
+        def->emit(*p, ops, labels, out);
+        out += '\n';
+        return true;
+    }
+
+    // flags, writes and discards for a prelude written before any line is
+    // translated (streaming): every opcode the program uses counts, and a zero
+    // register that appears as any operand gets a _discard.
+    void assumeProgram() {
+        for (Sym s=1; s<prog.syms.size(); ++s)
+            if (prog.syms.flags[s] & SymOpcode)
+                if (const SlotProgram* p = find(s)) {
+                    flags |= p->flags;
+                    for (size_t k = 0; k < p->writeCount; ++k) writes.emplace(def->write(*p, k));
+                }
+        auto zero = prog.syms.index.find(def->zeroReg);
+        discards |= foldZero && !def->zeroReg.empty() && zero != prog.syms.index.end() && (prog.syms.flags[zero->second] & SymOperand);
+    }
+};
@@ -1,10 +1,12 @@
-#pragma once
-#include "../comp/RISCVRV32I.h"
-#include "../comp/RISCVRV64I.h"
-#include "../comp/MIPS32.h"
-
-inline std::vector<AsmDefinition*> architectures = {
-    &RISCVRV32I,
-    &RISCVRV64I,
-    &MIPS32
-};
\ No newline at end of file
+#pragma once
+#include "../comp/RISCVRV32I.h"
+#include "../comp/RISCVRV64I.h"
+#include "../comp/RISCVRV64IA.h"
+#include "../comp/MIPS32.h"
+
+inline constexpr const AsmDefinition* architectures[] = {
+    &RISCVRV32I,
+    &RISCVRV64I,
+    &RISCVRV64IA,
+    &MIPS32
+};
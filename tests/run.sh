@@ -0,0 +1,52 @@
+#!/bin/sh
+# Regression corpus. Every tests/<name>.ezm runs in each mode below and must
+# print exactly tests/<name>.out and exit with tests/<name>.status.
+#
+#   tests/run.sh [path/to/ezm]          (default: ./ezm)
+#
+# Builds run in a scratch directory with -nocache, so gcc sees every one.
+
+ezm=${1:-./ezm}
+case $ezm in /*) ;; *) ezm=$PWD/$ezm ;; esac
+[ -x "$ezm" ] || { echo "no ezm at $ezm" >&2; exit 2; }
+dir=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 2
+
+runs=0
+failed=0
+for src in "$dir"/*.ezm; do
+    name=$(basename "$src" .ezm)
+    want=$(cat "$dir/$name.status")
+    for mode in default -O -interp -native "-split 4" -nostruct; do
+        runs=$((runs + 1))
+        rm -f "$name.exe" out
+        if [ "$mode" = -interp ]; then
+            "$ezm" -interp "$src" >out 2>log </dev/null
+            got=$?
+        else
+            flags=
+            [ "$mode" = default ] || flags=$mode
+            "$ezm" -nocache $flags "$src" >log 2>&1
+            if [ ! -x "$name.exe" ]; then
+                echo "FAIL $name ($mode): did not build"
+                sed 's/^/    /' log
+                failed=$((failed + 1))
+                continue
+            fi
+            "./$name.exe" >out 2>>log </dev/null
+            got=$?
+        fi
+        if [ "$got" != "$want" ]; then
+            echo "FAIL $name ($mode): exit $got, expected $want"
+            failed=$((failed + 1))
+        elif ! cmp -s out "$dir/$name.out"; then
+            echo "FAIL $name ($mode): output differs"
+            diff "$dir/$name.out" out | head -10 | sed 's/^/    /'
+            failed=$((failed + 1))
+        fi
+    done
+done
+echo "$runs runs, $failed failed"
+[ "$failed" -eq 0 ]